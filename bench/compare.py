@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""Compares two ys-throughput JSON results, baseline first:
+
+    bench/compare.py baseline.json current.json [--threshold 5]
+
+Prints the throughput change of every phase and size present in both, and
+exits with 1 if any got slower by more than the threshold in percent.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)["results"]
+    return {(r["phase"], r["size"]): r for r in results}
+
+
+def mb_per_s(result):
+    return result["bytes"] / result["ns"] * 1e3
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=5.0)
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressed = False
+    print("%-8s %10s %12s %12s %8s" %
+          ("phase", "size", "base MB/s", "new MB/s", "change"))
+    for key in sorted(baseline, key=lambda k: (k[1], k[0])):
+        if key not in current:
+            continue
+        before = mb_per_s(baseline[key])
+        after = mb_per_s(current[key])
+        change = (after / before - 1) * 100
+        mark = ""
+        if change < -args.threshold:
+            mark = "  slower"
+            regressed = True
+        print("%-8s %10d %12.2f %12.2f %+7.1f%%%s" %
+              (key[0], key[1], before, after, change, mark))
+
+    return 1 if regressed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
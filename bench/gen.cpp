@@ -0,0 +1,32 @@
+// ys-gen writes a synthetic program to stdout, for benchmarking outside the
+// throughput harness:
+//
+//   ys-gen --size 1048576 --if-chain 16 > big.yz
+
+#include <iostream>
+
+#include "../third_party/cmdline.h"
+#include "./generator.hpp"
+
+int main(int argc, char *argv[]) {
+  cmdline::parser cmd;
+  cmd.add<size_t>("size", 0, "minimum size in bytes", false, 0);
+  cmd.add<unsigned>("functions", 0, "number of functions", false, 32);
+  cmd.add<unsigned>("depth", 0, "expression depth", false, 4);
+  cmd.add<unsigned>("structs", 0, "number of struct types", false, 4);
+  cmd.add<unsigned>("if-chain", 0, "branches of each if/else chain", false,
+                    4);
+  cmd.add<uint64_t>("seed", 0, "random seed", false, 1);
+  cmd.parse_check(argc, argv);
+
+  yslang::ProgramShape shape;
+  shape.functions = cmd.get<unsigned>("functions");
+  shape.expr_depth = cmd.get<unsigned>("depth");
+  shape.structs = cmd.get<unsigned>("structs");
+  shape.if_chain = cmd.get<unsigned>("if-chain");
+  shape.seed = cmd.get<uint64_t>("seed");
+
+  std::cout << yslang::ProgramGenerator(shape).generate(
+      cmd.get<size_t>("size"));
+  return 0;
+}
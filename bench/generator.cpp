@@ -0,0 +1,134 @@
+#include "./generator.hpp"
+
+using namespace yslang;
+
+static const char *const field_names[] = { "a", "b", "c", "d" };
+
+std::string ProgramGenerator::generate() {
+  return generate(0);
+}
+
+std::string ProgramGenerator::generate(size_t bytes) {
+  state = shape.seed;
+  std::string out;
+  for (unsigned i = 0; i < shape.structs; i++) {
+    writeStruct(out, i);
+  }
+
+  unsigned index = 0;
+  while (index < shape.functions || out.size() < bytes) {
+    current = index;
+    writeFunction(out, index++);
+  }
+  current = index;
+  writeMain(out);
+  return out;
+}
+
+// type S1 struct {
+//   a i64;
+//   b i64;
+// }
+void ProgramGenerator::writeStruct(std::string &out, unsigned index) {
+  out += "type S" + std::to_string(index) + " struct {\n";
+  for (unsigned i = 0; i < 2 + index % 3; i++) {
+    out += "  " + std::string(field_names[i]) + " i64;\n";
+  }
+  out += "}\n\n";
+}
+
+// func f3(x i64, y i64) i64 {
+//   let p S1;
+//   p.a = <expr>;
+//   p.b = <expr>;
+//   let t = <expr>;
+//   if t < 10 {
+//     t = <expr>;
+//   } else if t < 20 {
+//   ...
+//   }
+//   return t + p.a;
+// }
+void ProgramGenerator::writeFunction(std::string &out, unsigned index) {
+  out += "func f" + std::to_string(index) + "(x i64, y i64) i64 {\n";
+
+  bool has_struct = shape.structs > 0;
+  if (has_struct) {
+    out += "  let p S" + std::to_string(index % shape.structs) + ";\n";
+    out += "  p.a = ";
+    writeExpr(out, shape.expr_depth, false);
+    out += ";\n  p.b = ";
+    writeExpr(out, shape.expr_depth, false);
+    out += ";\n";
+  }
+
+  out += "  let t = ";
+  writeExpr(out, shape.expr_depth, has_struct);
+  out += ";\n";
+
+  for (unsigned i = 0; i < shape.if_chain; i++) {
+    out += i == 0 ? "  if t < " : " else if t < ";
+    out += std::to_string((i + 1) * 10) + " {\n    t = ";
+    writeExpr(out, shape.expr_depth, has_struct);
+    out += ";\n  }";
+  }
+  if (shape.if_chain > 0) {
+    out += " else {\n    t = t - 1;\n  }\n";
+  }
+
+  out += has_struct ? "  return t + p.a;\n}\n\n" : "  return t;\n}\n\n";
+}
+
+// Without grouping parentheses, depth comes from operator chains and from
+// call arguments.
+void ProgramGenerator::writeExpr(std::string &out, unsigned depth,
+                                 bool has_locals) {
+  if (depth == 0) {
+    writeLeaf(out, has_locals);
+    return;
+  }
+
+  static const char *const ops[] = { " + ", " - ", " * " };
+  if (current > 0 && pick(4) == 0) {
+    out += "f" + std::to_string(pick(current)) + "(";
+    writeExpr(out, depth - 1, has_locals);
+    out += ", ";
+    writeLeaf(out, has_locals);
+    out += ")";
+  } else {
+    writeLeaf(out, has_locals);
+  }
+  out += ops[pick(3)];
+  writeExpr(out, depth - 1, has_locals);
+}
+
+void ProgramGenerator::writeLeaf(std::string &out, bool has_locals) {
+  switch (pick(has_locals ? 4 : 3)) {
+  case 0:
+    out += "x";
+    break;
+  case 1:
+    out += "y";
+    break;
+  case 2:
+    out += std::to_string(pick(1000));
+    break;
+  default:
+    out += pick(2) == 0 ? "p.a" : "p.b";
+    break;
+  }
+}
+
+void ProgramGenerator::writeMain(std::string &out) {
+  out += "func main() i64 {\n  return ";
+  out += current > 0 ? "f" + std::to_string(current - 1) + "(1, 2)" : "0";
+  out += ";\n}\n";
+}
+
+// splitmix64
+uint64_t ProgramGenerator::next() {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace yslang {
+struct ProgramShape {
+  // Functions per program; generate(bytes) adds more until it is long
+  // enough.
+  unsigned functions = 32;
+  // Nesting of each expression, through operators and call arguments.
+  unsigned expr_depth = 4;
+  unsigned structs = 4;
+  // Branches of the if/else if chain in every function.
+  unsigned if_chain = 4;
+  uint64_t seed = 1;
+};
+
+// Writes synthetic programs for the throughput benchmarks. The output only
+// depends on the shape, so the same shape always measures the same input;
+// every program also compiles, so codegen can be measured on it.
+class ProgramGenerator {
+public:
+  ProgramGenerator(const ProgramShape &shape) : shape(shape) {}
+
+  std::string generate();
+  // At least `bytes` long: the shape's functions, then more in the same
+  // style.
+  std::string generate(size_t bytes);
+
+private:
+  void writeStruct(std::string &out, unsigned index);
+  void writeFunction(std::string &out, unsigned index);
+  void writeExpr(std::string &out, unsigned depth, bool has_locals);
+  void writeLeaf(std::string &out, bool has_locals);
+  void writeMain(std::string &out);
+
+  // A fixed generator instead of <random>, whose distributions differ
+  // between standard libraries.
+  uint64_t next();
+  unsigned pick(unsigned n) { return unsigned(next() % n); }
+
+private:
+  ProgramShape shape;
+  uint64_t state = 0;
+  // The function being written; calls only go to earlier ones.
+  unsigned current = 0;
+};
+} // namespace yslang
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Runs the compute kernels in bench/kernels/ in every execution mode and
+compares them with their C references. From the build directory:
+
+    ../bench/kernels.py [--runs 11] [--budget 10] [--modes O2,vm]
+                        [--kernels fib,scan] [--output kernels.json]
+
+Modes are the native code of `ys -O0` to `-O3`, linked with cc, and
+`ys vm --tiered`, `ys vm` and `ys interp`. Each kernel is also built with
+`cc -O2`. Every mode runs --runs times, or fewer once it has spent --budget
+seconds, but at least once; times are wall clock of the whole process,
+including parsing for the VM and interpreter.
+
+Prints the median and p99 in milliseconds and the ratio of the medians to
+C, and exits with 1 if a mode's exit status, which every kernel derives
+from its result, differs from C's.
+
+    fib        recursion: naive Fibonacci, a call per node
+    scan       array scans: sums, maxima and counts over an array
+    particles  struct-heavy updates: particles bouncing in a box
+    strings    string handling: pattern search and hashing over character
+               codes, since yslang has no string values at run time
+    collatz    branchy code: Collatz lengths and their classification
+"""
+
+import argparse
+import json
+import math
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+KERNELS = ["fib", "scan", "particles", "strings", "collatz"]
+MODES = ["O0", "O1", "O2", "O3", "tiered", "vm", "interp"]
+
+
+def build(args, kernel, mode, workdir):
+    """Returns the command that runs `kernel` in `mode`."""
+    source = os.path.join(args.kernel_dir, kernel + ".yz")
+    if mode == "c":
+        binary = os.path.join(workdir, kernel + "-c")
+        subprocess.run([args.cc, "-O2", "-o", binary,
+                        os.path.join(args.kernel_dir, kernel + ".c")],
+                       check=True)
+        return [binary]
+    if mode.startswith("O"):
+        obj = os.path.join(workdir, kernel + "-" + mode + ".o")
+        binary = os.path.join(workdir, kernel + "-" + mode)
+        subprocess.run([args.ys, "-O", mode[1:], "--emit", "obj", "-o", obj,
+                        source], check=True)
+        subprocess.run([args.cc, "-o", binary, obj], check=True)
+        return [binary]
+    if mode == "tiered":
+        return [args.ys, "vm", "--tiered", source]
+    return [args.ys, mode, source]
+
+
+def measure(command, runs, budget):
+    """Runs `command` and returns its exit status and times in ms."""
+    times = []
+    statuses = set()
+    spent = 0.0
+    while len(times) < runs and (not times or spent < budget):
+        start = time.perf_counter()
+        status = subprocess.run(command, stdout=subprocess.DEVNULL).returncode
+        elapsed = time.perf_counter() - start
+        spent += elapsed
+        times.append(elapsed * 1e3)
+        statuses.add(status)
+    return (statuses.pop() if len(statuses) == 1 else None), times
+
+
+def p99(times):
+    ranked = sorted(times)
+    return ranked[math.ceil(0.99 * len(ranked)) - 1]
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--ys", default="./ys")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"))
+    parser.add_argument("--kernel-dir", default=os.path.join(here, "kernels"))
+    parser.add_argument("--runs", type=int, default=11)
+    parser.add_argument("--budget", type=float, default=10.0)
+    parser.add_argument("--modes", default=",".join(MODES))
+    parser.add_argument("--kernels", default=",".join(KERNELS))
+    parser.add_argument("--output", help="also write the results as JSON")
+    args = parser.parse_args()
+
+    results = []
+    wrong = False
+    print("%-10s %-7s %5s %10s %10s %8s" %
+          ("kernel", "mode", "runs", "median ms", "p99 ms", "x C"))
+    with tempfile.TemporaryDirectory() as workdir:
+        for kernel in args.kernels.split(","):
+            base = None
+            for mode in ["c"] + args.modes.split(","):
+                command = build(args, kernel, mode, workdir)
+                status, times = measure(command, args.runs, args.budget)
+                median = statistics.median(times)
+                if base is None:
+                    base = (status, median)
+                mark = ""
+                if status is None or status != base[0]:
+                    mark = "  wrong result"
+                    wrong = True
+                print("%-10s %-7s %5d %10.2f %10.2f %8.2f%s" %
+                      (kernel, mode, len(times), median, p99(times),
+                       median / base[1], mark), flush=True)
+                results.append({
+                    "kernel": kernel,
+                    "mode": mode,
+                    "runs": len(times),
+                    "median_ms": median,
+                    "p99_ms": p99(times),
+                    "ratio_to_c": median / base[1],
+                    "status": status,
+                })
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"results": results}, f, indent=2)
+    return 1 if wrong else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,41 @@
+/* C reference for collatz.yz.
+ *
+ * Branchy code: Collatz sequence lengths, where each step branches on the
+ * parity of an unpredictable value, and a classification of the lengths.
+ */
+#include <stdint.h>
+
+static int64_t steps(int64_t n) {
+  int64_t count = 0;
+  while (n != 1) {
+    if (n - n / 2 * 2 == 0) {
+      n = n / 2;
+    } else {
+      n = 3 * n + 1;
+    }
+    count = count + 1;
+  }
+  return count;
+}
+
+int main(void) {
+  int64_t longest = 0;
+  int64_t short_ = 0;
+  int64_t medium = 0;
+  int64_t long_ = 0;
+  for (int64_t n = 1; n < 100000; n++) {
+    int64_t s = steps(n);
+    if (longest < s) {
+      longest = s;
+    }
+    if (s < 50) {
+      short_ = short_ + 1;
+    } else if (s < 150) {
+      medium = medium + 1;
+    } else {
+      long_ = long_ + 1;
+    }
+  }
+  int64_t check = longest + short_ * 3 + medium * 5 + long_ * 7;
+  return (int)(check - check / 256 * 256);
+}
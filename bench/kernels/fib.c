@@ -0,0 +1,21 @@
+/* C reference for fib.yz.
+ *
+ * Recursion: naive Fibonacci, one call per node of the call tree. The
+ * argument depends on the loop so that nothing is evaluated at compile time.
+ */
+#include <stdint.h>
+
+static int64_t fib(int64_t n) {
+  if (n < 2) {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main(void) {
+  int64_t total = 0;
+  for (int64_t round = 0; round < 3; round++) {
+    total = total + fib(round + 29);
+  }
+  return (int)(total - total / 256 * 256);
+}
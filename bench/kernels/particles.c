@@ -0,0 +1,54 @@
+/* C reference for particles.yz.
+ *
+ * Struct-heavy updates: particles bounce in a 1000x1000 box. Each step
+ * copies a particle out of the array, moves it and stores it back.
+ */
+#include <stdint.h>
+
+struct Particle {
+  int64_t x;
+  int64_t y;
+  int64_t vx;
+  int64_t vy;
+};
+
+int main(void) {
+  struct Particle ps[512];
+  for (int64_t i = 0; i < 512; i++) {
+    ps[i].x = i * 7919 - i * 7919 / 1000 * 1000;
+    ps[i].y = i * 104729 - i * 104729 / 1000 * 1000;
+    ps[i].vx = i - i / 7 * 7 + 1;
+    ps[i].vy = i / 5 * 5 - i - 1;
+  }
+
+  for (int64_t step = 0; step < 5000; step++) {
+    for (int64_t i = 0; i < 512; i++) {
+      struct Particle p = ps[i];
+      p.x = p.x + p.vx;
+      p.y = p.y + p.vy;
+      if (p.x < 0) {
+        p.x = 0 - p.x;
+        p.vx = 0 - p.vx;
+      }
+      if (1000 < p.x) {
+        p.x = 2000 - p.x;
+        p.vx = 0 - p.vx;
+      }
+      if (p.y < 0) {
+        p.y = 0 - p.y;
+        p.vy = 0 - p.vy;
+      }
+      if (1000 < p.y) {
+        p.y = 2000 - p.y;
+        p.vy = 0 - p.vy;
+      }
+      ps[i] = p;
+    }
+  }
+
+  int64_t check = 0;
+  for (int64_t i = 0; i < 512; i++) {
+    check = check + ps[i].x * 3 + ps[i].y;
+  }
+  return (int)(check - check / 256 * 256);
+}
@@ -0,0 +1,39 @@
+/* C reference for scan.yz.
+ *
+ * Array scans: fills an array from a linear congruential generator, then
+ * makes passes over it for a sum, a maximum and a count above the mean.
+ */
+#include <stdint.h>
+
+int main(void) {
+  int64_t xs[8192];
+  int64_t seed = 12345;
+  for (int64_t i = 0; i < 8192; i++) {
+    seed = seed * 1103515245 + 12345;
+    seed = seed - seed / 2147483648 * 2147483648;
+    xs[i] = seed / 65536;
+  }
+
+  int64_t check = 0;
+  for (int64_t pass = 0; pass < 1000; pass++) {
+    int64_t sum = 0;
+    int64_t max = 0;
+    for (int64_t i = 0; i < 8192; i++) {
+      int64_t x = xs[i] + pass;
+      sum = sum + x;
+      if (max < x) {
+        max = x;
+      }
+    }
+
+    int64_t mean = sum / 8192;
+    int64_t above = 0;
+    for (int64_t i = 0; i < 8192; i++) {
+      if (mean < xs[i] + pass) {
+        above = above + 1;
+      }
+    }
+    check = check + sum / 1024 + max + above;
+  }
+  return (int)(check - check / 256 * 256);
+}
@@ -0,0 +1,45 @@
+/* C reference for strings.yz, on char rather than 64-bit codes.
+ *
+ * String handling: yslang has no string values at run time, so the text is
+ * an array of character codes. Each pass counts the matches of a 4-letter
+ * pattern with a naive search and hashes the text polynomially.
+ */
+#include <stdint.h>
+
+int main(void) {
+  char text[16384];
+  int64_t seed = 42;
+  for (int64_t i = 0; i < 16384; i++) {
+    seed = seed * 1103515245 + 12345;
+    seed = seed - seed / 2147483648 * 2147483648;
+    int64_t r = seed / 65536;
+    text[i] = (char)(97 + r - r / 4 * 4);
+  }
+
+  char pattern[4] = { 97, 98, 99, 0 };
+  int64_t check = 0;
+  for (int64_t pass = 0; pass < 200; pass++) {
+    pattern[3] = (char)(97 + pass - pass / 4 * 4);
+    int64_t count = 0;
+    for (int64_t i = 0; i < 16384 - 4; i++) {
+      int64_t j = 0;
+      while (j < 4) {
+        if (text[i + j] != pattern[j]) {
+          break;
+        }
+        j = j + 1;
+      }
+      if (j == 4) {
+        count = count + 1;
+      }
+    }
+
+    int64_t hash = pass;
+    for (int64_t i = 0; i < 16384; i++) {
+      hash = hash * 31 + text[i];
+      hash = hash - hash / 1000000007 * 1000000007;
+    }
+    check = check + count + hash / 1024;
+  }
+  return (int)(check - check / 256 * 256);
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Compares the startup cost of ys and ys-front on modes that never reach
+# code generation, and of running on the bytecode VM from source and from
+# precompiled bytecode. Run from the build directory:
+#
+#   ../bench/startup.sh [runs] [file.yz]
+set -e
+
+runs=${1:-200}
+src=${2:-$(dirname "$0")/../example/fib.yz}
+bin=${BIN:-.}
+
+# Prints the mean wall time of one invocation in milliseconds. Runs exit
+# with the result of main(), so their status is ignored.
+measure() {
+  start=$(date +%s%N)
+  i=0
+  while [ $i -lt "$runs" ]; do
+    "$@" > /dev/null || true
+    i=$((i + 1))
+  done
+  end=$(date +%s%N)
+  echo "$(( (end - start) / runs / 1000 ))" |
+    awk '{ printf "%8.2f ms", $1 / 1000 }'
+}
+
+printf '%-24s %s\n' "ys -t" "$(measure "$bin/ys" -t "$src")"
+printf '%-24s %s\n' "ys-front -t" "$(measure "$bin/ys-front" -t "$src")"
+printf '%-24s %s\n' "ys -a" "$(measure "$bin/ys" -a "$src")"
+printf '%-24s %s\n' "ys-front -a" "$(measure "$bin/ys-front" -a "$src")"
+printf '%-24s %s\n' "ys-front --check" \
+  "$(measure "$bin/ys-front" --check "$src")"
+
+ysb=$(mktemp)
+"$bin/ys" --emit ysb -o "$ysb" "$src"
+printf '%-24s %s\n' "ys-front --vm file.yz" \
+  "$(measure "$bin/ys-front" --vm "$src")"
+printf '%-24s %s\n' "ys-front --vm file.ysb" \
+  "$(measure "$bin/ys-front" --vm "$ysb")"
+rm -f "$ysb"
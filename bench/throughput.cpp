@@ -0,0 +1,243 @@
+// ys-throughput measures lexer, parser and codegen throughput on generated
+// programs from --min-size to --max-size, growing 4x per step, and can save
+// the results as JSON for bench/compare.py.
+//
+// The AST is never freed, so parsing stops at --max-parse-size and codegen,
+// which needs the AST and an LLVM module, at --max-codegen-size.
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "../src/ast.hpp"
+#include "../src/codegen.hpp"
+#include "../src/json.hpp"
+#include "../src/lexer.hpp"
+#include "../src/parser.hpp"
+#include "../src/token.hpp"
+#include "../third_party/cmdline.h"
+#include "./generator.hpp"
+
+using namespace yslang;
+
+using Clock = std::chrono::steady_clock;
+
+static size_t count_expr(Expr *expr) {
+  if (expr == nullptr) {
+    return 0;
+  }
+
+  switch (expr->type) {
+  case Expr::Type::BinaryExpr: {
+    auto *binary = dynamic_cast<BinaryExpr *>(expr);
+    return 1 + count_expr(binary->lhs) + count_expr(binary->rhs);
+  }
+  case Expr::Type::CallExpr: {
+    auto *call = dynamic_cast<CallExpr *>(expr);
+    size_t count = 1 + count_expr(call->func);
+    for (Expr *arg : call->args) {
+      count += count_expr(arg);
+    }
+    return count;
+  }
+  case Expr::Type::RefExpr:
+    return 1 + count_expr(dynamic_cast<RefExpr *>(expr)->receiver) + 1;
+  case Expr::Type::IndexExpr: {
+    auto *index = dynamic_cast<IndexExpr *>(expr);
+    return 1 + count_expr(index->receiver) + count_expr(index->index);
+  }
+  default:
+    return 1;
+  }
+}
+
+static size_t count_stmt(Stmt *stmt) {
+  if (stmt == nullptr) {
+    return 0;
+  }
+
+  switch (stmt->kind) {
+  case Stmt::Kind::Block: {
+    size_t count = 1;
+    for (Stmt *child : dynamic_cast<BlockStmt *>(stmt)->stmts) {
+      count += count_stmt(child);
+    }
+    return count;
+  }
+  case Stmt::Kind::Return: {
+    size_t count = 1;
+    for (Expr *result : dynamic_cast<ReturnStmt *>(stmt)->results) {
+      count += count_expr(result);
+    }
+    return count;
+  }
+  case Stmt::Kind::Let:
+    return 2 + count_expr(dynamic_cast<LetStmt *>(stmt)->expr);
+  case Stmt::Kind::If: {
+    auto *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    return 1 + count_expr(if_stmt->cond) + count_stmt(if_stmt->then_block) +
+           count_stmt(if_stmt->else_block);
+  }
+  case Stmt::Kind::While: {
+    auto *while_stmt = dynamic_cast<WhileStmt *>(stmt);
+    return 1 + count_expr(while_stmt->cond) + count_stmt(while_stmt->body);
+  }
+  case Stmt::Kind::Expr:
+    return 1 + count_expr(dynamic_cast<ExprStmt *>(stmt)->expr);
+  default:
+    return 1;
+  }
+}
+
+static size_t count_nodes(const Program &program) {
+  size_t count = 1;
+  for (Decl *decl : program.decls) {
+    count++;
+    if (decl->type == Decl::Kind::Func) {
+      count += count_stmt(dynamic_cast<FuncDecl *>(decl)->body);
+    } else if (decl->type == Decl::Kind::Const) {
+      count += count_expr(dynamic_cast<ConstDecl *>(decl)->expr);
+    }
+  }
+  return count;
+}
+
+struct Measurement {
+  size_t items = 0;
+  unsigned runs = 0;
+  Clock::duration elapsed = Clock::duration::zero();
+};
+
+// Runs `step` until `min_time` has passed, at least once. The step returns
+// the number of items it processed and adds its own timed region.
+template <typename Step>
+static Measurement measure(Clock::duration min_time, Step step) {
+  Measurement result;
+  while (result.runs == 0 || result.elapsed < min_time) {
+    result.items = step(result.elapsed);
+    result.runs++;
+  }
+  return result;
+}
+
+static std::string format_size(size_t bytes) {
+  const char *units[] = { "B", "KB", "MB", "GB" };
+  unsigned unit = 0;
+  while (bytes >= 1024 && bytes % 1024 == 0 && unit < 3) {
+    bytes /= 1024;
+    unit++;
+  }
+  return std::to_string(bytes) + units[unit];
+}
+
+static json report(const std::string &phase, size_t target, size_t bytes,
+                   const Measurement &m) {
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   m.elapsed / m.runs)
+                   .count();
+  double seconds = ns / 1e9;
+  std::printf("%-8s %8s %12.2f MB/s %14.0f items/s %6u runs\n",
+              phase.c_str(), format_size(target).c_str(),
+              bytes / seconds / 1e6, m.items / seconds, m.runs);
+  std::fflush(stdout);
+
+  json result;
+  result["phase"] = phase;
+  result["size"] = int64_t(target);
+  result["bytes"] = int64_t(bytes);
+  result["items"] = int64_t(m.items);
+  result["runs"] = int64_t(m.runs);
+  result["ns"] = ns;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  cmdline::parser cmd;
+  cmd.add<size_t>("min-size", 0, "smallest program in bytes", false, 1 << 10);
+  cmd.add<size_t>("max-size", 0, "largest program in bytes", false, 1 << 30);
+  cmd.add<size_t>("max-parse-size", 0, "largest program to parse", false,
+                  16 << 20);
+  cmd.add<size_t>("max-codegen-size", 0, "largest program to codegen", false,
+                  4 << 20);
+  cmd.add<unsigned>("min-time", 0, "minimum time per measurement in ms",
+                    false, 200);
+  cmd.add<unsigned>("depth", 0, "expression depth", false, 4);
+  cmd.add<unsigned>("structs", 0, "number of struct types", false, 4);
+  cmd.add<unsigned>("if-chain", 0, "branches of each if/else chain", false,
+                    4);
+  cmd.add<uint64_t>("seed", 0, "random seed", false, 1);
+  cmd.add<std::string>("output", 'o', "write results as JSON", false, "");
+  cmd.parse_check(argc, argv);
+
+  ProgramShape shape;
+  shape.functions = 0;
+  shape.expr_depth = cmd.get<unsigned>("depth");
+  shape.structs = cmd.get<unsigned>("structs");
+  shape.if_chain = cmd.get<unsigned>("if-chain");
+  shape.seed = cmd.get<uint64_t>("seed");
+  auto min_time = std::chrono::milliseconds(cmd.get<unsigned>("min-time"));
+
+  json results = json::array();
+  for (size_t size = cmd.get<size_t>("min-size");
+       size <= cmd.get<size_t>("max-size"); size *= 4) {
+    std::string input = ProgramGenerator(shape).generate(size);
+
+    results.push_back(report(
+        "lex", size, input.size(),
+        measure(min_time, [&](Clock::duration &elapsed) {
+          size_t tokens = 0;
+          auto start = Clock::now();
+          Lexer lexer(input);
+          while (lexer.next().type != TokenType::TEOF) {
+            tokens++;
+          }
+          elapsed += Clock::now() - start;
+          return tokens;
+        })));
+
+    if (size <= cmd.get<size_t>("max-parse-size")) {
+      results.push_back(report(
+          "parse", size, input.size(),
+          measure(min_time, [&](Clock::duration &elapsed) {
+            auto start = Clock::now();
+            Parser parser(input);
+            Program program = parser.parse();
+            elapsed += Clock::now() - start;
+            if (parser.has_error()) {
+              std::cerr << "err: generated program does not parse: "
+                        << parser.error_messages[0] << std::endl;
+              std::exit(1);
+            }
+            return count_nodes(program);
+          })));
+    }
+
+    if (size <= cmd.get<size_t>("max-codegen-size")) {
+      results.push_back(report(
+          "codegen", size, input.size(),
+          measure(min_time, [&](Clock::duration &elapsed) {
+            Parser parser(input);
+            Program program = parser.parse();
+            size_t nodes = count_nodes(program);
+            auto start = Clock::now();
+            CodeGen codegen;
+            codegen.generate(&program);
+            elapsed += Clock::now() - start;
+            return nodes;
+          })));
+    }
+  }
+
+  if (!cmd.get<std::string>("output").empty()) {
+    json root;
+    root["depth"] = int64_t(shape.expr_depth);
+    root["structs"] = int64_t(shape.structs);
+    root["if_chain"] = int64_t(shape.if_chain);
+    root["seed"] = int64_t(shape.seed);
+    root["results"] = results;
+    std::ofstream ofs(cmd.get<std::string>("output"));
+    ofs << root.to_string() << std::endl;
+  }
+  return 0;
+}
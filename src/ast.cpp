@@ -54,6 +54,13 @@ json IndexExpr::toJson() const {
   return j;
 }
 
+json AwaitExpr::toJson() const {
+  json j;
+  j["kind"] = "AwaitExpr";
+  j["operand"] = operand->toJson();
+  return j;
+}
+
 json BasicLit::toJson() const {
   json j;
   std::stringstream ss;
@@ -173,6 +180,25 @@ json IfStmt::toJson() const {
   return j;
 }
 
+json WhileStmt::toJson() const {
+  json j;
+  j["kind"] = "WhileStmt";
+  j["cond"] = cond->toJson();
+  j["body"] = body->toJson();
+  return j;
+}
+
+json BranchStmt::toJson() const {
+  json j;
+  std::stringstream ss;
+
+  ss << tok;
+
+  j["kind"] = "BranchStmt";
+  j["tok"] = ss.str();
+  return j;
+}
+
 // -------------------- //
 // Decl
 // -------------------- //
@@ -181,11 +207,29 @@ json FuncDecl::toJson() const {
   json j;
   j["kind"] = "FuncDecl";
   j["name"] = name;
+  if (is_async) {
+    j["async"] = true;
+  }
+  if (!attributes.empty()) {
+    j["attributes"] = json::array();
+    for (const auto &attribute : attributes) {
+      j["attributes"].push_back(attribute);
+    }
+  }
   j["type"] = func_type->toJson();
   j["body"] = body->toJson();
   return j;
 }
 
+bool FuncDecl::hasAttribute(const std::string &attribute) const {
+  for (const auto &a : attributes) {
+    if (a == attribute) {
+      return true;
+    }
+  }
+  return false;
+}
+
 json ConstDecl::toJson() const {
   json j;
   j["kind"] = "ConstDecl";
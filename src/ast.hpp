@@ -20,20 +20,32 @@ public:
 
 public:
   const Kind type;
+  // Read from another module's interface rather than parsed here.
+  bool imported = false;
 };
 
 class Stmt : public Node {
 public:
-  enum class Kind { Block, Return, Let, If, Expr };
+  enum class Kind { Block, Return, Let, If, While, Branch, Expr };
   Stmt(Kind kind) : kind(kind){};
 
 public:
   const Kind kind;
+  // 0 for statements made by a rewrite rather than parsed.
+  size_t line = 0;
 };
 
 class Expr : public Node {
 public:
-  enum class Type { BasicLit, Ident, CallExpr, BinaryExpr, RefExpr, IndexExpr };
+  enum class Type {
+    BasicLit,
+    Ident,
+    CallExpr,
+    BinaryExpr,
+    RefExpr,
+    IndexExpr,
+    AwaitExpr,
+  };
   Expr(Type type) : type(type){};
 
 public:
@@ -117,6 +129,17 @@ public:
   Expr *index;
 };
 
+// Suspends the enclosing async function until the task finishes and gives
+// its result.
+class AwaitExpr : public Expr {
+public:
+  AwaitExpr() : Expr(Expr::Type::AwaitExpr) {}
+  json toJson() const;
+
+public:
+  Expr *operand;
+};
+
 class BasicLit : public Expr {
 public:
   BasicLit() : Expr(Expr::Type::BasicLit) {}
@@ -233,6 +256,26 @@ public:
   Stmt *else_block;
 };
 
+class WhileStmt : public Stmt {
+public:
+  WhileStmt() : Stmt(Stmt::Kind::While) {}
+  json toJson() const;
+
+public:
+  Expr *cond;
+  BlockStmt *body;
+};
+
+// break or continue
+class BranchStmt : public Stmt {
+public:
+  BranchStmt() : Stmt(Stmt::Kind::Branch) {}
+  json toJson() const;
+
+public:
+  TokenType tok;
+};
+
 // -------------------- //
 // Decl
 // -------------------- //
@@ -242,10 +285,16 @@ public:
   FuncDecl() : Decl(Decl::Kind::Func) {}
   json toJson() const;
 
+  bool hasAttribute(const std::string &attribute) const;
+
 public:
   std::string name;
+  std::vector<std::string> attributes;
   FunctionType *func_type;
   BlockStmt *body;
+  size_t line = 0;
+  // Calls return a task handle; the body runs as a coroutine.
+  bool is_async = false;
 };
 
 class ConstDecl : public Decl {
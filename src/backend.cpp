@@ -0,0 +1,642 @@
+#include "./backend.hpp"
+#include "./error.hpp"
+#include "./timing.hpp"
+#include <algorithm>
+#include <atomic>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/LTO/Caching.h>
+#include <llvm/LTO/LTO.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Coroutines.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace yslang;
+
+// Partitioning depends only on the module, never on `jobs`, so the linked
+// object is identical whatever the thread count.
+static const unsigned functions_per_partition = 32;
+static const unsigned max_partitions = 64;
+
+// @multiversion clones, best first. `bit` indexes __cpu_model.__cpu_features
+// as filled in by __cpu_indicator_init from libgcc or compiler-rt.
+struct Version {
+  const char *suffix;
+  const char *features;
+  unsigned bit;
+};
+static const Version versions[] = {
+  { "avx512", "+avx512f", 15 },
+  { "avx2", "+avx2", 10 },
+  { "sse4.2", "+sse4.2", 8 },
+};
+
+Backend::Backend(const BackendOptions &options)
+    : options(options), triple(llvm::sys::getDefaultTargetTriple()) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  if (this->options.cpu == "native") {
+    this->options.cpu = llvm::sys::getHostCPUName().str();
+
+    llvm::StringMap<bool> host_features;
+    std::vector<std::string> features;
+    if (llvm::sys::getHostCPUFeatures(host_features)) {
+      for (const auto &feature : host_features) {
+        features.push_back((feature.getValue() ? "+" : "-") +
+                           feature.getKey().str());
+      }
+    }
+    std::sort(features.begin(), features.end());
+    for (const auto &feature : features) {
+      if (!this->options.features.empty()) {
+        this->options.features += ",";
+      }
+      this->options.features += feature;
+    }
+  }
+
+  std::string message;
+  target = llvm::TargetRegistry::lookupTarget(triple, message);
+  if (target == nullptr) {
+    error(message);
+  }
+}
+
+llvm::CodeGenOpt::Level Backend::codeGenOptLevel() const {
+  switch (options.opt_level) {
+  case 0:
+    return llvm::CodeGenOpt::None;
+  case 1:
+    return llvm::CodeGenOpt::Less;
+  case 2:
+    return llvm::CodeGenOpt::Default;
+  default:
+    return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
+std::unique_ptr<llvm::TargetMachine> Backend::createTargetMachine() {
+  llvm::TargetOptions target_options;
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, options.cpu, options.features, target_options,
+      llvm::Reloc::PIC_, llvm::None, codeGenOptLevel()));
+}
+
+void Backend::setTarget(llvm::Module *module) {
+  auto machine = createTargetMachine();
+  module->setTargetTriple(triple);
+  module->setDataLayout(machine->createDataLayout());
+
+  // Function attributes, unlike the TargetMachine, travel with the IR into
+  // partitions, caches and inlined callers.
+  for (auto &func : *module) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    if (!func.hasFnAttribute("target-cpu")) {
+      func.addFnAttr("target-cpu", options.cpu);
+    }
+    if (!func.hasFnAttribute("target-features") && !options.features.empty()) {
+      func.addFnAttr("target-features", options.features);
+    }
+  }
+}
+
+void Backend::optimize(llvm::Module *module) {
+  auto machine = createTargetMachine();
+  setTarget(module);
+  runPasses(module, machine.get(), nullptr);
+}
+
+void Backend::emitObject(llvm::Module *module, const std::string &path) {
+  if (llvm::verifyModule(*module, &llvm::errs())) {
+    error("broken module at emitObject");
+  }
+
+  // ThinLTO keeps one summary per module and parallelizes at link time.
+  unsigned partitions = options.thin_lto ? 1 : countPartitions(module);
+  if (partitions == 1) {
+    auto machine = createTargetMachine();
+    emitModule(module, machine.get(), path);
+    return;
+  }
+
+  // Partitions share the LLVMContext of `module`, which is not thread safe,
+  // so each one crosses over to its worker as bitcode. Locals stay with
+  // their users; promoting them would clash with other modules' locals
+  // once objects are linked together.
+  std::vector<llvm::SmallString<0>> bitcodes;
+  {
+    Phase phase("split");
+    llvm::SplitModule(
+        llvm::CloneModule(*module), partitions,
+        [&](std::unique_ptr<llvm::Module> part) {
+          bitcodes.emplace_back();
+          llvm::raw_svector_ostream os(bitcodes.back());
+          llvm::WriteBitcodeToFile(*part, os);
+        },
+        true);
+  }
+
+  std::vector<std::string> objects;
+  for (size_t i = 0; i < bitcodes.size(); i++) {
+    llvm::SmallString<128> object;
+    if (llvm::sys::fs::createTemporaryFile("ys-part", "o", object)) {
+      error("can not create temporary file at emitObject");
+    }
+    objects.push_back(object.str().str());
+  }
+
+  emitPartitions(bitcodes, objects);
+  linkObjects(objects, path);
+  for (const auto &object : objects) {
+    llvm::sys::fs::remove(object);
+  }
+}
+
+void Backend::emitIncremental(llvm::Module *module, const std::string &path,
+                              CompileCache &cache) {
+  if (llvm::verifyModule(*module, &llvm::errs())) {
+    error("broken module at emitIncremental");
+  }
+
+  // One unit per externally visible function, and one for global data.
+  std::vector<const llvm::GlobalValue *> roots;
+  for (const auto &func : *module) {
+    if (!func.isDeclaration() && !func.hasLocalLinkage() &&
+        !func.hasLinkOnceODRLinkage()) {
+      roots.push_back(&func);
+    }
+  }
+  for (const auto &global : module->globals()) {
+    if (!global.isDeclaration() && !global.hasLocalLinkage() &&
+        !global.hasLinkOnceODRLinkage()) {
+      roots.push_back(nullptr);
+      break;
+    }
+  }
+  if (roots.empty()) {
+    emitObject(module, path);
+    return;
+  }
+
+  std::vector<std::string> objects;
+  std::vector<std::string> missed_keys;
+  std::vector<std::string> missed_objects;
+  std::vector<llvm::SmallString<0>> bitcodes;
+  for (const auto *root : roots) {
+    auto unit = extractUnit(module, root);
+    std::string key = unitKey(unit.get());
+
+    llvm::SmallString<128> object;
+    if (llvm::sys::fs::createTemporaryFile("ys-func", "o", object)) {
+      error("can not create temporary file at emitIncremental");
+    }
+    objects.push_back(object.str().str());
+    if (cache.lookup(key, objects.back())) {
+      continue;
+    }
+
+    missed_keys.push_back(key);
+    missed_objects.push_back(objects.back());
+    bitcodes.emplace_back();
+    llvm::raw_svector_ostream os(bitcodes.back());
+    llvm::WriteBitcodeToFile(*unit, os);
+  }
+
+  emitPartitions(bitcodes, missed_objects);
+  for (size_t i = 0; i < missed_keys.size(); i++) {
+    cache.insert(missed_keys[i], missed_objects[i]);
+  }
+
+  linkObjects(objects, path);
+  for (const auto &object : objects) {
+    llvm::sys::fs::remove(object);
+  }
+}
+
+std::unique_ptr<llvm::Module>
+Backend::extractUnit(llvm::Module *module, const llvm::GlobalValue *root) {
+  return extractUnit(module, [root](const llvm::GlobalValue *value) {
+    // Internal helpers go along, such as the profile writer that the
+    // destructor list in the global data calls.
+    if (value->hasLocalLinkage()) {
+      return true;
+    }
+    if (root == nullptr) {
+      return llvm::isa<llvm::GlobalVariable>(value);
+    }
+    return value == root;
+  });
+}
+
+std::unique_ptr<llvm::Module> Backend::extractUnit(
+    llvm::Module *module,
+    const std::function<bool(const llvm::GlobalValue *)> &keep) {
+  llvm::ValueToValueMapTy vmap;
+  auto unit = llvm::CloneModule(
+      *module, vmap, [&keep](const llvm::GlobalValue *value) {
+        return keep(value) || value->hasLinkOnceODRLinkage();
+      });
+
+  // Drop the copied internals this unit never reaches.
+  for (bool changed = true; changed;) {
+    changed = false;
+    std::vector<llvm::GlobalValue *> dead;
+    for (auto &value : unit->global_values()) {
+      if ((value.hasLocalLinkage() || value.hasLinkOnceODRLinkage()) &&
+          value.use_empty()) {
+        dead.push_back(&value);
+      }
+    }
+    for (auto *value : dead) {
+      value->eraseFromParent();
+      changed = true;
+    }
+  }
+  return unit;
+}
+
+// The unit's IR before optimization covers its body, the signatures of
+// everything it calls and any constants folded into it by CodeGen.
+std::string Backend::unitKey(llvm::Module *unit) {
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+  unit->print(os, nullptr);
+  os.flush();
+
+  return CompileCache::key({ "function", ir, std::to_string(options.opt_level),
+                             triple, options.cpu, options.features });
+}
+
+void Backend::emitPartitions(const std::vector<llvm::SmallString<0>> &bitcodes,
+                             const std::vector<std::string> &objects) {
+  std::atomic<unsigned> next(0);
+  std::mutex failure_mutex;
+  std::string failure;
+  unsigned workers_size =
+      std::min<unsigned>(std::max(options.jobs, 1u), bitcodes.size());
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < workers_size; i++) {
+    workers.emplace_back([&]() {
+      TimeReport::attachThread();
+      for (unsigned p = next++; p < bitcodes.size(); p = next++) {
+        try {
+          emitPartition(bitcodes[p], objects[p]);
+        } catch (const Error &e) {
+          std::lock_guard<std::mutex> lock(failure_mutex);
+          failure = e.what();
+        }
+      }
+      TimeReport::detachThread();
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // An exception must not leave a worker thread, so it is raised again here.
+  if (!failure.empty()) {
+    for (const auto &object : objects) {
+      llvm::sys::fs::remove(object);
+    }
+    error(failure);
+  }
+}
+
+unsigned Backend::countPartitions(llvm::Module *module) {
+  unsigned defined = 0;
+  for (const auto &func : *module) {
+    if (!func.isDeclaration()) {
+      defined++;
+    }
+  }
+
+  unsigned partitions =
+      (defined + functions_per_partition - 1) / functions_per_partition;
+  return std::max(1u, std::min(partitions, max_partitions));
+}
+
+// A @multiversion function f becomes clones f.avx512, f.avx2, f.sse4.2 and
+// f.default plus an ifunc f whose resolver picks one once at load time.
+// This runs per partition, after SplitModule, since not every LLVM clones
+// ifuncs with a module.
+void Backend::lowerMultiversion(llvm::Module *module) {
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : *module) {
+    if (!func.isDeclaration() && func.hasFnAttribute("yslang.multiversion")) {
+      funcs.push_back(&func);
+    }
+  }
+
+  llvm::Triple module_triple(module->getTargetTriple());
+  bool x86 = module_triple.getArch() == llvm::Triple::x86_64 ||
+             module_triple.getArch() == llvm::Triple::x86;
+  for (llvm::Function *func : funcs) {
+    func->removeFnAttr("yslang.multiversion");
+    if (x86) {
+      lowerMultiversion(func);
+    }
+  }
+}
+
+void Backend::lowerMultiversion(llvm::Function *func) {
+  llvm::Module *module = func->getParent();
+  llvm::LLVMContext &context = module->getContext();
+  std::string name = func->getName().str();
+
+  std::vector<llvm::Function *> clones;
+  for (const auto &version : versions) {
+    llvm::ValueToValueMapTy vmap;
+    llvm::Function *clone = llvm::CloneFunction(func, vmap);
+    clone->setName(name + "." + version.suffix);
+    clone->setLinkage(llvm::GlobalValue::InternalLinkage);
+    clone->removeFnAttr("target-cpu");
+    clone->removeFnAttr("target-features");
+    clone->addFnAttr("target-cpu", "x86-64");
+    clone->addFnAttr("target-features", version.features);
+    clones.push_back(clone);
+  }
+
+  auto *resolver_type = llvm::FunctionType::get(func->getType(), false);
+  auto *resolver =
+      llvm::Function::Create(resolver_type, llvm::Function::InternalLinkage,
+                             name + ".resolver", module);
+
+  func->setName(name + ".default");
+  auto *ifunc = llvm::GlobalIFunc::create(
+      func->getFunctionType(), 0, func->getLinkage(), name, resolver, module);
+  func->replaceAllUsesWith(ifunc);
+  func->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+  auto *i32 = llvm::Type::getInt32Ty(context);
+  auto *cpu_model_type = llvm::StructType::get(
+      context, { i32, i32, i32, llvm::ArrayType::get(i32, 1) });
+  auto *cpu_model = module->getOrInsertGlobal("__cpu_model", cpu_model_type);
+  auto cpu_init = module->getOrInsertFunction(
+      "__cpu_indicator_init", llvm::Type::getVoidTy(context));
+
+  llvm::IRBuilder<> builder(
+      llvm::BasicBlock::Create(context, "entry", resolver));
+
+  // Resolvers run before constructors, so the CPU model is filled in here.
+  builder.CreateCall(cpu_init);
+  auto *features_array =
+      builder.CreateConstInBoundsGEP2_32(cpu_model_type, cpu_model, 0, 3);
+  auto *features_ptr = builder.CreateConstInBoundsGEP2_32(
+      llvm::ArrayType::get(i32, 1), features_array, 0, 0);
+  auto *features = builder.CreateLoad(features_ptr);
+  for (size_t i = 0; i < clones.size(); i++) {
+    auto *supported = builder.CreateICmpNE(
+        builder.CreateAnd(features, builder.getInt32(1u << versions[i].bit)),
+        builder.getInt32(0));
+    auto *found = llvm::BasicBlock::Create(context, "found", resolver);
+    auto *next = llvm::BasicBlock::Create(context, "next", resolver);
+    builder.CreateCondBr(supported, found, next);
+
+    builder.SetInsertPoint(found);
+    builder.CreateRet(clones[i]);
+    builder.SetInsertPoint(next);
+  }
+  builder.CreateRet(func);
+}
+
+void Backend::runPasses(llvm::Module *module, llvm::TargetMachine *machine,
+                        llvm::raw_pwrite_stream *object) {
+  lowerMultiversion(module);
+  // Units and partitions declare the coroutines of other units with all
+  // their attributes, but only a definition may be marked for CoroSplit.
+  for (auto &func : *module) {
+    if (func.isDeclaration()) {
+      func.removeFnAttr("coroutine.presplit");
+    }
+  }
+
+  llvm::legacy::PassManager module_passes;
+  llvm::legacy::FunctionPassManager function_passes(module);
+
+  llvm::Triple module_triple(module->getTargetTriple());
+  module_passes.add(new llvm::TargetLibraryInfoWrapperPass(module_triple));
+  module_passes.add(llvm::createTargetTransformInfoWrapperPass(
+      machine->getTargetIRAnalysis()));
+  function_passes.add(llvm::createTargetTransformInfoWrapperPass(
+      machine->getTargetIRAnalysis()));
+
+  llvm::PassManagerBuilder builder;
+  builder.OptLevel = options.opt_level;
+  builder.SizeLevel = 0;
+  if (options.opt_level > 1) {
+    builder.Inliner =
+        llvm::createFunctionInliningPass(options.opt_level, 0, false);
+  } else {
+    builder.Inliner = llvm::createAlwaysInlinerLegacyPass();
+  }
+  builder.LoopVectorize = options.opt_level > 1;
+  builder.SLPVectorize = options.opt_level > 1;
+  builder.PrepareForThinLTO = options.thin_lto;
+  // Async functions are split into resume and destroy functions at every
+  // level; above -O0 a frame that does not outlive its caller goes on the
+  // caller's stack.
+  llvm::addCoroutinePassesToExtensionPoints(builder);
+  builder.populateFunctionPassManager(function_passes);
+  builder.populateModulePassManager(module_passes);
+
+  if (object != nullptr && options.thin_lto) {
+    module_passes.add(llvm::createWriteThinLTOBitcodePass(*object));
+  } else if (object != nullptr &&
+             machine->addPassesToEmitFile(module_passes, *object, nullptr,
+                                          llvm::CGFT_ObjectFile)) {
+    error("target can not emit object file");
+  }
+
+  function_passes.doInitialization();
+  for (auto &func : *module) {
+    function_passes.run(func);
+  }
+  function_passes.doFinalization();
+  module_passes.run(*module);
+}
+
+void Backend::emitPartition(const llvm::SmallString<0> &bitcode,
+                            const std::string &path) {
+  Phase phase("emit partition", path);
+  llvm::LLVMContext context;
+  auto module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode.str(), "partition"), context);
+  if (!module) {
+    error("broken partition: " + llvm::toString(module.takeError()));
+  }
+
+  auto machine = createTargetMachine();
+  emitModule(module->get(), machine.get(), path);
+}
+
+void Backend::emitModule(llvm::Module *module, llvm::TargetMachine *machine,
+                         const std::string &path) {
+  setTarget(module);
+
+  std::error_code error_info;
+  llvm::raw_fd_ostream os(path, error_info, llvm::sys::fs::OpenFlags::F_None);
+  if (error_info) {
+    error("can not open " + path + ": " + error_info.message());
+  }
+
+  runPasses(module, machine, &os);
+}
+
+void Backend::linkThinLTO(const std::vector<std::string> &inputs,
+                          const std::string &output,
+                          const std::string &cache_dir) {
+  Phase phase("thin link");
+  llvm::lto::Config config;
+  config.CPU = options.cpu;
+  llvm::SmallVector<llvm::StringRef, 8> features;
+  llvm::StringRef(options.features).split(features, ',', -1, false);
+  for (auto feature : features) {
+    config.MAttrs.push_back(feature.str());
+  }
+  config.OptLevel = options.opt_level;
+  config.CGOptLevel = codeGenOptLevel();
+  config.RelocModel = llvm::Reloc::PIC_;
+  config.DefaultTriple = triple;
+
+  llvm::lto::LTO lto(std::move(config),
+                     llvm::lto::createInProcessThinBackend(
+                         llvm::heavyweight_hardware_concurrency(options.jobs)));
+
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> buffers;
+  std::vector<std::string> natives;
+  for (const auto &input : inputs) {
+    auto buffer = llvm::MemoryBuffer::getFile(input);
+    if (!buffer) {
+      error("can not read " + input + ": " + buffer.getError().message());
+    }
+    auto *start =
+        reinterpret_cast<const unsigned char *>((*buffer)->getBufferStart());
+    if (llvm::isBitcode(start, start + (*buffer)->getBufferSize())) {
+      buffers.push_back(std::move(*buffer));
+    } else {
+      natives.push_back(input);
+    }
+  }
+
+  // yslang code is only entered through main, so unless plain objects take
+  // part, everything else may be internalized once its callers are known.
+  std::set<std::string> defined;
+  for (const auto &buffer : buffers) {
+    auto file = llvm::lto::InputFile::create(buffer->getMemBufferRef());
+    if (!file) {
+      error("broken bitcode " + buffer->getBufferIdentifier().str() + ": " +
+            llvm::toString(file.takeError()));
+    }
+
+    std::vector<llvm::lto::SymbolResolution> resolutions;
+    for (const auto &symbol : (*file)->symbols()) {
+      llvm::lto::SymbolResolution resolution;
+      resolution.Prevailing = !symbol.isUndefined() &&
+                              defined.insert(symbol.getName().str()).second;
+      resolution.VisibleToRegularObj =
+          !natives.empty() || symbol.getName() == "main";
+      resolutions.push_back(resolution);
+    }
+    if (auto err = lto.add(std::move(*file), resolutions)) {
+      error("can not add " + buffer->getBufferIdentifier().str() + ": " +
+            llvm::toString(std::move(err)));
+    }
+  }
+
+  // Task results go to temporary objects, from the backend threads or, for
+  // cache hits, from the cache.
+  std::vector<std::string> objects(lto.getMaxTasks());
+  auto create_object = [&objects](unsigned task) {
+    llvm::SmallString<128> object;
+    // This runs on LLVM's threads, where an exception can not be caught.
+    if (llvm::sys::fs::createTemporaryFile("ys-thin", "o", object)) {
+      llvm::report_fatal_error("can not create temporary file at linkThinLTO");
+    }
+    objects[task] = object.str().str();
+    return objects[task];
+  };
+  auto add_stream = [&](unsigned task) {
+    std::error_code error_info;
+    auto os = std::make_unique<llvm::raw_fd_ostream>(
+        create_object(task), error_info, llvm::sys::fs::OpenFlags::F_None);
+    return std::make_unique<llvm::lto::NativeObjectStream>(std::move(os));
+  };
+  auto add_buffer = [&](unsigned task,
+                        std::unique_ptr<llvm::MemoryBuffer> buffer) {
+    std::error_code error_info;
+    llvm::raw_fd_ostream os(create_object(task), error_info,
+                            llvm::sys::fs::OpenFlags::F_None);
+    os << buffer->getBuffer();
+  };
+
+  llvm::lto::NativeObjectCache cache;
+  if (!cache_dir.empty()) {
+    auto local_cache = llvm::lto::localCache(cache_dir, add_buffer);
+    if (!local_cache) {
+      error("can not use cache " + cache_dir + ": " +
+            llvm::toString(local_cache.takeError()));
+    }
+    cache = std::move(*local_cache);
+  }
+  if (auto err = lto.run(add_stream, cache)) {
+    error("ThinLTO failed: " + llvm::toString(std::move(err)));
+  }
+
+  std::vector<std::string> link_inputs = natives;
+  for (const auto &object : objects) {
+    if (!object.empty()) {
+      link_inputs.push_back(object);
+    }
+  }
+  linkObjects(link_inputs, output);
+  for (const auto &object : objects) {
+    if (!object.empty()) {
+      llvm::sys::fs::remove(object);
+    }
+  }
+}
+
+void Backend::linkObjects(const std::vector<std::string> &inputs,
+                          const std::string &output) {
+  Phase phase("link");
+  auto ld = llvm::sys::findProgramByName("ld");
+  if (!ld) {
+    error("can not find ld to link partitions");
+  }
+
+  std::vector<llvm::StringRef> args{ *ld, "-r", "-o", output };
+  for (const auto &input : inputs) {
+    args.push_back(input);
+  }
+
+  std::string message;
+  if (llvm::sys::ExecuteAndWait(*ld, args, llvm::None, {}, 0, 0, &message) !=
+      0) {
+    error("failed to link partitions: " + message);
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "./cache.hpp"
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace yslang {
+struct BackendOptions {
+  unsigned opt_level = 0;
+  unsigned jobs = 1;
+  std::string cpu = "generic"; // or "native" for the host
+  std::string features;
+  // Emit ThinLTO bitcode with a module summary instead of machine code.
+  bool thin_lto = false;
+};
+
+class Backend {
+public:
+  Backend(const BackendOptions &options);
+
+  // The options after resolving "native" to the host CPU and features.
+  const BackendOptions &getOptions() const { return options; }
+  const std::string &getTriple() const { return triple; }
+
+  void setTarget(llvm::Module *module);
+  void optimize(llvm::Module *module);
+  void emitObject(llvm::Module *module, const std::string &path);
+  // Like emitObject, but compiles and caches each function separately so
+  // only changed functions are rebuilt.
+  void emitIncremental(llvm::Module *module, const std::string &path,
+                       CompileCache &cache);
+  // Runs the ThinLTO backend over `inputs` on `jobs` threads and links the
+  // results, and any plain objects among the inputs, into one object.
+  void linkThinLTO(const std::vector<std::string> &inputs,
+                   const std::string &output, const std::string &cache_dir);
+  // Combines objects into one with `ld -r`.
+  void linkObjects(const std::vector<std::string> &inputs,
+                   const std::string &output);
+
+  // Copies the values `keep` accepts into a module of their own. Everything
+  // else external becomes a declaration; internal helpers such as memo
+  // tables, and the linkonce_odr task runtime, are copied along when used.
+  static std::unique_ptr<llvm::Module>
+  extractUnit(llvm::Module *module,
+              const std::function<bool(const llvm::GlobalValue *)> &keep);
+  // The unit emitIncremental compiles for `root`, or for all external global
+  // variables when null.
+  static std::unique_ptr<llvm::Module>
+  extractUnit(llvm::Module *module, const llvm::GlobalValue *root);
+
+private:
+  llvm::CodeGenOpt::Level codeGenOptLevel() const;
+  std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+  unsigned countPartitions(llvm::Module *module);
+  std::string unitKey(llvm::Module *unit);
+  void lowerMultiversion(llvm::Module *module);
+  void lowerMultiversion(llvm::Function *func);
+
+  void runPasses(llvm::Module *module, llvm::TargetMachine *machine,
+                 llvm::raw_pwrite_stream *object);
+  void emitPartition(const llvm::SmallString<0> &bitcode,
+                     const std::string &path);
+  void emitPartitions(const std::vector<llvm::SmallString<0>> &bitcodes,
+                      const std::vector<std::string> &objects);
+  void emitModule(llvm::Module *module, llvm::TargetMachine *machine,
+                  const std::string &path);
+
+private:
+  BackendOptions options;
+  std::string triple;
+  const llvm::Target *target;
+};
+} // namespace yslang
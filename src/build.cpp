@@ -0,0 +1,93 @@
+#include "./build.hpp"
+#include "./error.hpp"
+#include "./parser.hpp"
+#include <algorithm>
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+using namespace yslang;
+
+void ModuleGraph::discover(const std::string &root,
+                           const std::vector<std::string> &search_paths) {
+  this->search_paths = search_paths;
+  modules.clear();
+  indices.clear();
+  paths.clear();
+  stack.clear();
+  visit(llvm::sys::path::stem(root).str(), root);
+}
+
+std::string ModuleGraph::findSource(const std::string &name) const {
+  for (const auto &dir : search_paths) {
+    llvm::SmallString<128> path(dir);
+    llvm::sys::path::append(path, name + ".yz");
+    if (llvm::sys::fs::exists(path)) {
+      return path.str().str();
+    }
+  }
+  error("can not find module " + name + ".yz");
+}
+
+size_t ModuleGraph::visit(const std::string &name, const std::string &path) {
+  // Interfaces and objects are named after the module, so one name can not
+  // stand for two sources.
+  auto known = paths.find(name);
+  if (known == paths.end()) {
+    paths[name] = path;
+  } else if (!llvm::sys::fs::equivalent(known->second, path)) {
+    error("module " + name + " is both " + known->second + " and " + path);
+  }
+
+  auto found = indices.find(name);
+  if (found != indices.end()) {
+    return found->second;
+  }
+
+  auto cycle = std::find(stack.begin(), stack.end(), name);
+  if (cycle != stack.end()) {
+    std::string chain;
+    for (auto it = cycle; it != stack.end(); ++it) {
+      chain += *it + " -> ";
+    }
+    error("import cycle: " + chain + name);
+  }
+
+  std::ifstream ifs(path);
+  if (ifs.fail()) {
+    error("can not open " + path);
+  }
+  std::string input((std::istreambuf_iterator<char>(ifs)),
+                    std::istreambuf_iterator<char>());
+
+  Parser parser(input);
+  Program program = parser.parse();
+  if (parser.has_error()) {
+    error(path + ": " + parser.error_messages[0]);
+  }
+
+  stack.push_back(name);
+  std::vector<size_t> imports;
+  for (Decl *decl : program.decls) {
+    if (decl->type != Decl::Kind::Import) {
+      continue;
+    }
+    const std::string &package =
+        dynamic_cast<ImportDecl *>(decl)->package->name;
+    size_t import = visit(package, findSource(package));
+    if (std::find(imports.begin(), imports.end(), import) == imports.end()) {
+      imports.push_back(import);
+    }
+  }
+  stack.pop_back();
+
+  // Added after its imports, which keeps the list in dependency order.
+  Module module;
+  module.name = name;
+  module.path = path;
+  module.imports = std::move(imports);
+  modules.push_back(std::move(module));
+  indices[name] = modules.size() - 1;
+  return modules.size() - 1;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace yslang {
+// The modules reachable from a root source through imports. `import pkg`
+// refers to the source pkg.yz, looked up in the search paths.
+class ModuleGraph {
+public:
+  struct Module {
+    std::string name;
+    std::string path;
+    std::vector<size_t> imports;
+  };
+
+  // Parses the root and everything it imports. A missing module, an import
+  // cycle or two sources with one module name is an error.
+  void discover(const std::string &root,
+                const std::vector<std::string> &search_paths);
+
+  // Every module comes after the modules it imports.
+  const std::vector<Module> &getModules() const { return modules; }
+
+private:
+  size_t visit(const std::string &name, const std::string &path);
+  std::string findSource(const std::string &name) const;
+
+private:
+  std::vector<std::string> search_paths;
+  std::vector<Module> modules;
+  std::map<std::string, size_t> indices;
+  // The source each module name was first found at.
+  std::map<std::string, std::string> paths;
+  // Modules being visited, to report cycles.
+  std::vector<std::string> stack;
+};
+} // namespace yslang
@@ -0,0 +1,1163 @@
+#include "./bytecode.hpp"
+#include "./error.hpp"
+#include "./tailrec.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+
+using namespace yslang;
+
+static const char magic[] = { 'Y', 'S', 'B', 1 };
+static const uint32_t max_registers = std::numeric_limits<uint16_t>::max();
+
+const char *yslang::opcodeName(Opcode op) {
+  static const char *const names[] = {
+#define YS_OPCODE_NAME(name) #name,
+    YS_OPCODES(YS_OPCODE_NAME)
+#undef YS_OPCODE_NAME
+  };
+  return names[static_cast<uint8_t>(op)];
+}
+
+static size_t opcode_count() {
+  static const Opcode ops[] = {
+#define YS_OPCODE_VALUE(name) Opcode::name,
+    YS_OPCODES(YS_OPCODE_VALUE)
+#undef YS_OPCODE_VALUE
+  };
+  return sizeof(ops) / sizeof(ops[0]);
+}
+
+// -------------------- //
+// Module
+// -------------------- //
+
+int BytecodeModule::find(const std::string &name) const {
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].name == name) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void BytecodeModule::verify() const {
+  for (const BytecodeFunction &func : functions) {
+    auto fail = [&](size_t at, const std::string &msg) {
+      error("bytecode: " + func.name + ": instruction " + std::to_string(at) +
+            ": " + msg);
+    };
+    if (func.code.empty() || func.registers < func.params) {
+      fail(0, "bad function header");
+    }
+
+    int64_t registers = func.registers;
+    for (size_t i = 0; i < func.code.size(); i++) {
+      const Instr &instr = func.code[i];
+      auto check_reg = [&](int64_t reg, int64_t count = 1) {
+        if (count < 0 || reg + count > registers) {
+          fail(i, "register out of range");
+        }
+      };
+      auto check_jump = [&]() {
+        int64_t to = int64_t(i) + instr.imm;
+        if (to < 0 || size_t(to) >= func.code.size()) {
+          fail(i, "jump out of range");
+        }
+      };
+      auto check_call = [&](bool memo) {
+        if (instr.imm < 0 || size_t(instr.imm) >= functions.size()) {
+          fail(i, "call of an unknown function");
+        }
+        const BytecodeFunction &callee = functions[instr.imm];
+        if (instr.b != callee.params || callee.memo != memo) {
+          fail(i, "call does not match " + callee.name);
+        }
+        check_reg(instr.a, std::max<int64_t>(instr.b, 1));
+      };
+
+      switch (instr.op) {
+      case Opcode::Move:
+        check_reg(instr.a);
+        check_reg(instr.b);
+        break;
+      case Opcode::Copy:
+        check_reg(instr.a, instr.imm);
+        check_reg(instr.b, instr.imm);
+        break;
+      case Opcode::Zero:
+        check_reg(instr.a, instr.imm);
+        break;
+      case Opcode::LoadInt:
+        check_reg(instr.a);
+        break;
+      case Opcode::LoadConst:
+        check_reg(instr.a);
+        if (instr.imm < 0 || size_t(instr.imm) >= func.constants.size()) {
+          fail(i, "constant out of range");
+        }
+        break;
+      case Opcode::Load:
+      case Opcode::Store:
+        check_reg(instr.a);
+        check_reg(instr.b, instr.imm);
+        check_reg(instr.c);
+        break;
+      case Opcode::Bound:
+        check_reg(instr.a);
+        break;
+      case Opcode::Add:
+      case Opcode::Sub:
+      case Opcode::Mul:
+      case Opcode::Div:
+      case Opcode::Equal:
+      case Opcode::NotEqual:
+      case Opcode::Less:
+      case Opcode::LessEqual:
+      case Opcode::Greater:
+      case Opcode::GreaterEqual:
+        check_reg(instr.a);
+        check_reg(instr.b);
+        check_reg(instr.c);
+        break;
+      case Opcode::AddImm:
+      case Opcode::SubImm:
+      case Opcode::MulImm:
+        check_reg(instr.a);
+        check_reg(instr.b);
+        break;
+      case Opcode::Jump:
+        check_jump();
+        break;
+      case Opcode::JumpIfZero:
+      case Opcode::JumpIfNotZero:
+        check_reg(instr.a);
+        check_jump();
+        break;
+      case Opcode::JumpIfEqual:
+      case Opcode::JumpIfNotEqual:
+      case Opcode::JumpIfLess:
+      case Opcode::JumpIfLessEqual:
+      case Opcode::JumpIfGreater:
+      case Opcode::JumpIfGreaterEqual:
+        check_reg(instr.b);
+        check_reg(instr.c);
+        check_jump();
+        break;
+      case Opcode::JumpIfEqualImm:
+      case Opcode::JumpIfNotEqualImm:
+      case Opcode::JumpIfLessImm:
+      case Opcode::JumpIfLessEqualImm:
+      case Opcode::JumpIfGreaterImm:
+      case Opcode::JumpIfGreaterEqualImm:
+        check_reg(instr.b);
+        check_jump();
+        break;
+      case Opcode::Call:
+        check_call(false);
+        break;
+      case Opcode::CallAddImm: {
+        if (instr.c >= functions.size() || functions[instr.c].params == 0 ||
+            functions[instr.c].memo) {
+          fail(i, "bad CallAddImm");
+        }
+        check_reg(instr.a, functions[instr.c].params);
+        check_reg(instr.b);
+        break;
+      }
+      case Opcode::CallReturn:
+        // The frame it replaces would have had to store a memo result.
+        if (func.memo) {
+          fail(i, "tail call from a memo function");
+        }
+        check_call(false);
+        break;
+      case Opcode::CallMemo:
+        check_call(true);
+        break;
+      case Opcode::Return:
+      case Opcode::ReturnMemo:
+        check_reg(instr.a);
+        if (func.memo != (instr.op == Opcode::ReturnMemo)) {
+          fail(i, "return does not match the function");
+        }
+        break;
+      default:
+        fail(i, "unknown opcode");
+      }
+    }
+
+    // Execution must never run past the last instruction.
+    switch (func.code.back().op) {
+    case Opcode::Jump:
+    case Opcode::CallReturn:
+    case Opcode::Return:
+    case Opcode::ReturnMemo:
+      break;
+    default:
+      fail(func.code.size() - 1, "function does not end in a jump or return");
+    }
+  }
+}
+
+static void write_uleb(std::string &out, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    out.push_back(static_cast<char>(byte));
+  } while (value != 0);
+}
+
+static void write_sleb(std::string &out, int64_t value) {
+  bool more = true;
+  while (more) {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    more = !((value == 0 && (byte & 0x40) == 0) ||
+             (value == -1 && (byte & 0x40) != 0));
+    if (more) {
+      byte |= 0x80;
+    }
+    out.push_back(static_cast<char>(byte));
+  }
+}
+
+static void write_str(std::string &out, const std::string &str) {
+  write_uleb(out, str.size());
+  out += str;
+}
+
+std::string BytecodeModule::serialize() const {
+  std::string out(magic, sizeof(magic));
+  write_uleb(out, functions.size());
+  for (const BytecodeFunction &func : functions) {
+    write_str(out, func.name);
+    write_uleb(out, func.params);
+    write_uleb(out, func.registers);
+    out.push_back(func.memo ? 1 : 0);
+    write_uleb(out, func.constants.size());
+    for (int64_t constant : func.constants) {
+      write_sleb(out, constant);
+    }
+    write_uleb(out, func.code.size());
+    for (const Instr &instr : func.code) {
+      out.push_back(static_cast<char>(instr.op));
+      write_uleb(out, instr.a);
+      write_uleb(out, instr.b);
+      write_uleb(out, instr.c);
+      write_sleb(out, instr.imm);
+    }
+  }
+  return out;
+}
+
+namespace {
+class BytecodeReader {
+public:
+  BytecodeReader(const char *p, const char *end) : p(p), end(end) {}
+
+  uint8_t byte() {
+    if (p == end) {
+      error("bytecode: truncated file");
+    }
+    return static_cast<uint8_t>(*p++);
+  }
+
+  uint64_t uleb(uint64_t max) {
+    uint64_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      uint8_t b = byte();
+      if (shift >= 63 && (b & 0x7f) > 1) {
+        error("bytecode: malformed number");
+      }
+      value |= uint64_t(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        break;
+      }
+    }
+    if (value > max) {
+      error("bytecode: number out of range");
+    }
+    return value;
+  }
+
+  int64_t sleb(int64_t min, int64_t max) {
+    uint64_t value = 0;
+    unsigned shift = 0;
+    uint8_t b;
+    do {
+      b = byte();
+      if (shift >= 64) {
+        error("bytecode: malformed number");
+      }
+      value |= uint64_t(b & 0x7f) << shift;
+      shift += 7;
+    } while (b & 0x80);
+    if (shift < 64 && (b & 0x40)) {
+      value |= ~uint64_t(0) << shift;
+    }
+    int64_t result = static_cast<int64_t>(value);
+    if (result < min || result > max) {
+      error("bytecode: number out of range");
+    }
+    return result;
+  }
+
+  std::string str() {
+    uint64_t size = uleb(end - p);
+    std::string result(p, size);
+    p += size;
+    return result;
+  }
+
+  bool done() const { return p == end; }
+
+private:
+  const char *p;
+  const char *end;
+};
+} // namespace
+
+bool BytecodeModule::isBytecode(const std::string &data) {
+  return data.size() >= sizeof(magic) &&
+         std::memcmp(data.data(), magic, sizeof(magic)) == 0;
+}
+
+void BytecodeModule::deserialize(const std::string &data) {
+  if (!isBytecode(data)) {
+    error("bytecode: not a yslang bytecode file");
+  }
+
+  BytecodeReader reader(data.data() + sizeof(magic),
+                        data.data() + data.size());
+  // Counts are bounded by the bytes left, so a corrupt count can not make
+  // a huge allocation.
+  std::vector<BytecodeFunction> result(reader.uleb(data.size()));
+  for (BytecodeFunction &func : result) {
+    func.name = reader.str();
+    func.params = reader.uleb(max_registers);
+    func.registers = reader.uleb(max_registers);
+    func.memo = reader.byte() != 0;
+    func.constants.resize(reader.uleb(data.size()));
+    for (int64_t &constant : func.constants) {
+      constant = reader.sleb(std::numeric_limits<int64_t>::min(),
+                             std::numeric_limits<int64_t>::max());
+    }
+    func.code.resize(reader.uleb(data.size()));
+    for (Instr &instr : func.code) {
+      uint8_t op = reader.byte();
+      if (op >= opcode_count()) {
+        error("bytecode: unknown opcode " + std::to_string(op));
+      }
+      instr.op = static_cast<Opcode>(op);
+      instr.a = reader.uleb(max_registers);
+      instr.b = reader.uleb(max_registers);
+      instr.c = reader.uleb(max_registers);
+      instr.imm = reader.sleb(std::numeric_limits<int32_t>::min(),
+                              std::numeric_limits<int32_t>::max());
+    }
+  }
+  if (!reader.done()) {
+    error("bytecode: trailing data");
+  }
+
+  functions = std::move(result);
+  verify();
+}
+
+void BytecodeModule::write(const std::string &path) const {
+  std::ofstream ofs(path, std::ios::binary);
+  ofs << serialize();
+  if (!ofs) {
+    error("can not write " + path);
+  }
+}
+
+void BytecodeModule::read(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (ifs.fail()) {
+    error("can not open " + path);
+  }
+  std::istreambuf_iterator<char> it(ifs);
+  std::istreambuf_iterator<char> last;
+  deserialize(std::string(it, last));
+}
+
+void BytecodeModule::dump(std::ostream &os) const {
+  for (const BytecodeFunction &func : functions) {
+    os << "func " << func.name << " params=" << func.params
+       << " registers=" << func.registers << (func.memo ? " memo" : "")
+       << "\n";
+    for (size_t i = 0; i < func.constants.size(); i++) {
+      os << "  const " << i << " = " << func.constants[i] << "\n";
+    }
+    for (size_t i = 0; i < func.code.size(); i++) {
+      const Instr &instr = func.code[i];
+      os << std::setw(6) << i << "  " << std::left << std::setw(22)
+         << opcodeName(instr.op) << std::right << instr.a << " " << instr.b
+         << " " << instr.c << " " << instr.imm << "\n";
+    }
+  }
+}
+
+// -------------------- //
+// Compiler
+// -------------------- //
+
+BytecodeModule BytecodeCompiler::compile(Program *program) {
+  TailRecElim().run(program);
+
+  BytecodeModule module;
+  std::vector<FuncDecl *> bodies;
+  for (Decl *decl : program->decls) {
+    evaluator.declare(decl);
+    if (decl->type == Decl::Kind::Func) {
+      FuncDecl *func_decl = dynamic_cast<FuncDecl *>(decl);
+      if (func_decl->is_async) {
+        error("async function " + func_decl->name + " needs native code");
+      }
+      funcs[func_decl->name] = func_decl;
+      // Imported functions have no body; calling them is an error.
+      if (func_decl->body != nullptr) {
+        func_index[func_decl->name] = static_cast<int>(bodies.size());
+        bodies.push_back(func_decl);
+      }
+    } else if (decl->type == Decl::Kind::Type) {
+      TypeDecl *type_decl = dynamic_cast<TypeDecl *>(decl);
+      types[type_decl->name->name] = type_decl->type;
+    }
+  }
+
+  module.functions.resize(bodies.size());
+  for (size_t i = 0; i < bodies.size(); i++) {
+    compileFunction(bodies[i], module.functions[i]);
+  }
+  return module;
+}
+
+void BytecodeCompiler::compileFunction(FuncDecl *func_decl,
+                                       BytecodeFunction &result) {
+  func = func_decl;
+  out = &result;
+  locals.clear();
+  loops.clear();
+
+  out->name = func->name;
+  out->memo = func->hasAttribute("memo");
+  if (resolve(func->func_type->result) != nullptr) {
+    error("function " + func->name +
+          " returns a struct or array; the bytecode VM only returns i64");
+  }
+  for (const auto &field : func->func_type->fields) {
+    if (resolve(field.type) != nullptr) {
+      error("function " + func->name +
+            " takes a struct or array; the bytecode VM only passes i64");
+    }
+    Place param;
+    param.reg = locals.size();
+    locals[field.name->name] = param;
+  }
+  out->params = func->func_type->fields.size();
+  out->registers = out->params;
+  locals_top = next_reg = out->params;
+
+  compileStmt(func->body);
+
+  // Running off the end returns 0.
+  next_reg = locals_top;
+  uint32_t zero = allocate(1);
+  emit(Opcode::LoadInt, zero);
+  emit(out->memo ? Opcode::ReturnMemo : Opcode::Return, zero);
+}
+
+void BytecodeCompiler::compileStmt(Stmt *stmt) {
+  // Temporaries never live across statements.
+  next_reg = locals_top;
+
+  switch (stmt->kind) {
+  case Stmt::Kind::Block:
+    for (Stmt *child : dynamic_cast<BlockStmt *>(stmt)->stmts) {
+      compileStmt(child);
+    }
+    break;
+  case Stmt::Kind::Let:
+    compileLet(dynamic_cast<LetStmt *>(stmt));
+    break;
+  case Stmt::Kind::Return:
+    compileReturn(dynamic_cast<ReturnStmt *>(stmt));
+    break;
+  case Stmt::Kind::If:
+    compileIf(dynamic_cast<IfStmt *>(stmt));
+    break;
+  case Stmt::Kind::While:
+    compileWhile(dynamic_cast<WhileStmt *>(stmt));
+    break;
+  case Stmt::Kind::Branch: {
+    if (loops.empty()) {
+      error("break or continue outside a loop");
+    }
+    size_t jump = emit(Opcode::Jump);
+    if (dynamic_cast<BranchStmt *>(stmt)->tok == TokenType::Break) {
+      loops.back().breaks.push_back(jump);
+    } else {
+      loops.back().continues.push_back(jump);
+    }
+    break;
+  }
+  case Stmt::Kind::Expr: {
+    // A statement drops its value, so an assignment needs no copy of it.
+    Expr *expr = dynamic_cast<ExprStmt *>(stmt)->expr;
+    auto *binary = dynamic_cast<BinaryExpr *>(expr);
+    if (binary != nullptr && binary->op == TokenType::Assign) {
+      compileAssign(binary);
+    } else {
+      compileExpr(expr, allocate(1));
+    }
+    break;
+  }
+  default:
+    error("unknown statement at compileStmt");
+  }
+}
+
+void BytecodeCompiler::compileLet(LetStmt *let) {
+  if (let->type == nullptr && let->expr == nullptr) {
+    error("let " + let->ident->name + " needs a type or a value");
+  }
+
+  Place place;
+  place.type = let->type != nullptr ? resolve(let->type) : typeOf(let->expr);
+  uint32_t size = sizeOf(place.type);
+  place.reg = allocate(size);
+  if (let->expr == nullptr) {
+    emit(Opcode::Zero, place.reg, 0, 0, size);
+  } else if (place.type == nullptr) {
+    compileExpr(let->expr, place.reg);
+  } else {
+    copyPlace(place, getPlace(let->expr));
+  }
+
+  // Bound only now, so the value can still read a variable it shadows.
+  locals_top = place.reg + size;
+  locals[let->ident->name] = place;
+}
+
+void BytecodeCompiler::compileAssign(BinaryExpr *expr, uint32_t result) {
+  Place dest = getPlace(expr->lhs);
+  if (dest.type != nullptr) {
+    if (result != no_result) {
+      error("struct or array used as i64");
+    }
+    copyPlace(dest, getPlace(expr->rhs));
+    return;
+  }
+
+  if (dest.offset >= 0) {
+    uint32_t value = compileOperand(expr->rhs);
+    emit(Opcode::Store, value, dest.reg, dest.offset, dest.bound);
+    if (result != no_result && result != value) {
+      emit(Opcode::Move, result, value);
+    }
+    return;
+  }
+
+  // The value goes to a temporary first, since computing it may still read
+  // the variable. Usually the instruction that wrote the temporary can
+  // write the variable instead.
+  uint32_t value = allocate(1);
+  compileExpr(expr->rhs, value);
+  Instr &last = out->code.back();
+  bool retargeted = false;
+  switch (last.op) {
+  case Opcode::Move:
+  case Opcode::LoadInt:
+  case Opcode::LoadConst:
+  case Opcode::Load:
+  case Opcode::Add:
+  case Opcode::Sub:
+  case Opcode::Mul:
+  case Opcode::Div:
+  case Opcode::AddImm:
+  case Opcode::SubImm:
+  case Opcode::MulImm:
+  case Opcode::Equal:
+  case Opcode::NotEqual:
+  case Opcode::Less:
+  case Opcode::LessEqual:
+  case Opcode::Greater:
+  case Opcode::GreaterEqual:
+    if (last.a == value) {
+      last.a = dest.reg;
+      retargeted = true;
+    }
+    break;
+  default:
+    break;
+  }
+  if (!retargeted) {
+    emit(Opcode::Move, dest.reg, value);
+  }
+  if (result != no_result && result != dest.reg) {
+    emit(Opcode::Move, result, dest.reg);
+  }
+}
+
+void BytecodeCompiler::compileReturn(ReturnStmt *stmt) {
+  Opcode ret = out->memo ? Opcode::ReturnMemo : Opcode::Return;
+  if (stmt->results.empty()) {
+    uint32_t zero = allocate(1);
+    emit(Opcode::LoadInt, zero);
+    emit(ret, zero);
+    return;
+  }
+
+  Expr *result = stmt->results[0];
+  if (result->type == Expr::Type::CallExpr && !out->memo) {
+    compileCall(dynamic_cast<CallExpr *>(result), allocate(1), true);
+    return;
+  }
+  emit(ret, compileOperand(result));
+}
+
+void BytecodeCompiler::compileIf(IfStmt *stmt) {
+  std::vector<size_t> to_else;
+  compileBranch(stmt->cond, false, to_else);
+  compileStmt(stmt->then_block);
+  if (stmt->else_block == nullptr) {
+    patch(to_else, out->code.size());
+    return;
+  }
+
+  size_t to_end = emit(Opcode::Jump);
+  patch(to_else, out->code.size());
+  compileStmt(stmt->else_block);
+  patch({ to_end }, out->code.size());
+}
+
+void BytecodeCompiler::compileWhile(WhileStmt *stmt) {
+  // The condition is tested at the bottom, so each iteration takes one
+  // branch. `while 1`, as TailRecElim writes, needs no jump to it first.
+  int64_t value;
+  bool forever = constantOf(stmt->cond, value) && value != 0;
+  std::vector<size_t> to_cond;
+  if (!forever) {
+    to_cond.push_back(emit(Opcode::Jump));
+  }
+
+  size_t body = out->code.size();
+  loops.emplace_back();
+  compileStmt(stmt->body);
+
+  size_t cond = out->code.size();
+  patch(to_cond, cond);
+  patch(loops.back().continues, cond);
+  next_reg = locals_top;
+  std::vector<size_t> to_body;
+  compileBranch(stmt->cond, true, to_body);
+  patch(to_body, body);
+  patch(loops.back().breaks, out->code.size());
+  loops.pop_back();
+}
+
+void BytecodeCompiler::compileExpr(Expr *expr, uint32_t dest) {
+  int64_t value;
+  switch (expr->type) {
+  case Expr::Type::BasicLit:
+    if (!constantOf(expr, value)) {
+      error("unsupported literal " + dynamic_cast<BasicLit *>(expr)->value);
+    }
+    loadConstant(dest, value);
+    return;
+  case Expr::Type::Ident:
+  case Expr::Type::RefExpr:
+  case Expr::Type::IndexExpr: {
+    if (expr->type == Expr::Type::Ident && constantOf(expr, value)) {
+      loadConstant(dest, value);
+      return;
+    }
+    Place place = getPlace(expr);
+    if (place.type != nullptr) {
+      error("struct or array used as i64");
+    }
+    if (place.offset >= 0) {
+      emit(Opcode::Load, dest, place.reg, place.offset, place.bound);
+    } else if (place.reg != dest) {
+      emit(Opcode::Move, dest, place.reg);
+    }
+    return;
+  }
+  case Expr::Type::CallExpr:
+    compileCall(dynamic_cast<CallExpr *>(expr), dest, false);
+    return;
+  case Expr::Type::BinaryExpr:
+    compileBinaryExpr(dynamic_cast<BinaryExpr *>(expr), dest);
+    return;
+  default:
+    error("unknown expression at compileExpr");
+  }
+}
+
+void BytecodeCompiler::compileCall(CallExpr *expr, uint32_t dest, bool tail) {
+  if (expr->func->type != Expr::Type::Ident) {
+    error("unsupported expr at compileCall");
+  }
+
+  const std::string &name = dynamic_cast<Ident *>(expr->func)->name;
+  auto itr = funcs.find(name);
+  if (itr == funcs.end()) {
+    error("undefined function " + name);
+  }
+  FuncDecl *callee = itr->second;
+  if (callee->body == nullptr) {
+    error("function " + name + " is imported; bytecode holds one module");
+  }
+  if (callee->func_type->fields.size() != expr->args.size()) {
+    error("function " + name + " takes " +
+          std::to_string(callee->func_type->fields.size()) +
+          " arguments, got " + std::to_string(expr->args.size()));
+  }
+
+  // Arguments are computed straight into the callee's first registers.
+  // When the result goes to the newest temporary, they start there.
+  uint32_t argc = expr->args.size();
+  uint32_t base;
+  if (dest + 1 == next_reg) {
+    base = dest;
+    allocate(argc > 0 ? argc - 1 : 0);
+  } else {
+    base = allocate(argc > 0 ? argc : 1);
+  }
+  for (uint32_t i = 0; i < argc; i++) {
+    if (typeOf(expr->args[i]) != nullptr) {
+      error("function " + name +
+            " takes a struct or array; the bytecode VM only passes i64");
+    }
+    compileExpr(expr->args[i], base + i);
+  }
+
+  int index = func_index[name];
+  bool memo = callee->hasAttribute("memo");
+  if (tail && !memo) {
+    emit(Opcode::CallReturn, base, argc, 0, index);
+    return;
+  }
+
+  // The last argument of `f(n - 1)` is computed by the call itself.
+  Instr &last = out->code.back();
+  if (!memo && argc > 0 && uint32_t(index) <= max_registers &&
+      (last.op == Opcode::AddImm || last.op == Opcode::SubImm) &&
+      last.a == base + argc - 1 && 
+      last.imm != std::numeric_limits<int32_t>::min()) {
+    last.imm = last.op == Opcode::AddImm ? last.imm : -last.imm;
+    last.op = Opcode::CallAddImm;
+    last.a = base;
+    last.c = index;
+  } else {
+    emit(memo ? Opcode::CallMemo : Opcode::Call, base, argc, 0, index);
+  }
+  if (tail) {
+    emit(out->memo ? Opcode::ReturnMemo : Opcode::Return, base);
+  } else if (dest != base) {
+    emit(Opcode::Move, dest, base);
+  }
+}
+
+static int compare_index(TokenType op) {
+  switch (op) {
+  case TokenType::Equal:
+    return 0;
+  case TokenType::NotEqual:
+    return 1;
+  case TokenType::Less:
+    return 2;
+  case TokenType::LessEqual:
+    return 3;
+  case TokenType::Greater:
+    return 4;
+  case TokenType::GreaterEqual:
+    return 5;
+  default:
+    return -1;
+  }
+}
+
+static Opcode offset_opcode(Opcode first, int index) {
+  return static_cast<Opcode>(static_cast<uint8_t>(first) + index);
+}
+
+static bool fits_int32(int64_t value) {
+  return value >= std::numeric_limits<int32_t>::min() &&
+         value <= std::numeric_limits<int32_t>::max();
+}
+
+void BytecodeCompiler::compileBinaryExpr(BinaryExpr *expr, uint32_t dest) {
+  if (expr->op == TokenType::Assign) {
+    compileAssign(expr, dest);
+    return;
+  }
+
+  int compare = compare_index(expr->op);
+  if (compare >= 0) {
+    uint32_t lhs = compileOperand(expr->lhs);
+    uint32_t rhs = compileOperand(expr->rhs);
+    emit(offset_opcode(Opcode::Equal, compare), dest, lhs, rhs);
+    return;
+  }
+
+  Opcode op, op_imm;
+  switch (expr->op) {
+  case TokenType::Plus:
+    op = Opcode::Add;
+    op_imm = Opcode::AddImm;
+    break;
+  case TokenType::Minus:
+    op = Opcode::Sub;
+    op_imm = Opcode::SubImm;
+    break;
+  case TokenType::Mul:
+    op = Opcode::Mul;
+    op_imm = Opcode::MulImm;
+    break;
+  case TokenType::Div:
+    op = op_imm = Opcode::Div;
+    break;
+  default:
+    error("not support binop at compileBinaryExpr");
+  }
+
+  // A small constant operand goes in the instruction.
+  int64_t value;
+  if (op != Opcode::Div) {
+    if (constantOf(expr->rhs, value) && fits_int32(value)) {
+      emit(op_imm, dest, compileOperand(expr->lhs), 0, value);
+      return;
+    }
+    if (op != Opcode::Sub && constantOf(expr->lhs, value) &&
+        fits_int32(value)) {
+      emit(op_imm, dest, compileOperand(expr->rhs), 0, value);
+      return;
+    }
+  }
+  uint32_t lhs = compileOperand(expr->lhs);
+  uint32_t rhs = compileOperand(expr->rhs);
+  emit(op, dest, lhs, rhs);
+}
+
+uint32_t BytecodeCompiler::compileOperand(Expr *expr) {
+  int64_t value;
+  switch (expr->type) {
+  case Expr::Type::Ident:
+  case Expr::Type::RefExpr:
+  case Expr::Type::IndexExpr: {
+    if (expr->type == Expr::Type::Ident && constantOf(expr, value)) {
+      break;
+    }
+    // A variable is its own operand.
+    Place place = getPlace(expr);
+    if (place.type != nullptr) {
+      error("struct or array used as i64");
+    }
+    if (place.offset < 0) {
+      return place.reg;
+    }
+    uint32_t temp = allocate(1);
+    emit(Opcode::Load, temp, place.reg, place.offset, place.bound);
+    return temp;
+  }
+  default:
+    break;
+  }
+
+  uint32_t temp = allocate(1);
+  compileExpr(expr, temp);
+  return temp;
+}
+
+void BytecodeCompiler::compileBranch(Expr *cond, bool when,
+                                     std::vector<size_t> &jumps) {
+  int64_t value;
+  if (constantOf(cond, value)) {
+    if ((value != 0) == when) {
+      jumps.push_back(emit(Opcode::Jump));
+    }
+    return;
+  }
+
+  // A comparison becomes a single compare-and-branch.
+  BinaryExpr *binary = dynamic_cast<BinaryExpr *>(cond);
+  int compare = binary != nullptr ? compare_index(binary->op) : -1;
+  if (compare < 0) {
+    uint32_t reg = compileOperand(cond);
+    jumps.push_back(
+        emit(when ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, reg));
+    return;
+  }
+
+  // Indexes follow the order Equal, NotEqual, Less, LessEqual, Greater,
+  // GreaterEqual.
+  static const int negated[] = { 1, 0, 5, 4, 3, 2 };
+  static const int swapped[] = { 0, 1, 4, 5, 2, 3 };
+  Expr *lhs = binary->lhs;
+  Expr *rhs = binary->rhs;
+  if (constantOf(lhs, value) && !constantOf(rhs, value)) {
+    std::swap(lhs, rhs);
+    compare = swapped[compare];
+  }
+  if (!when) {
+    compare = negated[compare];
+  }
+
+  if (constantOf(rhs, value) && value >= std::numeric_limits<int16_t>::min() &&
+      value <= std::numeric_limits<int16_t>::max()) {
+    uint32_t reg = compileOperand(lhs);
+    jumps.push_back(emit(offset_opcode(Opcode::JumpIfEqualImm, compare), 0,
+                         reg, static_cast<uint16_t>(value)));
+    return;
+  }
+  uint32_t lhs_reg = compileOperand(lhs);
+  uint32_t rhs_reg = compileOperand(rhs);
+  jumps.push_back(
+      emit(offset_opcode(Opcode::JumpIfEqual, compare), 0, lhs_reg, rhs_reg));
+}
+
+BytecodeCompiler::Place BytecodeCompiler::getPlace(Expr *expr) {
+  switch (expr->type) {
+  case Expr::Type::Ident: {
+    Ident *ident = dynamic_cast<Ident *>(expr);
+    auto itr = locals.find(ident->name);
+    if (itr == locals.end()) {
+      error("undefined value " + ident->name);
+    }
+    return itr->second;
+  }
+  case Expr::Type::RefExpr: {
+    RefExpr *ref = dynamic_cast<RefExpr *>(expr);
+    Place place = getPlace(ref->receiver);
+    StructType *struct_type = dynamic_cast<StructType *>(place.type);
+    if (struct_type == nullptr) {
+      error("field " + ref->ref->name + " of a non-struct value");
+    }
+    unsigned index = struct_type->index(ref->ref->name);
+    if (index >= struct_type->fields.size()) {
+      error("no field " + ref->ref->name);
+    }
+    uint32_t offset = 0;
+    for (unsigned i = 0; i < index; i++) {
+      offset += sizeOf(resolve(struct_type->fields[i].type));
+    }
+    place.reg += offset;
+    place.bound -= offset;
+    place.type = resolve(struct_type->fields[index].type);
+    return place;
+  }
+  case Expr::Type::IndexExpr: {
+    IndexExpr *index = dynamic_cast<IndexExpr *>(expr);
+    Place place = getPlace(index->receiver);
+    ArrayType *array_type = dynamic_cast<ArrayType *>(place.type);
+    if (array_type == nullptr) {
+      error("index of a non-array value");
+    }
+    uint32_t length = std::stoul(array_type->length->value);
+    Type *element = resolve(array_type->element);
+    uint32_t stride = sizeOf(element);
+    place.type = element;
+
+    int64_t value;
+    if (constantOf(index->index, value)) {
+      if (value < 0 || value >= length) {
+        error("index " + std::to_string(value) + " out of range");
+      }
+      place.reg += value * stride;
+      place.bound -= value * stride;
+      return place;
+    }
+
+    // A plain array of i64 needs only the bound check of the Load or
+    // Store; anything else checks each index on its own.
+    uint32_t item = compileOperand(index->index);
+    if (place.offset < 0 && stride == 1) {
+      place.offset = item;
+      place.bound = length;
+      return place;
+    }
+    emit(Opcode::Bound, item, 0, 0, length);
+    if (stride != 1) {
+      uint32_t scaled = allocate(1);
+      emit(Opcode::MulImm, scaled, item, 0, stride);
+      item = scaled;
+    }
+    if (place.offset >= 0) {
+      uint32_t sum = allocate(1);
+      emit(Opcode::Add, sum, place.offset, item);
+      item = sum;
+    } else {
+      place.bound = length * stride;
+    }
+    place.offset = item;
+    return place;
+  }
+  default:
+    error("can not get ref of expression");
+  }
+}
+
+void BytecodeCompiler::copyPlace(const Place &dest, const Place &src) {
+  uint32_t size = sizeOf(dest.type);
+  if (sizeOf(src.type) != size ||
+      (dest.type == nullptr) != (src.type == nullptr)) {
+    error("mismatched types in assignment");
+  }
+
+  if (dest.offset < 0 && src.offset < 0) {
+    if (dest.reg != src.reg) {
+      emit(Opcode::Copy, dest.reg, src.reg, 0, size);
+    }
+    return;
+  }
+
+  uint32_t temp = allocate(1);
+  for (uint32_t i = 0; i < size; i++) {
+    uint32_t value = src.reg + i;
+    if (src.offset >= 0) {
+      value = temp;
+      emit(Opcode::Load, temp, src.reg + i, src.offset, src.bound - i);
+    }
+    if (dest.offset >= 0) {
+      emit(Opcode::Store, value, dest.reg + i, dest.offset, dest.bound - i);
+    } else {
+      emit(Opcode::Move, dest.reg + i, value);
+    }
+  }
+}
+
+Type *BytecodeCompiler::typeOf(Expr *expr) {
+  switch (expr->type) {
+  case Expr::Type::Ident: {
+    auto itr = locals.find(dynamic_cast<Ident *>(expr)->name);
+    return itr != locals.end() ? itr->second.type : nullptr;
+  }
+  case Expr::Type::RefExpr: {
+    RefExpr *ref = dynamic_cast<RefExpr *>(expr);
+    StructType *struct_type =
+        dynamic_cast<StructType *>(typeOf(ref->receiver));
+    if (struct_type == nullptr) {
+      return nullptr;
+    }
+    unsigned index = struct_type->index(ref->ref->name);
+    if (index >= struct_type->fields.size()) {
+      return nullptr;
+    }
+    return resolve(struct_type->fields[index].type);
+  }
+  case Expr::Type::IndexExpr: {
+    IndexExpr *index = dynamic_cast<IndexExpr *>(expr);
+    ArrayType *array_type =
+        dynamic_cast<ArrayType *>(typeOf(index->receiver));
+    return array_type != nullptr ? resolve(array_type->element) : nullptr;
+  }
+  default:
+    return nullptr;
+  }
+}
+
+Type *BytecodeCompiler::resolve(Type *type) {
+  if (type == nullptr || type->kind != Type::Kind::Ident) {
+    return type;
+  }
+  const std::string &name = dynamic_cast<IdentType *>(type)->name->name;
+  if (name == "i64" || name == "void") {
+    return nullptr;
+  }
+  auto itr = types.find(name);
+  if (itr == types.end()) {
+    error("unknown type " + name);
+  }
+  return resolve(itr->second);
+}
+
+uint32_t BytecodeCompiler::sizeOf(Type *type) {
+  uint64_t size = 1;
+  if (type == nullptr) {
+    return 1;
+  } else if (type->kind == Type::Kind::Struct) {
+    size = 0;
+    for (const auto &field : dynamic_cast<StructType *>(type)->fields) {
+      size += sizeOf(resolve(field.type));
+    }
+  } else if (type->kind == Type::Kind::Array) {
+    ArrayType *array_type = dynamic_cast<ArrayType *>(type);
+    size = std::stoull(array_type->length->value) *
+           uint64_t(sizeOf(resolve(array_type->element)));
+  } else {
+    error("no values of function type");
+  }
+
+  if (size > max_registers) {
+    error("value of " + std::to_string(size) +
+          " words is too large for the bytecode VM");
+  }
+  return size;
+}
+
+bool BytecodeCompiler::constantOf(Expr *expr, int64_t &value) {
+  if (expr->type == Expr::Type::BasicLit) {
+    BasicLit *lit = dynamic_cast<BasicLit *>(expr);
+    if (lit->kind != TokenType::Integer) {
+      return false;
+    }
+    value = std::stoll(lit->value);
+    return true;
+  }
+  if (expr->type == Expr::Type::Ident) {
+    const std::string &name = dynamic_cast<Ident *>(expr)->name;
+    return locals.find(name) == locals.end() && evaluator.isConst(name) &&
+           evaluator.constant(name, value);
+  }
+  return false;
+}
+
+uint32_t BytecodeCompiler::allocate(uint32_t count) {
+  uint32_t reg = next_reg;
+  if (uint64_t(next_reg) + count > max_registers) {
+    error("function " + func->name +
+          " needs more registers than the bytecode VM has");
+  }
+  next_reg += count;
+  if (next_reg > out->registers) {
+    out->registers = next_reg;
+  }
+  return reg;
+}
+
+void BytecodeCompiler::loadConstant(uint32_t dest, int64_t value) {
+  if (fits_int32(value)) {
+    emit(Opcode::LoadInt, dest, 0, 0, value);
+    return;
+  }
+  emit(Opcode::LoadConst, dest, 0, 0, out->constants.size());
+  out->constants.push_back(value);
+}
+
+size_t BytecodeCompiler::emit(Opcode op, uint32_t a, uint32_t b, uint32_t c,
+                              int32_t imm) {
+  Instr instr;
+  instr.op = op;
+  instr.a = a;
+  instr.b = b;
+  instr.c = c;
+  instr.imm = imm;
+  out->code.push_back(instr);
+  return out->code.size() - 1;
+}
+
+void BytecodeCompiler::patch(const std::vector<size_t> &jumps, size_t target) {
+  for (size_t jump : jumps) {
+    out->code[jump].imm = int64_t(target) - int64_t(jump);
+  }
+}
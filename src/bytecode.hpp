@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./consteval.hpp"
+
+namespace yslang {
+// Opcodes of the register VM. Registers are the i64 slots of a frame; a
+// struct or array local takes one register per i64 it holds. `a`, `b` and
+// `c` name registers unless noted, `imm` is a jump offset from the jump
+// itself, constant index, function index or count.
+//
+// The Jump* compare-and-branch forms jump by `imm` when `b <op> c`; their
+// Imm variants compare with `c` read as a signed 16-bit constant. Call
+// passes the `b` registers from `a` up as the callee's first registers and
+// puts the result in `a`. CallAddImm calls function `c` after setting its
+// last argument to `b + imm`, as in `f(n - 1)`. CallReturn is a call in
+// tail position: it reuses the frame and returns the callee's result to the
+// caller.
+#define YS_OPCODES(X)                                                        \
+  X(Move)         /* a = b */                                                \
+  X(Copy)         /* a..a+imm = b..b+imm */                                  \
+  X(Zero)         /* a..a+imm = 0 */                                         \
+  X(LoadInt)      /* a = imm */                                              \
+  X(LoadConst)    /* a = constants[imm] */                                   \
+  X(Load)         /* a = r[b + c], 0 <= c < imm */                           \
+  X(Store)        /* r[b + c] = a, 0 <= c < imm */                           \
+  X(Bound)        /* fail unless 0 <= a < imm */                             \
+  X(Add)          /* a = b + c */                                            \
+  X(Sub)          /* a = b - c */                                            \
+  X(Mul)          /* a = b * c */                                            \
+  X(Div)          /* a = b / c */                                            \
+  X(AddImm)       /* a = b + imm */                                          \
+  X(SubImm)       /* a = b - imm */                                          \
+  X(MulImm)       /* a = b * imm */                                          \
+  X(Equal)        /* a = b == c */                                           \
+  X(NotEqual)     /* a = b != c */                                           \
+  X(Less)         /* a = b < c */                                            \
+  X(LessEqual)    /* a = b <= c */                                           \
+  X(Greater)      /* a = b > c */                                            \
+  X(GreaterEqual) /* a = b >= c */                                           \
+  X(Jump)                                                                    \
+  X(JumpIfZero)                                                              \
+  X(JumpIfNotZero)                                                           \
+  X(JumpIfEqual)                                                             \
+  X(JumpIfNotEqual)                                                          \
+  X(JumpIfLess)                                                              \
+  X(JumpIfLessEqual)                                                         \
+  X(JumpIfGreater)                                                           \
+  X(JumpIfGreaterEqual)                                                      \
+  X(JumpIfEqualImm)                                                          \
+  X(JumpIfNotEqualImm)                                                       \
+  X(JumpIfLessImm)                                                           \
+  X(JumpIfLessEqualImm)                                                      \
+  X(JumpIfGreaterImm)                                                        \
+  X(JumpIfGreaterEqualImm)                                                   \
+  X(Call)                                                                    \
+  X(CallAddImm)                                                              \
+  X(CallReturn)                                                              \
+  X(CallMemo)     /* Call of an @memo function */                            \
+  X(Return)       /* returns a */                                            \
+  X(ReturnMemo)   /* Return from an @memo function */
+
+enum class Opcode : uint8_t {
+#define YS_OPCODE_ENUM(name) name,
+  YS_OPCODES(YS_OPCODE_ENUM)
+#undef YS_OPCODE_ENUM
+};
+
+const char *opcodeName(Opcode op);
+
+struct Instr {
+  Opcode op;
+  uint16_t a = 0;
+  uint16_t b = 0;
+  uint16_t c = 0;
+  int32_t imm = 0;
+};
+
+struct BytecodeFunction {
+  std::string name;
+  uint16_t params = 0;
+  uint16_t registers = 0;
+  bool memo = false;
+  std::vector<Instr> code;
+  std::vector<int64_t> constants;
+};
+
+// A compiled program, which can be saved as a .ysb file and run without
+// its source.
+//
+// The file is "YSB" and a format version, then a ULEB128 function count
+// and for each function: name, params, registers, a memo byte, the SLEB128
+// constants and the instructions as an opcode byte, ULEB128 a, b, c and
+// SLEB128 imm. Counts and lengths are ULEB128.
+class BytecodeModule {
+public:
+  // Index of the function, or -1.
+  int find(const std::string &name) const;
+
+  // Checks that every register, jump and call stays inside its function
+  // and the module, so the VM can run a loaded file without checking.
+  void verify() const;
+
+  std::string serialize() const;
+  void deserialize(const std::string &data);
+  static bool isBytecode(const std::string &data);
+
+  void write(const std::string &path) const;
+  void read(const std::string &path);
+
+  void dump(std::ostream &os) const;
+
+public:
+  std::vector<BytecodeFunction> functions;
+};
+
+// Compiles a Program to bytecode. Locals live in registers, struct and
+// array ones flattened, so field access is a register offset and indexing
+// a checked Load or Store. Structs and arrays can not be passed to or
+// returned from functions; those programs need the Interpreter.
+class BytecodeCompiler {
+public:
+  // Runs TailRecElim like CodeGen.
+  BytecodeModule compile(Program *program);
+
+private:
+  // A run of registers holding a value of `type`, nullptr for i64. When
+  // indexed by a value, register `offset` is added to `reg` at run time,
+  // and the sum stays below `reg + bound`.
+  struct Place {
+    uint32_t reg = 0;
+    Type *type = nullptr;
+    int32_t offset = -1;
+    uint32_t bound = 0;
+  };
+
+  static constexpr uint32_t no_result = UINT32_MAX;
+
+  struct Loop {
+    std::vector<size_t> breaks;
+    std::vector<size_t> continues;
+  };
+
+  void compileFunction(FuncDecl *func, BytecodeFunction &out);
+  void compileStmt(Stmt *stmt);
+  void compileLet(LetStmt *let);
+  // Also copies an i64 value to `result` unless it is `no_result`, for an
+  // assignment used as a value.
+  void compileAssign(BinaryExpr *expr, uint32_t result = no_result);
+  void compileReturn(ReturnStmt *stmt);
+  void compileIf(IfStmt *stmt);
+  void compileWhile(WhileStmt *stmt);
+
+  void compileExpr(Expr *expr, uint32_t dest);
+  void compileCall(CallExpr *expr, uint32_t dest, bool tail);
+  void compileBinaryExpr(BinaryExpr *expr, uint32_t dest);
+  // A register holding the value of `expr`: the local itself for a
+  // variable, otherwise a new temporary.
+  uint32_t compileOperand(Expr *expr);
+  // Emits jumps taken when `cond` is `when`, to be patched later.
+  void compileBranch(Expr *cond, bool when, std::vector<size_t> &jumps);
+
+  Place getPlace(Expr *expr);
+  void copyPlace(const Place &dest, const Place &src);
+  Type *typeOf(Expr *expr);
+  Type *resolve(Type *type);
+  uint32_t sizeOf(Type *type);
+  bool constantOf(Expr *expr, int64_t &value);
+
+  uint32_t allocate(uint32_t count);
+  void loadConstant(uint32_t dest, int64_t value);
+  size_t emit(Opcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0,
+              int32_t imm = 0);
+  void patch(const std::vector<size_t> &jumps, size_t target);
+
+private:
+  ConstEvaluator evaluator;
+  std::map<std::string, FuncDecl *> funcs;
+  std::map<std::string, int> func_index;
+  std::map<std::string, Type *> types;
+
+  // State of the function being compiled.
+  FuncDecl *func = nullptr;
+  BytecodeFunction *out = nullptr;
+  std::map<std::string, Place> locals;
+  std::vector<Loop> loops;
+  // Registers below `locals_top` belong to variables; temporaries are
+  // taken from `next_reg` up and freed after every statement.
+  uint32_t locals_top = 0;
+  uint32_t next_reg = 0;
+};
+} // namespace yslang
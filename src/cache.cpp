@@ -0,0 +1,106 @@
+#include "./cache.hpp"
+#include <chrono>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA1.h>
+
+using namespace yslang;
+
+// Bump when a change to the compiler alters its output.
+static const char *cache_version = "yslang-cache-1";
+
+// Identifies this build of ys, so rebuilding the compiler invalidates
+// entries made by the old one.
+static std::string compiler_stamp() {
+  static int anchor;
+  std::string exe = llvm::sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&anchor));
+  llvm::sys::fs::file_status status;
+  if (exe.empty() || llvm::sys::fs::status(exe, status)) {
+    return "";
+  }
+  return exe + ":" + std::to_string(status.getSize()) + ":" +
+         std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+                            status.getLastModificationTime().time_since_epoch())
+                            .count());
+}
+
+CompileCache::CompileCache(const std::string &dir, uint64_t max_bytes)
+    : dir(dir), max_bytes(max_bytes) {
+  llvm::sys::fs::create_directories(dir);
+}
+
+std::string CompileCache::key(const std::vector<std::string> &parts) {
+  static const std::string stamp = compiler_stamp();
+
+  llvm::SHA1 hasher;
+  auto add = [&hasher](const std::string &part) {
+    // Length prefixes keep ("ab", "c") and ("a", "bc") apart.
+    hasher.update(std::to_string(part.size()) + ":");
+    hasher.update(part);
+  };
+  add(cache_version);
+  add(LLVM_VERSION_STRING);
+  add(stamp);
+  for (const auto &part : parts) {
+    add(part);
+  }
+  return llvm::toHex(hasher.final(), true);
+}
+
+std::string CompileCache::entryPath(const std::string &key) const {
+  // pruneCache only ever deletes files with this prefix.
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, "llvmcache-" + key);
+  return path.str().str();
+}
+
+bool CompileCache::lookup(const std::string &key, const std::string &output) {
+  std::string entry = entryPath(key);
+
+  int fd;
+  if (llvm::sys::fs::openFileForRead(entry, fd)) {
+    return false;
+  }
+  // Pruning is by access time, which noatime mounts never update.
+  llvm::sys::fs::setLastAccessAndModificationTime(
+      fd, std::chrono::system_clock::now());
+  llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+
+  return !llvm::sys::fs::copy_file(entry, output);
+}
+
+bool CompileCache::insert(const std::string &key, const std::string &input) {
+  llvm::SmallString<128> model(dir);
+  llvm::sys::path::append(model, "tmp-%%%%%%%%");
+
+  int fd;
+  llvm::SmallString<128> temp;
+  if (llvm::sys::fs::createUniqueFile(model, fd, temp)) {
+    return false;
+  }
+  llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+
+  if (llvm::sys::fs::copy_file(input, temp) ||
+      llvm::sys::fs::rename(temp, entryPath(key))) {
+    llvm::sys::fs::remove(temp);
+    return false;
+  }
+  return true;
+}
+
+void CompileCache::prune() {
+  llvm::CachePruningPolicy policy;
+  // Scanning is linear in the size of the cache, so parallel and batch
+  // compiles sharing one directory take turns through its timestamp file.
+  policy.Interval = std::chrono::minutes(1);
+  policy.Expiration = std::chrono::seconds(0);
+  policy.MaxSizePercentageOfAvailableSpace = 0;
+  policy.MaxSizeBytes = max_bytes;
+  llvm::pruneCache(dir, policy);
+}
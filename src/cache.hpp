@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace yslang {
+// A content-addressed directory of compiler outputs. Entries are written to
+// a temporary file and renamed into place, so parallel compilers sharing a
+// directory only ever see complete entries; a lookup that races with pruning
+// is simply a miss.
+class CompileCache {
+public:
+  CompileCache(const std::string &dir, uint64_t max_bytes);
+
+  // Hashes every part, together with the compiler identity, into a key.
+  static std::string key(const std::vector<std::string> &parts);
+
+  bool lookup(const std::string &key, const std::string &output);
+  // Leaves eviction to prune(), which each invocation calls once at the end.
+  bool insert(const std::string &key, const std::string &input);
+
+  // Evicts the least recently used entries beyond max_bytes, unless the
+  // directory was pruned within the last minute.
+  void prune();
+
+private:
+  std::string entryPath(const std::string &key) const;
+
+private:
+  std::string dir;
+  uint64_t max_bytes;
+};
+} // namespace yslang
@@ -0,0 +1,45 @@
+// ys-client forwards its arguments to a running `ys --server`, which
+// compiles in this process's directory and writes diagnostics straight to
+// its stdout and stderr. Without a server it runs ys itself.
+
+#include "./protocol.hpp"
+#include <cerrno>
+#include <iostream>
+#include <limits.h>
+
+using namespace yslang;
+
+static int run_locally(char *argv[]) {
+  argv[0] = const_cast<char *>("ys");
+  execvp("ys", argv);
+  std::cerr << "err: can not run ys: " << std::strerror(errno) << std::endl;
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  sockaddr_un addr;
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || !make_socket_address(default_socket_path(), addr) ||
+      connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    return run_locally(argv);
+  }
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    return run_locally(argv);
+  }
+
+  std::vector<std::string> request{ cwd };
+  for (int i = 0; i < argc; i++) {
+    request.push_back(argv[i]);
+  }
+
+  const int fds[3] = { 0, 1, 2 };
+  int32_t status;
+  if (!send_fds(sock, fds, 3) || !send_strings(sock, request) ||
+      !read_all(sock, &status, sizeof(status))) {
+    std::cerr << "err: lost connection to the ys server" << std::endl;
+    return 1;
+  }
+  return status;
+}
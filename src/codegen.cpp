@@ -1,21 +1,84 @@
 #include "./codegen.hpp"
 #include "./error.hpp"
+#include "./tailrec.hpp"
+#include <algorithm>
 #include <cassert>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/IR/ValueSymbolTable.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 using namespace yslang;
 
+// @memo tables: a direct-mapped array for small single arguments, and an
+// open-addressed hash with bounded linear probing for everything else.
+static const uint64_t memo_dense_size = 4096;
+static const uint64_t memo_hash_size = 1 << 16;
+static const uint64_t memo_probes = 8;
+
+// Fields of a task, the promise of an async function's coroutine: its
+// result, the coroutine awaiting it, the next task in the ready or timer
+// queue, its state and, for sleep, when it is due in nanoseconds.
+static const unsigned task_result = 0;
+static const unsigned task_waiter = 1;
+static const unsigned task_next = 2;
+static const unsigned task_state = 3;
+static const unsigned task_deadline = 4;
+
+// Tasks start when spawned, awaited or run rather than when called.
+static const int64_t task_created = 0;
+static const int64_t task_scheduled = 1;
+static const int64_t task_done = 2;
+
 CodeGen::CodeGen()
     : context(), module(new llvm::Module("top", context)), builder(context) {}
 
+// The module has to go before the context it lives in.
+CodeGen::~CodeGen() { delete module; }
+
 void CodeGen::generate(Program *program) {
+  TailRecElim().run(program);
+  if (!debug_path.empty()) {
+    startDebugInfo();
+  }
   visitProgram(program);
+  if (dibuilder) {
+    dibuilder->finalize();
+  }
+  if (!profile_path.empty()) {
+    genProfileWriter();
+  }
+  if (!summary_records.empty()) {
+    addProfileSummary();
+  }
 }
 
 void CodeGen::visitProgram(Program *program) {
+  // Types first and then every prototype, so bodies can call functions
+  // defined later in the file.
   for (Decl *decl : program->decls) {
-    visitDecl(decl);
+    evaluator.declare(decl);
+    if (decl->type == Decl::Kind::Type) {
+      visitDecl(decl);
+    }
+  }
+
+  for (Decl *decl : program->decls) {
+    if (decl->type == Decl::Kind::Func) {
+      declareFunc(dynamic_cast<FuncDecl *>(decl));
+    }
+  }
+
+  for (Decl *decl : program->decls) {
+    if (decl->type != Decl::Kind::Type) {
+      visitDecl(decl);
+    }
   }
 }
 
@@ -75,6 +138,22 @@ llvm::Type *CodeGen::getTypeByName(const std::string &name) {
   }
 }
 
+llvm::AllocaInst *CodeGen::createEntryAlloca(llvm::Type *type,
+                                             const std::string &name) {
+  // Allocas outside the entry block are dynamic stack allocations that
+  // mem2reg can not promote, and inside a loop they grow the stack.
+  llvm::BasicBlock &entry = curFunc->getEntryBlock();
+  llvm::IRBuilder<> entry_builder(&entry, entry.begin());
+  return entry_builder.CreateAlloca(type, 0, name);
+}
+
+// Code after return, break or continue is unreachable but still needs a
+// block to go into; SimplifyCFG deletes it.
+void CodeGen::startDeadBlock() {
+  auto *dummy = llvm::BasicBlock::Create(context, "dummy", curFunc);
+  builder.SetInsertPoint(dummy);
+}
+
 llvm::FunctionType *CodeGen::getFuncType(FunctionType *funcType) {
   llvm::Type *funcResult = getType(funcType->result);
 
@@ -92,32 +171,287 @@ llvm::ArrayType *CodeGen::getArrayType(ArrayType *arrayType) {
   return llvm::ArrayType::get(elementType, length);
 }
 
-void CodeGen::visitFuncDecl(FuncDecl *func_decl) {
+llvm::Function *CodeGen::declareFunc(FuncDecl *func_decl) {
+  if (module->getFunction(func_decl->name) != nullptr) {
+    error("function " + func_decl->name + " is already declared");
+  }
+
   auto *funcType = getFuncType(func_decl->func_type);
   auto *func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
                                       func_decl->name, module);
+
+  // yslang functions are only called from code CodeGen emits, so all but
+  // the C entry point can use the fast calling convention.
+  if (func_decl->name != "main") {
+    func->setCallingConv(llvm::CallingConv::Fast);
+  }
+  return func;
+}
+
+void CodeGen::visitFuncDecl(FuncDecl *func_decl) {
+  // Imported functions are only declared; their module defines them.
+  if (func_decl->body == nullptr) {
+    return;
+  }
+
+  llvm::TimeTraceScope trace("CodeGen function", func_decl->name);
+  auto *func = module->getFunction(func_decl->name);
+  // A memo wrapper has no lines of its own.
+  builder.SetCurrentDebugLocation(llvm::DebugLoc());
+
+  for (const auto &attribute : func_decl->attributes) {
+    if (attribute != "memo" && attribute != "multiversion") {
+      error("unknown attribute @" + attribute + " on " + func_decl->name);
+    }
+  }
+
+  if (func_decl->is_async) {
+    if (func_decl->hasAttribute("memo")) {
+      error("@memo function " + func_decl->name + " can not be async");
+    }
+    if (func->getReturnType() != builder.getInt64Ty()) {
+      error("async function " + func_decl->name + " must return i64");
+    }
+  }
+
+  // Cloned per CPU and dispatched through an ifunc by the Backend.
+  if (func_decl->hasAttribute("multiversion")) {
+    func->addFnAttr("yslang.multiversion");
+  }
+
+  // The body moves to an internal function behind a caching wrapper that
+  // keeps the public name, so recursive calls also hit the table.
+  if (func_decl->hasAttribute("memo")) {
+    auto *body = llvm::Function::Create(
+        func->getFunctionType(), llvm::Function::InternalLinkage,
+        func_decl->name + ".memo.body", module);
+    body->setCallingConv(llvm::CallingConv::Fast);
+    genMemoWrapper(func_decl, func, body);
+    func = body;
+  }
+
+  if (dibuilder) {
+    subprogram = dibuilder->createFunction(
+        debug_file, func_decl->name, func->getName(), debug_file,
+        func_decl->line,
+        dibuilder->createSubroutineType(dibuilder->getOrCreateTypeArray({})),
+        func_decl->line, llvm::DINode::FlagZero,
+        llvm::DISubprogram::SPFlagDefinition);
+    func->setSubprogram(subprogram);
+    setLine(func_decl->line);
+  }
+
   auto *bblock = llvm::BasicBlock::Create(context, "entry", func);
   builder.SetInsertPoint(bblock);
 
+  curFunc = func;
+  local_vals.clear();
+  if (func_decl->is_async) {
+    startCoroutine(func);
+  }
+
+  // Parameters live in allocas like other locals so they can be assigned;
+  // mem2reg turns them back into registers.
   llvm::Function::arg_iterator arg_iter = func->arg_begin();
   for (const auto &field : func_decl->func_type->fields) {
     arg_iter->setName(field.name->name);
+    auto *alloca = createEntryAlloca(arg_iter->getType(), field.name->name);
+    builder.CreateStore(&*arg_iter, alloca);
+    local_vals[field.name->name] = alloca;
     ++arg_iter;
   }
 
-  curFunc = func;
+  startProfile(func_decl, func);
   visitBlock(func_decl->body);
-  builder.CreateRet(builder.getInt64(0));
+  if (func_decl->is_async) {
+    finishCoroutine();
+  } else {
+    builder.CreateRet(builder.getInt64(0));
+  }
   curFunc = nullptr;
+  coroutine = Coroutine();
+  counters = nullptr;
+  weights = nullptr;
+  subprogram = nullptr;
+  builder.SetCurrentDebugLocation(llvm::DebugLoc());
+}
+
+void CodeGen::genMemoWrapper(FuncDecl *func_decl, llvm::Function *func,
+                             llvm::Function *body) {
+  const std::string &name = func_decl->name;
+  if (!evaluator.isPure(name)) {
+    error("@memo function " + name + " is not pure");
+  }
+
+  auto *i64 = builder.getInt64Ty();
+  auto *i8 = builder.getInt8Ty();
+  llvm::FunctionType *func_type = func->getFunctionType();
+  if (func_type->getReturnType() != i64) {
+    error("@memo function " + name + " must return i64");
+  }
+
+  std::vector<llvm::Value *> args;
+  llvm::Function::arg_iterator arg_iter = func->arg_begin();
+  for (const auto &field : func_decl->func_type->fields) {
+    if (arg_iter->getType() != i64) {
+      error("@memo function " + name + " must take i64 parameters");
+    }
+    arg_iter->setName(field.name->name);
+    args.push_back(&*arg_iter);
+    ++arg_iter;
+  }
+
+  auto call_body = [&]() {
+    auto *call = builder.CreateCall(body, args);
+    call->setCallingConv(body->getCallingConv());
+    return call;
+  };
+
+  auto *zero = builder.getInt64(0);
+  auto *entry = llvm::BasicBlock::Create(context, "entry", func);
+  auto *hash_block = llvm::BasicBlock::Create(context, "memo.hash", func);
+  builder.SetInsertPoint(entry);
+
+  if (args.size() == 1) {
+    auto *dense_vals = createMemoTable(
+        name + ".memo.dense", llvm::ArrayType::get(i64, memo_dense_size));
+    auto *dense_set = createMemoTable(
+        name + ".memo.dense.set", llvm::ArrayType::get(i8, memo_dense_size));
+    auto *check = llvm::BasicBlock::Create(context, "memo.dense", func);
+    auto *hit = llvm::BasicBlock::Create(context, "memo.dense.hit", func);
+    auto *miss = llvm::BasicBlock::Create(context, "memo.dense.miss", func);
+
+    builder.CreateCondBr(
+        builder.CreateICmpULT(args[0], builder.getInt64(memo_dense_size)),
+        check, hash_block);
+
+    builder.SetInsertPoint(check);
+    auto *set_ptr = builder.CreateInBoundsGEP(dense_set, { zero, args[0] });
+    auto *val_ptr = builder.CreateInBoundsGEP(dense_vals, { zero, args[0] });
+    auto *is_set = builder.CreateLoad(set_ptr);
+    builder.CreateCondBr(builder.CreateICmpNE(is_set, builder.getInt8(0)), hit,
+                         miss);
+
+    builder.SetInsertPoint(hit);
+    builder.CreateRet(builder.CreateLoad(val_ptr));
+
+    builder.SetInsertPoint(miss);
+    auto *result = call_body();
+    builder.CreateStore(result, val_ptr);
+    builder.CreateStore(builder.getInt8(1), set_ptr);
+    builder.CreateRet(result);
+  } else {
+    builder.CreateBr(hash_block);
+  }
+
+  size_t arity = std::max<size_t>(args.size(), 1);
+  auto *keys = createMemoTable(
+      name + ".memo.keys",
+      llvm::ArrayType::get(llvm::ArrayType::get(i64, arity), memo_hash_size));
+  auto *vals = createMemoTable(name + ".memo.vals",
+                               llvm::ArrayType::get(i64, memo_hash_size));
+  auto *used = createMemoTable(name + ".memo.used",
+                               llvm::ArrayType::get(i8, memo_hash_size));
+  auto *mask = builder.getInt64(memo_hash_size - 1);
+  auto *probes = builder.getInt64(memo_probes);
+
+  builder.SetInsertPoint(hash_block);
+  llvm::Value *hash = zero;
+  for (llvm::Value *arg : args) {
+    hash = builder.CreateMul(builder.CreateXor(hash, arg),
+                             builder.getInt64(0x9e3779b97f4a7c15ULL));
+    hash = builder.CreateXor(hash, builder.CreateLShr(hash, 32));
+  }
+
+  auto *probe = llvm::BasicBlock::Create(context, "memo.probe", func);
+  auto *compare = llvm::BasicBlock::Create(context, "memo.compare", func);
+  auto *hit = llvm::BasicBlock::Create(context, "memo.hit", func);
+  auto *next = llvm::BasicBlock::Create(context, "memo.next", func);
+  auto *compute = llvm::BasicBlock::Create(context, "memo.compute", func);
+  auto *insert = llvm::BasicBlock::Create(context, "memo.insert", func);
+  auto *store = llvm::BasicBlock::Create(context, "memo.store", func);
+  auto *insert_next =
+      llvm::BasicBlock::Create(context, "memo.insert.next", func);
+  auto *full = llvm::BasicBlock::Create(context, "memo.full", func);
+  builder.CreateBr(probe);
+
+  // Lookup: stop at the first empty slot or after memo_probes slots.
+  builder.SetInsertPoint(probe);
+  auto *i = builder.CreatePHI(i64, 2, "i");
+  i->addIncoming(zero, hash_block);
+  auto *slot = builder.CreateAnd(builder.CreateAdd(hash, i), mask);
+  auto *used_ptr = builder.CreateInBoundsGEP(used, { zero, slot });
+  auto *is_used = builder.CreateLoad(used_ptr);
+  builder.CreateCondBr(builder.CreateICmpNE(is_used, builder.getInt8(0)),
+                       compare, compute);
+
+  builder.SetInsertPoint(compare);
+  llvm::Value *match = builder.getTrue();
+  for (size_t k = 0; k < args.size(); k++) {
+    auto *key_ptr =
+        builder.CreateInBoundsGEP(keys, { zero, slot, builder.getInt64(k) });
+    auto *key = builder.CreateLoad(key_ptr);
+    match = builder.CreateAnd(match, builder.CreateICmpEQ(key, args[k]));
+  }
+  builder.CreateCondBr(match, hit, next);
+
+  builder.SetInsertPoint(hit);
+  auto *hit_ptr = builder.CreateInBoundsGEP(vals, { zero, slot });
+  builder.CreateRet(builder.CreateLoad(hit_ptr));
+
+  builder.SetInsertPoint(next);
+  auto *i_next = builder.CreateAdd(i, builder.getInt64(1));
+  i->addIncoming(i_next, next);
+  builder.CreateCondBr(builder.CreateICmpULT(i_next, probes), probe, compute);
+
+  // The body may have filled slots while it recursed, so probe again for
+  // a free one; when the chain is full the result is simply not cached.
+  builder.SetInsertPoint(compute);
+  auto *result = call_body();
+  builder.CreateBr(insert);
+
+  builder.SetInsertPoint(insert);
+  auto *j = builder.CreatePHI(i64, 2, "j");
+  j->addIncoming(zero, compute);
+  auto *free_slot = builder.CreateAnd(builder.CreateAdd(hash, j), mask);
+  auto *free_ptr = builder.CreateInBoundsGEP(used, { zero, free_slot });
+  auto *is_free = builder.CreateLoad(free_ptr);
+  builder.CreateCondBr(builder.CreateICmpEQ(is_free, builder.getInt8(0)),
+                       store, insert_next);
+
+  builder.SetInsertPoint(store);
+  for (size_t k = 0; k < args.size(); k++) {
+    auto *key_ptr = builder.CreateInBoundsGEP(
+        keys, { zero, free_slot, builder.getInt64(k) });
+    builder.CreateStore(args[k], key_ptr);
+  }
+  auto *val_ptr = builder.CreateInBoundsGEP(vals, { zero, free_slot });
+  builder.CreateStore(result, val_ptr);
+  builder.CreateStore(builder.getInt8(1), free_ptr);
+  builder.CreateRet(result);
+
+  builder.SetInsertPoint(insert_next);
+  auto *j_next = builder.CreateAdd(j, builder.getInt64(1));
+  j->addIncoming(j_next, insert_next);
+  builder.CreateCondBr(builder.CreateICmpULT(j_next, probes), insert, full);
+
+  builder.SetInsertPoint(full);
+  builder.CreateRet(result);
 }
 
+llvm::GlobalVariable *CodeGen::createMemoTable(const std::string &name,
+                                               llvm::Type *type) {
+  return new llvm::GlobalVariable(*module, type, false,
+                                  llvm::GlobalValue::InternalLinkage,
+                                  llvm::Constant::getNullValue(type), name);
+}
+
+// Uses fold to the value (genIdent), so only the check is left to do.
 void CodeGen::visitConstDecl(ConstDecl *const_decl) {
-  auto *val = genExpr(const_decl->expr);
-  auto *constant = llvm::dyn_cast<llvm::Constant>(val);
-  auto *g =
-      new llvm::GlobalVariable(*module, constant->getType(), true,
-                               llvm::GlobalValue::LinkageTypes::PrivateLinkage,
-                               constant, const_decl->name);
+  int64_t value;
+  if (!evaluator.constant(const_decl->name, value)) {
+    error("const " + const_decl->name + " is not a compile time constant");
+  }
 }
 
 void CodeGen::visitTypeDecl(TypeDecl *type_decl) {
@@ -134,8 +468,9 @@ void CodeGen::visitTypeDecl(TypeDecl *type_decl) {
       fields.push_back(getType(field.type));
     }
 
-    auto *type = llvm::StructType::get(context, fields);
-    type->setName(type_decl->name->name);
+    // Named, not literal: literal structs are uniqued by layout, so two
+    // declarations with the same fields would share one name.
+    llvm::StructType::create(context, fields, type_decl->name->name);
 
     this->structs[type_decl->name->name] = struct_type;
   }
@@ -148,6 +483,7 @@ void CodeGen::visitBlock(BlockStmt *block) {
 }
 
 void CodeGen::visitStmt(Stmt *stmt) {
+  setLine(stmt->line);
   switch (stmt->kind) {
   case Stmt::Kind::Let:
     visitLetStmt((LetStmt *)stmt);
@@ -158,6 +494,15 @@ void CodeGen::visitStmt(Stmt *stmt) {
   case Stmt::Kind::If:
     visitIfStmt((IfStmt *)stmt);
     break;
+  case Stmt::Kind::While:
+    visitWhileStmt(dynamic_cast<WhileStmt *>(stmt));
+    break;
+  case Stmt::Kind::Branch:
+    visitBranchStmt(dynamic_cast<BranchStmt *>(stmt));
+    break;
+  case Stmt::Kind::Block:
+    visitBlock(dynamic_cast<BlockStmt *>(stmt));
+    break;
   case Stmt::Kind::Expr:
     visitExprStmt(dynamic_cast<ExprStmt *>(stmt));
     break;
@@ -181,30 +526,46 @@ void CodeGen::visitLetStmt(LetStmt *stmt) {
     }
   }
 
-  auto *alloca = builder.CreateAlloca(type, 0, stmt->ident->name);
-  local_vals.emplace(stmt->ident->name, alloca);
+  auto *alloca = createEntryAlloca(type, stmt->ident->name);
+  local_vals[stmt->ident->name] = alloca;
 
-  if (val != nullptr) {
-    builder.CreateStore(val, alloca);
+  // Without a value the variable starts at zero, as in the interpreter and
+  // the VM, and again on every pass through a loop.
+  if (val == nullptr) {
+    val = llvm::Constant::getNullValue(type);
   }
+  builder.CreateStore(val, alloca);
 }
 
 void CodeGen::visitReturnStmt(ReturnStmt *stmt) {
   auto *retVal = genExpr(stmt->results[0]);
-  builder.CreateRet(retVal);
 
-  auto *dummy = llvm::BasicBlock::Create(context, "dummy");
-  builder.SetInsertPoint(dummy);
+  if (coroutine.handle != nullptr) {
+    builder.CreateStore(retVal,
+                        builder.CreateStructGEP(getTaskType(), coroutine.task,
+                                                task_result));
+    builder.CreateBr(coroutine.finish);
+    startDeadBlock();
+    return;
+  }
+
+  auto *call = llvm::dyn_cast<llvm::CallInst>(retVal);
+  if (call != nullptr && stmt->results[0]->type == Expr::Type::CallExpr) {
+    markTailCall(call);
+  }
+
+  builder.CreateRet(retVal);
+  startDeadBlock();
 }
 
 void CodeGen::visitIfStmt(IfStmt *stmt) {
-  auto *cond = genExpr(stmt->cond);
+  auto *cond = genCond(stmt->cond);
 
   auto *then_block = llvm::BasicBlock::Create(context, "if.then", curFunc);
   auto *else_block = llvm::BasicBlock::Create(context, "if.else", curFunc);
   auto *merge_block = llvm::BasicBlock::Create(context, "if.merge");
 
-  builder.CreateCondBr(cond, then_block, else_block);
+  genCondBr(cond, then_block, else_block);
 
   builder.SetInsertPoint(then_block);
   visitBlock(dynamic_cast<BlockStmt *>(stmt->then_block));
@@ -213,7 +574,7 @@ void CodeGen::visitIfStmt(IfStmt *stmt) {
 
   builder.SetInsertPoint(else_block);
   if (stmt->else_block != nullptr) {
-    visitBlock(dynamic_cast<BlockStmt *>(stmt->else_block));
+    visitStmt(stmt->else_block);
   }
   builder.CreateBr(merge_block);
   else_block = builder.GetInsertBlock();
@@ -222,6 +583,719 @@ void CodeGen::visitIfStmt(IfStmt *stmt) {
   builder.SetInsertPoint(merge_block);
 }
 
+// Loops are emitted in the canonical shape LoopSimplify would produce, so
+// rotation, LICM, unrolling and vectorization apply without repair:
+//
+//   preheader -> cond -> body -> ... -> latch -> cond
+//                 \-> exit
+//
+// continue branches to the single latch, break to the dedicated exit.
+void CodeGen::visitWhileStmt(WhileStmt *stmt) {
+  auto *preheader =
+      llvm::BasicBlock::Create(context, "while.preheader", curFunc);
+  auto *cond_block = llvm::BasicBlock::Create(context, "while.cond", curFunc);
+  auto *body_block = llvm::BasicBlock::Create(context, "while.body", curFunc);
+  auto *latch = llvm::BasicBlock::Create(context, "while.latch");
+  auto *exit_block = llvm::BasicBlock::Create(context, "while.exit");
+
+  builder.CreateBr(preheader);
+  builder.SetInsertPoint(preheader);
+  builder.CreateBr(cond_block);
+
+  builder.SetInsertPoint(cond_block);
+  genCondBr(genCond(stmt->cond), body_block, exit_block);
+
+  builder.SetInsertPoint(body_block);
+  loops.push_back(Loop{ latch, exit_block });
+  visitBlock(stmt->body);
+  loops.pop_back();
+  builder.CreateBr(latch);
+
+  curFunc->getBasicBlockList().push_back(latch);
+  builder.SetInsertPoint(latch);
+  auto *backedge = builder.CreateBr(cond_block);
+
+  // A distinct self-referential node identifies the loop, so the loop
+  // passes can attach their hints (e.g. llvm.loop.isvectorized) to it.
+  llvm::Metadata *ops[] = { nullptr };
+  auto *loop_id = llvm::MDNode::getDistinct(context, ops);
+  loop_id->replaceOperandWith(0, loop_id);
+  backedge->setMetadata(llvm::LLVMContext::MD_loop, loop_id);
+
+  curFunc->getBasicBlockList().push_back(exit_block);
+  builder.SetInsertPoint(exit_block);
+}
+
+void CodeGen::visitBranchStmt(BranchStmt *stmt) {
+  if (loops.empty()) {
+    error("break or continue outside of loop");
+  }
+
+  if (stmt->tok == TokenType::Break) {
+    builder.CreateBr(loops.back().exit);
+  } else {
+    builder.CreateBr(loops.back().latch);
+  }
+  startDeadBlock();
+}
+
+llvm::BranchInst *CodeGen::genCondBr(llvm::Value *cond,
+                                     llvm::BasicBlock *then_block,
+                                     llvm::BasicBlock *else_block) {
+  unsigned index = conditions++;
+  if (counters != nullptr) {
+    // The true count of the condition is at 1 + 2 * index, false after it.
+    auto *is_true = builder.CreateZExt(cond, builder.getInt64Ty());
+    increment(builder.CreateSub(builder.getInt64(2 + 2 * index), is_true));
+  }
+
+  auto *branch = builder.CreateCondBr(cond, then_block, else_block);
+  if (weights != nullptr) {
+    // Weights are 32-bit.
+    uint64_t taken = (*weights)[2 * index];
+    uint64_t not_taken = (*weights)[2 * index + 1];
+    uint64_t scale = std::max(taken, not_taken) / UINT32_MAX + 1;
+    branch->setMetadata(llvm::LLVMContext::MD_prof,
+                        llvm::MDBuilder(context).createBranchWeights(
+                            taken / scale, not_taken / scale));
+  }
+  return branch;
+}
+
+// Conditions CodeGen branches on in `stmt`, so counters are sized before
+// the body is generated.
+static unsigned count_conditions(Stmt *stmt) {
+  if (stmt == nullptr) {
+    return 0;
+  }
+  switch (stmt->kind) {
+  case Stmt::Kind::Block: {
+    unsigned count = 0;
+    for (Stmt *child : dynamic_cast<BlockStmt *>(stmt)->stmts) {
+      count += count_conditions(child);
+    }
+    return count;
+  }
+  case Stmt::Kind::If: {
+    auto *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    return 1 + count_conditions(if_stmt->then_block) +
+           count_conditions(if_stmt->else_block);
+  }
+  case Stmt::Kind::While:
+    return 1 + count_conditions(dynamic_cast<WhileStmt *>(stmt)->body);
+  default:
+    return 0;
+  }
+}
+
+void CodeGen::startProfile(FuncDecl *func_decl, llvm::Function *func) {
+  unsigned total = count_conditions(func_decl->body);
+  conditions = 0;
+
+  const Profile::Counts *counts =
+      profile != nullptr ? profile->find(func_decl->name) : nullptr;
+  if (counts != nullptr) {
+    func->setEntryCount(counts->entry);
+    if (counts->entry == 0) {
+      func->addFnAttr(llvm::Attribute::Cold);
+    }
+    // A profile of an older version of the function only gives its entry
+    // count.
+    if (counts->branches.size() == 2 * total) {
+      weights = &counts->branches;
+    }
+    summary_records.push_back({ counts->entry });
+    summary_records.back().insert(summary_records.back().end(),
+                                  counts->branches.begin(),
+                                  counts->branches.end());
+  }
+
+  if (!profile_path.empty()) {
+    // External, so that a function compiled on its own by --cache-functions
+    // counts into the array the writer reads; hidden keeps it in the binary.
+    auto *type = llvm::ArrayType::get(builder.getInt64Ty(), 1 + 2 * total);
+    counters = new llvm::GlobalVariable(*module, type, false,
+                                        llvm::GlobalValue::ExternalLinkage,
+                                        llvm::Constant::getNullValue(type),
+                                        func_decl->name + ".counters");
+    counters->setVisibility(llvm::GlobalValue::HiddenVisibility);
+    all_counters.emplace_back(func_decl->name, counters);
+    increment(builder.getInt64(0));
+  }
+}
+
+void CodeGen::increment(llvm::Value *index) {
+  auto *i64 = builder.getInt64Ty();
+  auto *slot = builder.CreateInBoundsGEP(counters->getValueType(), counters,
+                                         { builder.getInt64(0), index });
+  builder.CreateStore(
+      builder.CreateAdd(builder.CreateLoad(i64, slot), builder.getInt64(1)),
+      slot);
+}
+
+// The profile runtime is generated into every instrumented module: a
+// destructor that appends a line per function with fprintf, so the program
+// needs nothing beyond libc.
+void CodeGen::genProfileWriter() {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *i32 = builder.getInt32Ty();
+  auto *i64 = builder.getInt64Ty();
+  auto getenv = module->getOrInsertFunction(
+      "getenv", llvm::FunctionType::get(i8p, { i8p }, false));
+  auto fopen = module->getOrInsertFunction(
+      "fopen", llvm::FunctionType::get(i8p, { i8p, i8p }, false));
+  auto fprintf = module->getOrInsertFunction(
+      "fprintf", llvm::FunctionType::get(i32, { i8p, i8p }, true));
+  auto fclose = module->getOrInsertFunction(
+      "fclose", llvm::FunctionType::get(i32, { i8p }, false));
+
+  auto *writer = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getVoidTy(), false),
+      llvm::Function::InternalLinkage, "ys.profile.write", module);
+  auto *entry = llvm::BasicBlock::Create(context, "entry", writer);
+  auto *write = llvm::BasicBlock::Create(context, "write", writer);
+  auto *done = llvm::BasicBlock::Create(context, "done", writer);
+
+  builder.SetInsertPoint(entry);
+  auto *env = builder.CreateCall(
+      getenv, { builder.CreateGlobalStringPtr("YS_PROFILE_FILE") });
+  auto *path = builder.CreateSelect(
+      builder.CreateIsNull(env), builder.CreateGlobalStringPtr(profile_path),
+      env);
+  auto *file =
+      builder.CreateCall(fopen, { path, builder.CreateGlobalStringPtr("a") });
+  builder.CreateCondBr(builder.CreateIsNull(file), done, write);
+
+  builder.SetInsertPoint(write);
+  for (const auto &func : all_counters) {
+    auto *type = llvm::cast<llvm::ArrayType>(func.second->getValueType());
+    std::string format = func.first;
+    std::vector<llvm::Value *> args{ file, nullptr };
+    for (uint64_t i = 0; i < type->getNumElements(); i++) {
+      format += " %llu";
+      args.push_back(builder.CreateLoad(
+          i64, builder.CreateConstInBoundsGEP2_64(type, func.second, 0, i)));
+    }
+    args[1] = builder.CreateGlobalStringPtr(format + "\n");
+    builder.CreateCall(fprintf, args);
+  }
+  builder.CreateCall(fclose, { file });
+  builder.CreateBr(done);
+
+  builder.SetInsertPoint(done);
+  builder.CreateRetVoid();
+  llvm::appendToGlobalDtors(*module, writer, 0);
+}
+
+void CodeGen::addProfileSummary() {
+  llvm::InstrProfSummaryBuilder summary(
+      llvm::ProfileSummaryBuilder::DefaultCutoffs);
+  for (const auto &record : summary_records) {
+    summary.addRecord(llvm::InstrProfRecord(record));
+  }
+  module->setProfileSummary(summary.getSummary()->getMD(context),
+                            llvm::ProfileSummary::PSK_Instr);
+}
+
+void CodeGen::startDebugInfo() {
+  dibuilder.reset(new llvm::DIBuilder(*module));
+  debug_file = dibuilder->createFile(llvm::sys::path::filename(debug_path),
+                                     llvm::sys::path::parent_path(debug_path));
+  // DWARF has no code for yslang; C is the closest.
+  dibuilder->createCompileUnit(llvm::dwarf::DW_LANG_C, debug_file, "yslang",
+                               true, "", 0);
+  module->addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                        llvm::DEBUG_METADATA_VERSION);
+  module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+}
+
+void CodeGen::setLine(size_t line) {
+  // Statements without a line keep the one they were made from.
+  if (subprogram != nullptr && line != 0) {
+    builder.SetCurrentDebugLocation(
+        llvm::DILocation::get(context, line, 0, subprogram));
+  }
+}
+
+llvm::CallInst *CodeGen::callIntrinsic(llvm::Intrinsic::ID id,
+                                       llvm::ArrayRef<llvm::Value *> args,
+                                       llvm::ArrayRef<llvm::Type *> types) {
+  return builder.CreateCall(llvm::Intrinsic::getDeclaration(module, id, types),
+                            args);
+}
+
+llvm::StructType *CodeGen::getTaskType() {
+  if (task_type == nullptr) {
+    auto *i8p = builder.getInt8PtrTy();
+    auto *i64 = builder.getInt64Ty();
+    task_type = llvm::StructType::create(context, { i64, i8p, i8p, i64, i64 },
+                                         "ys.task");
+  }
+  return task_type;
+}
+
+// Every coroutine has its task at the same place in its frame, so a task is
+// found from a handle alone.
+llvm::Value *CodeGen::getTask(llvm::Value *handle) {
+  auto *promise = callIntrinsic(llvm::Intrinsic::coro_promise,
+                                { handle, builder.getInt32(8),
+                                  builder.getFalse() });
+  return builder.CreateBitCast(promise, getTaskType()->getPointerTo());
+}
+
+// An async function is a switched-resume coroutine whose ramp returns the
+// handle as an i64. The frame is malloc'ed unless CoroElide finds that it
+// does not outlive the caller, and the body waits at an initial suspend.
+void CodeGen::startCoroutine(llvm::Function *func) {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *null = llvm::ConstantPointerNull::get(i8p);
+  auto malloc = module->getOrInsertFunction(
+      "malloc", llvm::FunctionType::get(i8p, { builder.getInt64Ty() }, false));
+
+  // Marks the function for CoroSplit, as clang does for C++ coroutines.
+  func->addFnAttr("coroutine.presplit", "0");
+  auto *task = createEntryAlloca(getTaskType(), "task");
+  auto *id = callIntrinsic(llvm::Intrinsic::coro_id,
+                           { builder.getInt32(8),
+                             builder.CreateBitCast(task, i8p), null, null });
+  auto *entry = builder.GetInsertBlock();
+  auto *alloc = llvm::BasicBlock::Create(context, "coro.alloc", func);
+  auto *begin = llvm::BasicBlock::Create(context, "coro.begin", func);
+  builder.CreateCondBr(callIntrinsic(llvm::Intrinsic::coro_alloc, { id }),
+                       alloc, begin);
+
+  builder.SetInsertPoint(alloc);
+  auto *size =
+      callIntrinsic(llvm::Intrinsic::coro_size, {}, { builder.getInt64Ty() });
+  auto *frame = builder.CreateCall(malloc, { size });
+  builder.CreateBr(begin);
+
+  builder.SetInsertPoint(begin);
+  auto *memory = builder.CreatePHI(i8p, 2);
+  memory->addIncoming(null, entry);
+  memory->addIncoming(frame, alloc);
+  coroutine.id = id;
+  coroutine.handle =
+      callIntrinsic(llvm::Intrinsic::coro_begin, { id, memory });
+  coroutine.task = task;
+  coroutine.finish = llvm::BasicBlock::Create(context, "coro.finish");
+  coroutine.cleanup = llvm::BasicBlock::Create(context, "coro.cleanup");
+  coroutine.suspend = llvm::BasicBlock::Create(context, "coro.suspend");
+  builder.CreateStore(llvm::Constant::getNullValue(getTaskType()), task);
+  genSuspend(false, coroutine.cleanup);
+}
+
+// Returns come here with the result stored. The awaiting coroutine, if any,
+// is scheduled and the frame stays until the awaiter or run destroys it.
+void CodeGen::finishCoroutine() {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *task_type = getTaskType();
+  builder.CreateBr(coroutine.finish);
+
+  curFunc->getBasicBlockList().push_back(coroutine.finish);
+  builder.SetInsertPoint(coroutine.finish);
+  builder.CreateStore(
+      builder.getInt64(task_done),
+      builder.CreateStructGEP(task_type, coroutine.task, task_state));
+  auto *waiter = builder.CreateLoad(
+      i8p, builder.CreateStructGEP(task_type, coroutine.task, task_waiter));
+  builder.CreateCall(getAsyncRuntime("schedule"), { waiter });
+  genSuspend(true, coroutine.cleanup);
+
+  curFunc->getBasicBlockList().push_back(coroutine.cleanup);
+  builder.SetInsertPoint(coroutine.cleanup);
+  auto free = module->getOrInsertFunction(
+      "free", llvm::FunctionType::get(builder.getVoidTy(), { i8p }, false));
+  auto *memory = callIntrinsic(llvm::Intrinsic::coro_free,
+                               { coroutine.id, coroutine.handle });
+  builder.CreateCall(free, { memory });
+  builder.CreateBr(coroutine.suspend);
+
+  curFunc->getBasicBlockList().push_back(coroutine.suspend);
+  builder.SetInsertPoint(coroutine.suspend);
+  callIntrinsic(llvm::Intrinsic::coro_end,
+                { coroutine.handle, builder.getFalse() });
+  builder.CreateRet(
+      builder.CreatePtrToInt(coroutine.handle, builder.getInt64Ty()));
+}
+
+// Suspends the coroutine; destroying it there goes to `cleanup`. A resume
+// continues at the insert point this leaves, except after the final suspend,
+// which can not be resumed and, as in clang, cleans up.
+void CodeGen::genSuspend(bool final, llvm::BasicBlock *cleanup) {
+  auto *state = callIntrinsic(
+      llvm::Intrinsic::coro_suspend,
+      { llvm::ConstantTokenNone::get(context), builder.getInt1(final) });
+  auto *resume =
+      final ? coroutine.cleanup
+            : llvm::BasicBlock::Create(context, "coro.resume", curFunc);
+  auto *cases = builder.CreateSwitch(state, coroutine.suspend, 2);
+  cases->addCase(builder.getInt8(0), resume);
+  cases->addCase(builder.getInt8(1), cleanup);
+  if (!final) {
+    builder.SetInsertPoint(resume);
+  }
+}
+
+// `await t` starts t if needed and suspends until t finishes, then takes its
+// result and destroys it; a task is awaited once. Destroying the awaiter
+// destroys t too, so t never outlives it and, when t was made right there,
+// CoroElide can put t's frame in the awaiter's.
+llvm::Value *CodeGen::genAwaitExpr(AwaitExpr *expr) {
+  if (coroutine.handle == nullptr) {
+    error("await outside an async function");
+  }
+  llvm::Value *operand = genExpr(expr->operand);
+  if (!operand->getType()->isIntegerTy(64)) {
+    error("await needs a task");
+  }
+
+  auto *task_type = getTaskType();
+  auto *handle = builder.CreateIntToPtr(operand, builder.getInt8PtrTy());
+  auto *task = getTask(handle);
+  auto *wait = llvm::BasicBlock::Create(context, "await.wait", curFunc);
+  auto *cleanup = llvm::BasicBlock::Create(context, "await.cleanup", curFunc);
+  auto *ready = llvm::BasicBlock::Create(context, "await.ready");
+  auto *state = builder.CreateLoad(
+      builder.getInt64Ty(),
+      builder.CreateStructGEP(task_type, task, task_state));
+  builder.CreateCondBr(
+      builder.CreateICmpEQ(state, builder.getInt64(task_done)), ready, wait);
+
+  builder.SetInsertPoint(wait);
+  builder.CreateStore(coroutine.handle,
+                      builder.CreateStructGEP(task_type, task, task_waiter));
+  builder.CreateCall(getAsyncRuntime("spawn"), { operand });
+  genSuspend(false, cleanup);
+  builder.CreateBr(ready);
+
+  builder.SetInsertPoint(cleanup);
+  callIntrinsic(llvm::Intrinsic::coro_destroy, { handle });
+  builder.CreateBr(coroutine.cleanup);
+
+  curFunc->getBasicBlockList().push_back(ready);
+  builder.SetInsertPoint(ready);
+  auto *result = builder.CreateLoad(
+      builder.getInt64Ty(),
+      builder.CreateStructGEP(task_type, task, task_result));
+  callIntrinsic(llvm::Intrinsic::coro_destroy, { handle });
+  return result;
+}
+
+llvm::Function *CodeGen::getAsyncRuntime(const std::string &name) {
+  if (!async_runtime) {
+    async_runtime = true;
+    genAsyncRuntime();
+  }
+  return module->getFunction("ys.async." + name);
+}
+
+// The event loop is generated into every module that uses tasks, as
+// linkonce_odr so that linked modules share one queue:
+//
+//   ys.async.schedule(handle)  appends a coroutine to the ready queue
+//   ys.async.spawn(task)       starts a task that has not started, then
+//                              gives it back
+//   ys.async.run(task)         starts the task and resumes ready coroutines,
+//                              sleeping until the next timer when none is
+//                              ready, until the task finishes; gives its
+//                              result and destroys it
+//   ys.async.sleep(ms)         a task that finishes after ms milliseconds
+//
+// Both queues link tasks through their next field; timers are kept sorted
+// by deadline.
+void CodeGen::genAsyncRuntime() {
+  llvm::IRBuilderBase::InsertPointGuard guard(builder);
+  builder.SetCurrentDebugLocation(llvm::DebugLoc());
+  llvm::Function *outer = curFunc;
+  Coroutine outer_coroutine = coroutine;
+
+  auto *i8p = builder.getInt8PtrTy();
+  auto *i32 = builder.getInt32Ty();
+  auto *i64 = builder.getInt64Ty();
+  auto *task_type = getTaskType();
+  auto *null = llvm::ConstantPointerNull::get(i8p);
+  auto linkage = llvm::GlobalValue::LinkOnceODRLinkage;
+  auto queue = [&](const std::string &name) {
+    return new llvm::GlobalVariable(*module, i8p, false, linkage, null, name);
+  };
+  auto *ready = queue("ys.async.ready");
+  auto *ready_tail = queue("ys.async.ready.tail");
+  auto *timers = queue("ys.async.timers");
+  auto *timers_tail = queue("ys.async.timers.tail");
+  auto create = [&](const std::string &name, llvm::Type *result,
+                    llvm::ArrayRef<llvm::Type *> params) {
+    return llvm::Function::Create(
+        llvm::FunctionType::get(result, params, false), linkage,
+        "ys.async." + name, module);
+  };
+  auto block = [&](const std::string &name, llvm::Function *func) {
+    return llvm::BasicBlock::Create(context, name, func);
+  };
+  auto field = [&](llvm::Value *handle, unsigned index) {
+    return builder.CreateStructGEP(task_type, getTask(handle), index);
+  };
+  auto *timespec = llvm::ArrayType::get(i64, 2);
+  auto clock_gettime = module->getOrInsertFunction(
+      "clock_gettime", llvm::FunctionType::get(i32, { i32, i8p }, false));
+  auto nanosleep = module->getOrInsertFunction(
+      "nanosleep", llvm::FunctionType::get(i32, { i8p, i8p }, false));
+  auto write = module->getOrInsertFunction(
+      "write", llvm::FunctionType::get(i64, { i32, i8p, i64 }, false));
+  auto abort = module->getOrInsertFunction(
+      "abort", llvm::FunctionType::get(builder.getVoidTy(), false));
+
+  // A finished task with no awaiter schedules nothing.
+  auto *schedule = create("schedule", builder.getVoidTy(), { i8p });
+  {
+    llvm::Value *handle = &*schedule->arg_begin();
+    auto *entry = block("entry", schedule);
+    auto *push = block("push", schedule);
+    auto *first = block("first", schedule);
+    auto *append = block("append", schedule);
+    auto *done = block("done", schedule);
+    auto *exit = block("exit", schedule);
+    builder.SetInsertPoint(entry);
+    builder.CreateCondBr(builder.CreateIsNull(handle), exit, push);
+
+    builder.SetInsertPoint(push);
+    builder.CreateStore(null, field(handle, task_next));
+    auto *tail = builder.CreateLoad(i8p, ready_tail);
+    builder.CreateCondBr(builder.CreateIsNull(tail), first, append);
+
+    builder.SetInsertPoint(first);
+    builder.CreateStore(handle, ready);
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(append);
+    builder.CreateStore(handle, field(tail, task_next));
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    builder.CreateStore(handle, ready_tail);
+    builder.CreateBr(exit);
+
+    builder.SetInsertPoint(exit);
+    builder.CreateRetVoid();
+  }
+
+  auto *spawn = create("spawn", i64, { i64 });
+  {
+    llvm::Value *task = &*spawn->arg_begin();
+    auto *entry = block("entry", spawn);
+    auto *start = block("start", spawn);
+    auto *done = block("done", spawn);
+    builder.SetInsertPoint(entry);
+    auto *handle = builder.CreateIntToPtr(task, i8p);
+    auto *state = field(handle, task_state);
+    builder.CreateCondBr(builder.CreateICmpEQ(builder.CreateLoad(i64, state),
+                                              builder.getInt64(task_created)),
+                         start, done);
+
+    builder.SetInsertPoint(start);
+    builder.CreateStore(builder.getInt64(task_scheduled), state);
+    builder.CreateCall(schedule, { handle });
+    builder.CreateBr(done);
+
+    builder.SetInsertPoint(done);
+    builder.CreateRet(task);
+  }
+
+  // CLOCK_MONOTONIC in nanoseconds.
+  auto *now = create("now", i64, {});
+  {
+    builder.SetInsertPoint(block("entry", now));
+    auto *time = builder.CreateAlloca(timespec);
+    builder.CreateCall(clock_gettime, { builder.getInt32(1),
+                                        builder.CreateBitCast(time, i8p) });
+    auto *seconds = builder.CreateLoad(
+        i64, builder.CreateConstInBoundsGEP2_64(timespec, time, 0, 0));
+    auto *nanoseconds = builder.CreateLoad(
+        i64, builder.CreateConstInBoundsGEP2_64(timespec, time, 0, 1));
+    builder.CreateRet(builder.CreateAdd(
+        builder.CreateMul(seconds, builder.getInt64(1000000000)),
+        nanoseconds));
+  }
+
+  // Inlined, so that CoroElide sees run(f(x)) destroy f's task before the
+  // caller returns and puts the frame on the caller's stack.
+  auto *run = create("run", i64, { i64 });
+  run->addFnAttr(llvm::Attribute::AlwaysInline);
+  {
+    llvm::Value *task = &*run->arg_begin();
+    auto *entry = block("entry", run);
+    auto *loop = block("loop", run);
+    auto *poll = block("poll", run);
+    auto *resume = block("resume", run);
+    auto *timer = block("timer", run);
+    auto *wait = block("wait", run);
+    auto *nap = block("nap", run);
+    auto *wake = block("wake", run);
+    auto *deadlock = block("deadlock", run);
+    auto *done = block("done", run);
+    builder.SetInsertPoint(entry);
+    auto *time = builder.CreateAlloca(timespec);
+    auto *handle = builder.CreateIntToPtr(task, i8p);
+    builder.CreateCall(spawn, { task });
+    builder.CreateBr(loop);
+
+    builder.SetInsertPoint(loop);
+    auto *state = builder.CreateLoad(i64, field(handle, task_state));
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(state, builder.getInt64(task_done)), done, poll);
+
+    builder.SetInsertPoint(poll);
+    auto *head = builder.CreateLoad(i8p, ready);
+    builder.CreateCondBr(builder.CreateIsNull(head), timer, resume);
+
+    builder.SetInsertPoint(resume);
+    auto *next = builder.CreateLoad(i8p, field(head, task_next));
+    builder.CreateStore(next, ready);
+    auto *tail = builder.CreateLoad(i8p, ready_tail);
+    builder.CreateStore(
+        builder.CreateSelect(builder.CreateIsNull(next), null, tail),
+        ready_tail);
+    callIntrinsic(llvm::Intrinsic::coro_resume, { head });
+    builder.CreateBr(loop);
+
+    builder.SetInsertPoint(timer);
+    auto *first = builder.CreateLoad(i8p, timers);
+    builder.CreateCondBr(builder.CreateIsNull(first), deadlock, wait);
+
+    // nanosleep can return early, so the deadline is checked again.
+    builder.SetInsertPoint(wait);
+    auto *left = builder.CreateSub(
+        builder.CreateLoad(i64, field(first, task_deadline)),
+        builder.CreateCall(now));
+    builder.CreateCondBr(builder.CreateICmpSGT(left, builder.getInt64(0)),
+                         nap, wake);
+
+    builder.SetInsertPoint(nap);
+    auto *billion = builder.getInt64(1000000000);
+    builder.CreateStore(
+        builder.CreateSDiv(left, billion),
+        builder.CreateConstInBoundsGEP2_64(timespec, time, 0, 0));
+    builder.CreateStore(
+        builder.CreateSRem(left, billion),
+        builder.CreateConstInBoundsGEP2_64(timespec, time, 0, 1));
+    builder.CreateCall(nanosleep, { builder.CreateBitCast(time, i8p), null });
+    builder.CreateBr(wait);
+
+    builder.SetInsertPoint(wake);
+    auto *later = builder.CreateLoad(i8p, field(first, task_next));
+    builder.CreateStore(later, timers);
+    builder.CreateStore(
+        builder.CreateSelect(builder.CreateIsNull(later), null,
+                             builder.CreateLoad(i8p, timers_tail)),
+        timers_tail);
+    builder.CreateCall(schedule, { first });
+    builder.CreateBr(loop);
+
+    // Nothing is ready and no timer is pending, so the task never finishes.
+    builder.SetInsertPoint(deadlock);
+    std::string message = "deadlock: run waits for a task nothing wakes\n";
+    builder.CreateCall(write, { builder.getInt32(2),
+                                builder.CreateGlobalStringPtr(message),
+                                builder.getInt64(message.size()) });
+    builder.CreateCall(abort);
+    builder.CreateUnreachable();
+
+    builder.SetInsertPoint(done);
+    auto *result = builder.CreateLoad(i64, field(handle, task_result));
+    callIntrinsic(llvm::Intrinsic::coro_destroy, { handle });
+    builder.CreateRet(result);
+  }
+
+  auto *sleep = create("sleep", i64, { i64 });
+  {
+    llvm::Value *ms = &*sleep->arg_begin();
+    curFunc = sleep;
+    builder.SetInsertPoint(block("entry", sleep));
+    startCoroutine(sleep);
+    auto *deadline = builder.CreateAdd(
+        builder.CreateCall(now),
+        builder.CreateMul(ms, builder.getInt64(1000000)));
+    builder.CreateStore(deadline,
+                        builder.CreateStructGEP(task_type, coroutine.task,
+                                                task_deadline));
+
+    // Sleeps of one length finish in the order they start, so the last
+    // timer is tried before walking the list.
+    auto *from = builder.GetInsertBlock();
+    auto *last_check = block("timer.last", sleep);
+    auto *append = block("timer.append", sleep);
+    auto *scan = block("timer.scan", sleep);
+    auto *check = block("timer.check", sleep);
+    auto *skip = block("timer.skip", sleep);
+    auto *insert = block("timer.insert", sleep);
+    auto *wait = block("timer.wait", sleep);
+    auto *last = builder.CreateLoad(i8p, timers_tail);
+    builder.CreateCondBr(builder.CreateIsNull(last), scan, last_check);
+
+    builder.SetInsertPoint(last_check);
+    auto *last_due = builder.CreateLoad(i64, field(last, task_deadline));
+    builder.CreateCondBr(builder.CreateICmpSLE(last_due, deadline), append,
+                         scan);
+
+    builder.SetInsertPoint(append);
+    builder.CreateStore(
+        null, builder.CreateStructGEP(task_type, coroutine.task, task_next));
+    builder.CreateStore(coroutine.handle, field(last, task_next));
+    builder.CreateStore(coroutine.handle, timers_tail);
+    builder.CreateBr(wait);
+
+    builder.SetInsertPoint(scan);
+    auto *link = builder.CreatePHI(i8p->getPointerTo(), 3);
+    link->addIncoming(timers, from);
+    link->addIncoming(timers, last_check);
+    auto *other = builder.CreateLoad(i8p, link);
+    builder.CreateCondBr(builder.CreateIsNull(other), insert, check);
+
+    builder.SetInsertPoint(check);
+    auto *due = builder.CreateLoad(i64, field(other, task_deadline));
+    builder.CreateCondBr(builder.CreateICmpSLE(due, deadline), skip, insert);
+
+    builder.SetInsertPoint(skip);
+    link->addIncoming(field(other, task_next), skip);
+    builder.CreateBr(scan);
+
+    builder.SetInsertPoint(insert);
+    builder.CreateStore(
+        other, builder.CreateStructGEP(task_type, coroutine.task, task_next));
+    builder.CreateStore(coroutine.handle, link);
+    builder.CreateStore(
+        builder.CreateSelect(builder.CreateIsNull(other), coroutine.handle,
+                             builder.CreateLoad(i8p, timers_tail)),
+        timers_tail);
+    builder.CreateBr(wait);
+
+    builder.SetInsertPoint(wait);
+    genSuspend(false, coroutine.cleanup);
+    finishCoroutine();
+  }
+
+  curFunc = outer;
+  coroutine = outer_coroutine;
+}
+
+void CodeGen::markTailCall(llvm::CallInst *call) {
+  // musttail guarantees the frame is reused, but only between identical
+  // prototypes and conventions; otherwise leave it to the backend.
+  llvm::Function *callee = call->getCalledFunction();
+  if (callee != nullptr &&
+      callee->getFunctionType() == curFunc->getFunctionType() &&
+      callee->getCallingConv() == curFunc->getCallingConv()) {
+    call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+  } else {
+    call->setTailCall();
+  }
+}
+
+// run, spawn and sleep, unless the program defines its own.
+static bool is_async_builtin(const std::string &name) {
+  return name == "run" || name == "spawn" || name == "sleep";
+}
+
 void CodeGen::visitExprStmt(ExprStmt *stmt) {
   genExpr(stmt->expr);
 }
@@ -240,12 +1314,22 @@ llvm::Value *CodeGen::genExpr(Expr *expr) {
     return genRefExpr(dynamic_cast<RefExpr *>(expr));
   case Expr::Type::IndexExpr:
     return genIndexExpr(dynamic_cast<IndexExpr *>(expr));
+  case Expr::Type::AwaitExpr:
+    return genAwaitExpr(dynamic_cast<AwaitExpr *>(expr));
   default:
     error("unknown expression at genExpr");
     return nullptr;
   }
 }
 
+// Comparisons are 0 or 1 like every other value; instcombine folds the
+// widening back into the branch.
+llvm::Value *CodeGen::genCond(Expr *expr) {
+  llvm::Value *cond = genExpr(expr);
+  return builder.CreateICmpNE(cond,
+                              llvm::Constant::getNullValue(cond->getType()));
+}
+
 llvm::Value *CodeGen::genIdent(Ident *ident) {
   auto itr = local_vals.find(ident->name);
   if (itr != local_vals.end()) {
@@ -258,6 +1342,12 @@ llvm::Value *CodeGen::genIdent(Ident *ident) {
     return v;
   }
 
+  int64_t value;
+  if (evaluator.isConst(ident->name) &&
+      evaluator.constant(ident->name, value)) {
+    return builder.getInt64(value);
+  }
+
   v = module->getNamedValue(ident->name);
   if (v == nullptr) {
     error("undefined ident " + ident->name + " at genIdent");
@@ -280,6 +1370,12 @@ llvm::Value *CodeGen::genCallExpr(CallExpr *callExpr) {
   switch (callExpr->func->type) {
   case Expr::Type::Ident:
     func = module->getFunction(((Ident *)callExpr->func)->name);
+    if (func == nullptr && is_async_builtin(((Ident *)callExpr->func)->name)) {
+      func = getAsyncRuntime(((Ident *)callExpr->func)->name);
+    }
+    if (func == nullptr) {
+      error("undefined function " + ((Ident *)callExpr->func)->name);
+    }
     break;
   default:
     error("unsupported expr at genCallExpr");
@@ -287,10 +1383,26 @@ llvm::Value *CodeGen::genCallExpr(CallExpr *callExpr) {
   }
 
   std::vector<llvm::Value *> args;
+  std::vector<int64_t> const_args;
   for (Expr *expr : callExpr->args) {
-    args.push_back(genExpr(expr));
+    llvm::Value *arg = genExpr(expr);
+    auto *const_arg = llvm::dyn_cast<llvm::ConstantInt>(arg);
+    if (const_arg != nullptr && const_arg->getBitWidth() == 64) {
+      const_args.push_back(const_arg->getSExtValue());
+    }
+    args.push_back(arg);
+  }
+
+  // Calls of side-effect-free functions with constant arguments are folded.
+  int64_t result;
+  if (const_args.size() == args.size() &&
+      evaluator.call(((Ident *)callExpr->func)->name, const_args, result)) {
+    return builder.getInt64(result);
   }
-  return builder.CreateCall(func, args);
+
+  auto *call = builder.CreateCall(func, args);
+  call->setCallingConv(func->getCallingConv());
+  return call;
 }
 
 llvm::Value *CodeGen::genBinaryExpr(BinaryExpr *expr) {
@@ -305,8 +1417,26 @@ llvm::Value *CodeGen::genBinaryExpr(BinaryExpr *expr) {
     return builder.CreateAdd(lhs, rhs);
   case TokenType::Minus:
     return builder.CreateSub(lhs, rhs);
+  case TokenType::Mul:
+    return builder.CreateMul(lhs, rhs);
+  case TokenType::Div:
+    return builder.CreateSDiv(lhs, rhs);
+  case TokenType::Equal:
+    return builder.CreateZExt(builder.CreateICmpEQ(lhs, rhs), lhs->getType());
+  case TokenType::NotEqual:
+    return builder.CreateZExt(builder.CreateICmpNE(lhs, rhs), lhs->getType());
+  case TokenType::Less:
+    return builder.CreateZExt(builder.CreateICmpSLT(lhs, rhs),
+                              lhs->getType());
   case TokenType::LessEqual:
-    return builder.CreateICmpSLE(lhs, rhs);
+    return builder.CreateZExt(builder.CreateICmpSLE(lhs, rhs),
+                              lhs->getType());
+  case TokenType::Greater:
+    return builder.CreateZExt(builder.CreateICmpSGT(lhs, rhs),
+                              lhs->getType());
+  case TokenType::GreaterEqual:
+    return builder.CreateZExt(builder.CreateICmpSGE(lhs, rhs),
+                              lhs->getType());
   default:
     std::stringstream ss;
     ss << "not support binop " << expr->op;
@@ -318,10 +1448,8 @@ llvm::Value *CodeGen::genBinaryExpr(BinaryExpr *expr) {
 llvm::Value *CodeGen::genAssignExpr(BinaryExpr *expr) {
   llvm::Value *dist = getRef(expr->lhs);
   llvm::Value *src = genExpr(expr->rhs);
-  return builder.CreateStore(src, dist);
-
-  error("unsupported assigner");
-  return nullptr;
+  builder.CreateStore(src, dist);
+  return src;
 }
 
 llvm::Value *CodeGen::genRefExpr(RefExpr *expr) {
@@ -1,25 +1,52 @@
 #pragma once
 
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <map>
+#include <memory>
 
 #include "./ast.hpp"
+#include "./consteval.hpp"
+#include "./profile.hpp"
 
 namespace yslang {
 class CodeGen {
 public:
   CodeGen();
+  ~CodeGen();
   void generate(Program *program);
   llvm::Module *getModule() {
     return module;
   }
 
+  // Counts function entries and conditions; the module appends them to
+  // `path`, or to $YS_PROFILE_FILE when set, at exit. See Profile.
+  void instrument(const std::string &path) {
+    profile_path = path;
+  }
+  // Puts the counts of `profile` on functions and branches as entry counts
+  // and branch weights, marks functions that never ran cold and adds a
+  // profile summary, which the inliner and hot/cold splitting consult.
+  void useProfile(const Profile *profile) {
+    this->profile = profile;
+  }
+  // Describes functions and the line of each statement in DWARF, with
+  // `path` as the source file, for debuggers and profilers.
+  void emitDebugInfo(const std::string &path) {
+    debug_path = path;
+  }
+
 private:
   void visitProgram(Program *program);
   void visitDecl(Decl *decl);
+  llvm::Function *declareFunc(FuncDecl *func);
   void visitFuncDecl(FuncDecl *func);
+  void genMemoWrapper(FuncDecl *func_decl, llvm::Function *func,
+                      llvm::Function *body);
+  llvm::GlobalVariable *createMemoTable(const std::string &name,
+                                        llvm::Type *type);
   void visitConstDecl(ConstDecl *constDecl);
   void visitTypeDecl(TypeDecl *typeDecl);
   void visitBlock(BlockStmt *block);
@@ -29,9 +56,38 @@ private:
   void visitLetStmt(LetStmt *stmt);
   void visitReturnStmt(ReturnStmt *stmt);
   void visitIfStmt(IfStmt *stmt);
+  void visitWhileStmt(WhileStmt *stmt);
+  void visitBranchStmt(BranchStmt *stmt);
   void visitExprStmt(ExprStmt *stmt);
+  void markTailCall(llvm::CallInst *call);
+  llvm::BranchInst *genCondBr(llvm::Value *cond, llvm::BasicBlock *then_block,
+                              llvm::BasicBlock *else_block);
+
+  // Profiles
+  void startProfile(FuncDecl *func_decl, llvm::Function *func);
+  void increment(llvm::Value *index);
+  void genProfileWriter();
+  void addProfileSummary();
+
+  // Debug info
+  void startDebugInfo();
+  void setLine(size_t line);
+
+  // Async functions
+  void startCoroutine(llvm::Function *func);
+  void finishCoroutine();
+  void genSuspend(bool final, llvm::BasicBlock *cleanup);
+  llvm::Value *genAwaitExpr(AwaitExpr *expr);
+  llvm::Value *getTask(llvm::Value *handle);
+  llvm::StructType *getTaskType();
+  llvm::Function *getAsyncRuntime(const std::string &name);
+  void genAsyncRuntime();
+  llvm::CallInst *callIntrinsic(llvm::Intrinsic::ID id,
+                                llvm::ArrayRef<llvm::Value *> args,
+                                llvm::ArrayRef<llvm::Type *> types = {});
 
   llvm::Value *genExpr(Expr *expr);
+  llvm::Value *genCond(Expr *expr);
   llvm::Value *genIdent(Ident *ident);
   llvm::Value *genBasicLit(BasicLit *lit);
   llvm::Value *genCallExpr(CallExpr *lit);
@@ -52,14 +108,57 @@ private:
   llvm::Type *getTypeByName(const std::string &name);
   void setTypeAlias(const std::string &name, llvm::Type *type);
 
+  llvm::AllocaInst *createEntryAlloca(llvm::Type *type,
+                                      const std::string &name);
+  void startDeadBlock();
+
 private:
   llvm::LLVMContext context;
   llvm::Module *module;
   llvm::IRBuilder<> builder;
 
+  ConstEvaluator evaluator;
+
+  struct Loop {
+    llvm::BasicBlock *latch; // target of continue
+    llvm::BasicBlock *exit;  // target of break
+  };
+
   llvm::Function *curFunc;
+  std::vector<Loop> loops;
   std::map<std::string, llvm::AllocaInst *> local_vals;
   std::map<std::string, llvm::Type *> types;
   std::map<std::string, StructType *> structs;
+
+  std::string profile_path;
+  const Profile *profile = nullptr;
+  // The function being generated: its counters, its entries then the true
+  // and false count of each condition, and its counts in `profile`.
+  llvm::GlobalVariable *counters = nullptr;
+  const std::vector<uint64_t> *weights = nullptr;
+  unsigned conditions = 0;
+  std::vector<std::pair<std::string, llvm::GlobalVariable *>> all_counters;
+  std::vector<std::vector<uint64_t>> summary_records;
+
+  std::string debug_path;
+  std::unique_ptr<llvm::DIBuilder> dibuilder;
+  llvm::DIFile *debug_file = nullptr;
+  // The function being generated, when it has debug info.
+  llvm::DISubprogram *subprogram = nullptr;
+
+  // The async function being generated: its coroutine, its task (the
+  // coroutine promise) and the blocks return, destruction and suspension
+  // lead to.
+  struct Coroutine {
+    llvm::Value *id = nullptr;
+    llvm::Value *handle = nullptr;
+    llvm::Value *task = nullptr;
+    llvm::BasicBlock *finish = nullptr;
+    llvm::BasicBlock *cleanup = nullptr;
+    llvm::BasicBlock *suspend = nullptr;
+  };
+  Coroutine coroutine;
+  llvm::StructType *task_type = nullptr;
+  bool async_runtime = false;
 };
 } // namespace yslang
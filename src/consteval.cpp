@@ -0,0 +1,444 @@
+#include "./consteval.hpp"
+#include <limits>
+
+using namespace yslang;
+
+ConstEvaluator::ConstEvaluator() {}
+
+void ConstEvaluator::declare(Decl *decl) {
+  switch (decl->type) {
+  case Decl::Kind::Func: {
+    FuncDecl *func = dynamic_cast<FuncDecl *>(decl);
+    funcs[func->name] = func;
+    break;
+  }
+  case Decl::Kind::Const: {
+    ConstDecl *const_decl = dynamic_cast<ConstDecl *>(decl);
+    const_exprs[const_decl->name] = const_decl->expr;
+    break;
+  }
+  default:;
+  }
+}
+
+bool ConstEvaluator::evaluate(Expr *expr, int64_t &result) {
+  if (depth == 0) {
+    steps = 0;
+  }
+
+  Frame frame;
+  return evalExpr(expr, frame, result);
+}
+
+bool ConstEvaluator::constant(const std::string &name, int64_t &result) {
+  auto itr = consts.find(name);
+  if (itr != consts.end()) {
+    result = itr->second;
+    return true;
+  }
+
+  auto expr = const_exprs.find(name);
+  if (expr == const_exprs.end()) {
+    return false;
+  }
+  if (depth >= max_depth) {
+    too_deep = true;
+    return false;
+  }
+
+  if (depth == 0) {
+    steps = 0;
+  }
+  depth++;
+  bool ok = evaluate(expr->second, result);
+  depth--;
+
+  if (ok) {
+    consts[name] = result;
+  }
+  return ok;
+}
+
+bool ConstEvaluator::call(const std::string &name,
+                          const std::vector<int64_t> &args, int64_t &result) {
+  auto itr = funcs.find(name);
+  if (itr == funcs.end()) {
+    return false;
+  }
+
+  if (depth == 0) {
+    steps = 0;
+  }
+  return invoke(itr->second, args, result);
+}
+
+bool ConstEvaluator::invoke(FuncDecl *func, const std::vector<int64_t> &args,
+                            int64_t &result) {
+  auto key = std::make_pair(func->name, args);
+  auto cached = memo.find(key);
+  if (cached != memo.end()) {
+    result = cached->second;
+    return true;
+  }
+  if (failed.count(key) != 0) {
+    return false;
+  }
+
+  // Only bodies (not externals) over integer parameters can be evaluated,
+  // and an async call makes a task rather than running the body.
+  const auto &fields = func->func_type->fields;
+  if (func->body == nullptr || func->is_async ||
+      fields.size() != args.size() || !isInteger(func->func_type->result)) {
+    return false;
+  }
+  if (depth >= max_depth) {
+    too_deep = true;
+    return false;
+  }
+  for (const auto &field : fields) {
+    if (!isInteger(field.type)) {
+      return false;
+    }
+  }
+
+  Frame frame;
+  for (size_t i = 0; i < fields.size(); i++) {
+    frame[fields[i].name->name] = args[i];
+  }
+
+  // The outermost call of an evaluation gets the whole step budget, so
+  // when it fails it fails at every call site. A nested call that ran into
+  // a limit may only have had what its callers left.
+  bool outermost = calls == 0;
+  if (outermost) {
+    steps = 0;
+  }
+  bool was_too_deep = too_deep;
+  too_deep = false;
+  calls++;
+  depth++;
+  Flow flow = execBlock(func->body, frame, result);
+  depth--;
+  calls--;
+  bool limited = too_deep || steps > max_steps;
+  too_deep = was_too_deep || too_deep;
+
+  if (flow != Flow::Return) {
+    if (outermost || !limited) {
+      failed.insert(key);
+    }
+    return false;
+  }
+
+  memo[key] = result;
+  return true;
+}
+
+bool ConstEvaluator::isInteger(Type *type) {
+  return type != nullptr && type->kind == Type::Kind::Ident &&
+         dynamic_cast<IdentType *>(type)->name->name == "i64";
+}
+
+ConstEvaluator::Flow ConstEvaluator::execBlock(BlockStmt *block, Frame &frame,
+                                               int64_t &result) {
+  for (Stmt *stmt : block->stmts) {
+    Flow flow = execStmt(stmt, frame, result);
+    if (flow != Flow::Normal) {
+      return flow;
+    }
+  }
+  return Flow::Normal;
+}
+
+ConstEvaluator::Flow ConstEvaluator::execStmt(Stmt *stmt, Frame &frame,
+                                              int64_t &result) {
+  if (++steps > max_steps) {
+    return Flow::Fail;
+  }
+
+  switch (stmt->kind) {
+  case Stmt::Kind::Block:
+    return execBlock(dynamic_cast<BlockStmt *>(stmt), frame, result);
+  case Stmt::Kind::Let: {
+    LetStmt *let = dynamic_cast<LetStmt *>(stmt);
+    int64_t value = 0;
+    if (let->expr != nullptr && !evalExpr(let->expr, frame, value)) {
+      return Flow::Fail;
+    }
+    frame[let->ident->name] = value;
+    return Flow::Normal;
+  }
+  case Stmt::Kind::Return: {
+    ReturnStmt *ret = dynamic_cast<ReturnStmt *>(stmt);
+    if (ret->results.size() != 1 ||
+        !evalExpr(ret->results[0], frame, result)) {
+      return Flow::Fail;
+    }
+    return Flow::Return;
+  }
+  case Stmt::Kind::If: {
+    IfStmt *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    int64_t cond;
+    if (!evalExpr(if_stmt->cond, frame, cond)) {
+      return Flow::Fail;
+    }
+    if (cond != 0) {
+      return execStmt(if_stmt->then_block, frame, result);
+    } else if (if_stmt->else_block != nullptr) {
+      return execStmt(if_stmt->else_block, frame, result);
+    }
+    return Flow::Normal;
+  }
+  case Stmt::Kind::While: {
+    WhileStmt *while_stmt = dynamic_cast<WhileStmt *>(stmt);
+    while (true) {
+      int64_t cond;
+      if (!evalExpr(while_stmt->cond, frame, cond)) {
+        return Flow::Fail;
+      }
+      if (cond == 0) {
+        return Flow::Normal;
+      }
+
+      Flow flow = execBlock(while_stmt->body, frame, result);
+      if (flow == Flow::Break) {
+        return Flow::Normal;
+      } else if (flow == Flow::Return || flow == Flow::Fail) {
+        return flow;
+      }
+    }
+  }
+  case Stmt::Kind::Branch:
+    if (dynamic_cast<BranchStmt *>(stmt)->tok == TokenType::Break) {
+      return Flow::Break;
+    }
+    return Flow::Continue;
+  case Stmt::Kind::Expr: {
+    int64_t value;
+    if (!evalExpr(dynamic_cast<ExprStmt *>(stmt)->expr, frame, value)) {
+      return Flow::Fail;
+    }
+    return Flow::Normal;
+  }
+  default:
+    return Flow::Fail;
+  }
+}
+
+bool ConstEvaluator::evalExpr(Expr *expr, Frame &frame, int64_t &result) {
+  if (expr == nullptr || ++steps > max_steps) {
+    return false;
+  }
+
+  switch (expr->type) {
+  case Expr::Type::BasicLit: {
+    BasicLit *lit = dynamic_cast<BasicLit *>(expr);
+    if (lit->kind != TokenType::Integer) {
+      return false;
+    }
+    result = std::stoll(lit->value);
+    return true;
+  }
+  case Expr::Type::Ident:
+    return evalIdent(dynamic_cast<Ident *>(expr), frame, result);
+  case Expr::Type::CallExpr:
+    return evalCallExpr(dynamic_cast<CallExpr *>(expr), frame, result);
+  case Expr::Type::BinaryExpr:
+    return evalBinaryExpr(dynamic_cast<BinaryExpr *>(expr), frame, result);
+  default:
+    // Struct and array values only exist at runtime.
+    return false;
+  }
+}
+
+bool ConstEvaluator::evalIdent(Ident *ident, Frame &frame, int64_t &result) {
+  auto itr = frame.find(ident->name);
+  if (itr != frame.end()) {
+    result = itr->second;
+    return true;
+  }
+  return constant(ident->name, result);
+}
+
+bool ConstEvaluator::evalCallExpr(CallExpr *expr, Frame &frame,
+                                  int64_t &result) {
+  if (expr->func->type != Expr::Type::Ident) {
+    return false;
+  }
+
+  auto itr = funcs.find(dynamic_cast<Ident *>(expr->func)->name);
+  if (itr == funcs.end()) {
+    return false;
+  }
+
+  std::vector<int64_t> args;
+  for (Expr *arg : expr->args) {
+    int64_t value;
+    if (!evalExpr(arg, frame, value)) {
+      return false;
+    }
+    args.push_back(value);
+  }
+
+  return invoke(itr->second, args, result);
+}
+
+bool ConstEvaluator::evalBinaryExpr(BinaryExpr *expr, Frame &frame,
+                                    int64_t &result) {
+  if (expr->op == TokenType::Assign) {
+    if (expr->lhs->type != Expr::Type::Ident) {
+      return false;
+    }
+    auto itr = frame.find(dynamic_cast<Ident *>(expr->lhs)->name);
+    if (itr == frame.end() || !evalExpr(expr->rhs, frame, result)) {
+      return false;
+    }
+    itr->second = result;
+    return true;
+  }
+
+  int64_t lhs, rhs;
+  if (!evalExpr(expr->lhs, frame, lhs) || !evalExpr(expr->rhs, frame, rhs)) {
+    return false;
+  }
+
+  // Arithmetic wraps like the generated `add`/`sub`/`mul`.
+  uint64_t ulhs = static_cast<uint64_t>(lhs);
+  uint64_t urhs = static_cast<uint64_t>(rhs);
+  switch (expr->op) {
+  case TokenType::Plus:
+    result = static_cast<int64_t>(ulhs + urhs);
+    return true;
+  case TokenType::Minus:
+    result = static_cast<int64_t>(ulhs - urhs);
+    return true;
+  case TokenType::Mul:
+    result = static_cast<int64_t>(ulhs * urhs);
+    return true;
+  case TokenType::Div:
+    if (rhs == 0 ||
+        (lhs == std::numeric_limits<int64_t>::min() && rhs == -1)) {
+      return false;
+    }
+    result = lhs / rhs;
+    return true;
+  case TokenType::Equal:
+    result = lhs == rhs;
+    return true;
+  case TokenType::NotEqual:
+    result = lhs != rhs;
+    return true;
+  case TokenType::Less:
+    result = lhs < rhs;
+    return true;
+  case TokenType::LessEqual:
+    result = lhs <= rhs;
+    return true;
+  case TokenType::Greater:
+    result = lhs > rhs;
+    return true;
+  case TokenType::GreaterEqual:
+    result = lhs >= rhs;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ConstEvaluator::isPure(const std::string &name) {
+  auto known = purity.find(name);
+  if (known != purity.end()) {
+    return known->second;
+  }
+
+  // Every call of an async function makes a new task.
+  auto itr = funcs.find(name);
+  if (itr == funcs.end() || itr->second->body == nullptr ||
+      itr->second->is_async) {
+    return false;
+  }
+
+  // Recursive calls assume purity; a single impure callee anywhere makes
+  // the answer false, so forget what was assumed on the way.
+  auto assumed = purity;
+  purity[name] = true;
+  bool pure = isPureStmt(itr->second->body);
+  if (!pure) {
+    purity = std::move(assumed);
+  }
+  purity[name] = pure;
+  return pure;
+}
+
+bool ConstEvaluator::isPureStmt(Stmt *stmt) {
+  switch (stmt->kind) {
+  case Stmt::Kind::Block:
+    for (Stmt *child : dynamic_cast<BlockStmt *>(stmt)->stmts) {
+      if (!isPureStmt(child)) {
+        return false;
+      }
+    }
+    return true;
+  case Stmt::Kind::Let: {
+    LetStmt *let = dynamic_cast<LetStmt *>(stmt);
+    return let->expr == nullptr || isPureExpr(let->expr);
+  }
+  case Stmt::Kind::Return:
+    for (Expr *expr : dynamic_cast<ReturnStmt *>(stmt)->results) {
+      if (!isPureExpr(expr)) {
+        return false;
+      }
+    }
+    return true;
+  case Stmt::Kind::If: {
+    IfStmt *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    return isPureExpr(if_stmt->cond) && isPureStmt(if_stmt->then_block) &&
+           (if_stmt->else_block == nullptr ||
+            isPureStmt(if_stmt->else_block));
+  }
+  case Stmt::Kind::While: {
+    WhileStmt *while_stmt = dynamic_cast<WhileStmt *>(stmt);
+    return isPureExpr(while_stmt->cond) && isPureStmt(while_stmt->body);
+  }
+  case Stmt::Kind::Branch:
+    return true;
+  case Stmt::Kind::Expr:
+    return isPureExpr(dynamic_cast<ExprStmt *>(stmt)->expr);
+  default:
+    return false;
+  }
+}
+
+bool ConstEvaluator::isPureExpr(Expr *expr) {
+  switch (expr->type) {
+  case Expr::Type::BasicLit:
+  case Expr::Type::Ident:
+    // There are no mutable globals, so every name is a local or a const.
+    return true;
+  case Expr::Type::BinaryExpr: {
+    BinaryExpr *binary = dynamic_cast<BinaryExpr *>(expr);
+    return isPureExpr(binary->lhs) && isPureExpr(binary->rhs);
+  }
+  case Expr::Type::RefExpr:
+    return isPureExpr(dynamic_cast<RefExpr *>(expr)->receiver);
+  case Expr::Type::IndexExpr: {
+    IndexExpr *index = dynamic_cast<IndexExpr *>(expr);
+    return isPureExpr(index->receiver) && isPureExpr(index->index);
+  }
+  case Expr::Type::CallExpr: {
+    CallExpr *call = dynamic_cast<CallExpr *>(expr);
+    if (call->func->type != Expr::Type::Ident ||
+        !isPure(dynamic_cast<Ident *>(call->func)->name)) {
+      return false;
+    }
+    for (Expr *arg : call->args) {
+      if (!isPureExpr(arg)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
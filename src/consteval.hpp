@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "./ast.hpp"
+
+namespace yslang {
+class ConstEvaluator {
+public:
+  ConstEvaluator();
+
+  void declare(Decl *decl);
+  bool evaluate(Expr *expr, int64_t &result);
+  bool constant(const std::string &name, int64_t &result);
+  bool call(const std::string &name, const std::vector<int64_t> &args,
+            int64_t &result);
+
+  bool isConst(const std::string &name) const {
+    return const_exprs.find(name) != const_exprs.end();
+  }
+
+  // A function is pure when it only writes its own locals and calls other
+  // pure functions, so equal arguments always give equal results.
+  bool isPure(const std::string &name);
+  static bool isInteger(Type *type);
+
+public:
+  size_t max_steps = 10000000;
+  size_t max_depth = 512;
+
+private:
+  enum class Flow { Normal, Return, Break, Continue, Fail };
+  using Frame = std::map<std::string, int64_t>;
+
+  Flow execStmt(Stmt *stmt, Frame &frame, int64_t &result);
+  Flow execBlock(BlockStmt *block, Frame &frame, int64_t &result);
+  bool evalExpr(Expr *expr, Frame &frame, int64_t &result);
+  bool evalIdent(Ident *ident, Frame &frame, int64_t &result);
+  bool evalCallExpr(CallExpr *expr, Frame &frame, int64_t &result);
+  bool evalBinaryExpr(BinaryExpr *expr, Frame &frame, int64_t &result);
+  bool invoke(FuncDecl *func, const std::vector<int64_t> &args,
+              int64_t &result);
+
+  bool isPureStmt(Stmt *stmt);
+  bool isPureExpr(Expr *expr);
+
+private:
+  std::map<std::string, Expr *> const_exprs;
+  std::map<std::string, int64_t> consts;
+  std::map<std::string, FuncDecl *> funcs;
+  // Evaluated functions are side-effect free, so results can be reused.
+  std::map<std::pair<std::string, std::vector<int64_t>>, int64_t> memo;
+  // Calls that would fail at any call site are not evaluated again.
+  std::set<std::pair<std::string, std::vector<int64_t>>> failed;
+  std::map<std::string, bool> purity;
+
+  size_t steps = 0;
+  size_t depth = 0;
+  // Active invoke() calls, and whether one of them hit max_depth.
+  size_t calls = 0;
+  bool too_deep = false;
+};
+} // namespace yslang
@@ -1,10 +1,15 @@
 #pragma once
 
-#include <iostream>
+#include <stdexcept>
+#include <string>
 
 namespace yslang {
-static void error(const std::string &msg) {
-  std::cerr << "err: " << msg << std::endl;
-  exit(1);
-}
+// Thrown by error(). Callers catch it per compilation, so one broken input
+// does not take down the others compiled in the same process.
+class Error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] static void error(const std::string &msg) { throw Error(msg); }
 } // namespace yslang
@@ -0,0 +1,124 @@
+// ys-front covers the modes of ys that need no code generation: token and
+// AST dumps, syntax checks, interpreting and the bytecode VM. It does not
+// link LLVM, so editors and hooks that run it on every save do not pay for
+// loading it.
+
+#include <iostream>
+#include <iterator>
+
+#include "../third_party/cmdline.h"
+#include "./bytecode.hpp"
+#include "./error.hpp"
+#include "./interpreter.hpp"
+#include "./lexer.hpp"
+#include "./parser.hpp"
+#include "./token.hpp"
+#include "./vm.hpp"
+
+static int check_file(const cmdline::parser &cmd, const std::string &path,
+                      bool batch) {
+  auto report = [&](const std::string &msg) {
+    std::cerr << (batch ? path + ": " : "") + msg + "\n";
+  };
+
+  std::ifstream ifs(path);
+  if (ifs.fail()) {
+    report("Can not open " + path);
+    return 1;
+  }
+
+  std::istreambuf_iterator<char> it(ifs);
+  std::istreambuf_iterator<char> last;
+  std::string input(it, last);
+
+  try {
+    // Precompiled bytecode runs without its source.
+    if (cmd.exist("vm") && yslang::BytecodeModule::isBytecode(input)) {
+      yslang::BytecodeModule module;
+      module.deserialize(input);
+      return static_cast<int>(yslang::VM(std::move(module)).run());
+    }
+
+    if (cmd.exist("tokens")) {
+      yslang::Lexer lexer(input);
+      for (yslang::Token t = lexer.next(); t.type != yslang::TokenType::TEOF;
+           t = lexer.next()) {
+        std::cout << t << std::endl;
+      }
+      return 0;
+    }
+
+    yslang::Parser parser(input);
+    yslang::Program program = parser.parse();
+
+    if (parser.has_error()) {
+      for (const auto &msg : parser.error_messages) {
+        report(msg);
+      }
+      return 1;
+    }
+
+    if (cmd.exist("ast")) {
+      std::cout << program.toJson().to_string() << std::endl;
+    }
+    if (cmd.exist("bytecode") || cmd.exist("vm")) {
+      yslang::BytecodeModule module =
+          yslang::BytecodeCompiler().compile(&program);
+      if (cmd.exist("bytecode")) {
+        module.dump(std::cout);
+      }
+      if (cmd.exist("vm")) {
+        return static_cast<int>(yslang::VM(std::move(module)).run());
+      }
+    }
+    if (cmd.exist("run")) {
+      yslang::Interpreter interpreter;
+      interpreter.load(&program);
+      return static_cast<int>(interpreter.run());
+    }
+    return 0;
+  } catch (const yslang::Error &e) {
+    report(std::string("err: ") + e.what());
+  } catch (const std::string &msg) {
+    report("err: " + msg);
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  cmdline::parser cmd;
+  cmd.add("tokens", 't', "print lexed tokens");
+  cmd.add("ast", 'a', "print ast");
+  cmd.add("check", 'c', "only report syntax errors");
+  cmd.add("run", 'r', "interpret main() and exit with its result");
+  cmd.add("vm", 0, "run main() of a .yz or .ysb file on the bytecode VM");
+  cmd.add("bytecode", 'b', "print compiled bytecode");
+  cmd.footer("file...");
+
+  cmd.parse_check(argc, argv);
+
+  const auto &paths = cmd.rest();
+  bool run = cmd.exist("run") || cmd.exist("vm");
+  if (paths.size() == 0 ||
+      !(cmd.exist("tokens") || cmd.exist("ast") || cmd.exist("check") ||
+        cmd.exist("bytecode") || run)) {
+    std::cout << cmd.usage();
+    return 0;
+  }
+  if (run) {
+    if (paths.size() != 1) {
+      std::cerr << "err: --run and --vm take one file" << std::endl;
+      return 1;
+    }
+    return check_file(cmd, paths[0], false);
+  }
+
+  // Every file is checked even after an error, so one run reports them all.
+  int status = 0;
+  for (const auto &path : paths) {
+    if (check_file(cmd, path, paths.size() > 1) != 0) {
+      status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,543 @@
+#include "./instrument.hpp"
+#include "./error.hpp"
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <sstream>
+
+using namespace yslang;
+
+// Fields of a record.
+enum {
+  next_field,
+  name_field,
+  flags_field,
+  calls_field,
+  inclusive_field,
+  exclusive_field,
+  active_field
+};
+
+// Bits of the flags field.
+enum { cycles_flag = 1 };
+
+Instrumenter::Instrumenter(llvm::Module *module, const std::string &spec)
+    : module(module), context(module->getContext()), builder(context) {
+  std::istringstream kinds(spec);
+  std::string kind;
+  while (std::getline(kinds, kind, ',')) {
+    if (kind == "cycles") {
+      cycles = true;
+    } else if (kind != "calls") {
+      error("unknown instrumentation " + kind + ", expected calls or cycles");
+    }
+  }
+}
+
+void Instrumenter::run() {
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : *module) {
+    if (!func.isDeclaration() && !func.hasLocalLinkage()) {
+      funcs.push_back(&func);
+    }
+  }
+  if (funcs.empty()) {
+    return;
+  }
+
+  // Every module generates the same runtime, so the linker may keep any
+  // one copy.
+  auto *i64 = builder.getInt64Ty();
+  record_type = llvm::StructType::create(
+      context,
+      { i64, builder.getInt8PtrTy(), i64, i64, i64, i64, i64 },
+      "ys.instrument.record");
+  // Cycles the callees of the current call took so far.
+  child_cycles = new llvm::GlobalVariable(
+      *module, i64, false, llvm::GlobalValue::LinkOnceODRLinkage,
+      builder.getInt64(0), "ys.instrument.child", nullptr,
+      llvm::GlobalValue::GeneralDynamicTLSModel);
+  records = new llvm::GlobalVariable(
+      *module, i64, false, llvm::GlobalValue::LinkOnceODRLinkage,
+      builder.getInt64(0), "ys.instrument.records");
+  dumped = new llvm::GlobalVariable(
+      *module, i64, false, llvm::GlobalValue::LinkOnceODRLinkage,
+      builder.getInt64(0), "ys.instrument.dumped");
+
+  auto *enter = genEnter(genRegister());
+  auto *exit = cycles ? genExit() : nullptr;
+  for (auto *func : funcs) {
+    instrument(func, enter, exit);
+  }
+  llvm::appendToGlobalDtors(*module, genDump(), 0);
+}
+
+llvm::Function *
+Instrumenter::createFunction(const std::string &name, llvm::Type *result,
+                             const std::vector<llvm::Type *> &params) {
+  auto *func = llvm::Function::Create(
+      llvm::FunctionType::get(result, params, false),
+      llvm::Function::LinkOnceODRLinkage, name, module);
+  func->addFnAttr(llvm::Attribute::NoUnwind);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(context, "entry", func));
+  return func;
+}
+
+llvm::Value *Instrumenter::field(llvm::Value *record, unsigned field) {
+  return builder.CreateStructGEP(record_type, record, field);
+}
+
+void Instrumenter::increment(llvm::Value *ptr, llvm::Value *amount) {
+  auto *i64 = builder.getInt64Ty();
+  builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, ptr), amount),
+                      ptr);
+}
+
+void Instrumenter::emitLoop(
+    llvm::Value *count, const std::function<void(llvm::Value *)> &body) {
+  auto *func = builder.GetInsertBlock()->getParent();
+  auto *preheader = builder.GetInsertBlock();
+  auto *loop = llvm::BasicBlock::Create(context, "loop", func);
+  auto *done = llvm::BasicBlock::Create(context, "loop.done", func);
+  builder.CreateCondBr(builder.CreateIsNull(count), done, loop);
+
+  builder.SetInsertPoint(loop);
+  auto *i = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  i->addIncoming(builder.getInt64(0), preheader);
+  body(i);
+  auto *next = builder.CreateAdd(i, builder.getInt64(1));
+  i->addIncoming(next, builder.GetInsertBlock());
+  builder.CreateCondBr(builder.CreateICmpULT(next, count), loop, done);
+  builder.SetInsertPoint(done);
+}
+
+void Instrumenter::emitWalk(const std::function<void(llvm::Value *)> &body) {
+  auto *i64 = builder.getInt64Ty();
+  auto *func = builder.GetInsertBlock()->getParent();
+  auto *preheader = builder.GetInsertBlock();
+  auto *walk = llvm::BasicBlock::Create(context, "walk", func);
+  auto *visit = llvm::BasicBlock::Create(context, "visit", func);
+  auto *done = llvm::BasicBlock::Create(context, "walk.done", func);
+  auto *head = builder.CreateLoad(i64, records);
+  builder.CreateBr(walk);
+
+  builder.SetInsertPoint(walk);
+  auto *record = builder.CreatePHI(i64, 2);
+  record->addIncoming(head, preheader);
+  builder.CreateCondBr(builder.CreateIsNull(record), done, visit);
+
+  builder.SetInsertPoint(visit);
+  auto *ptr = builder.CreateIntToPtr(record, record_type->getPointerTo());
+  body(ptr);
+  record->addIncoming(builder.CreateLoad(i64, field(ptr, next_field)),
+                      builder.GetInsertBlock());
+  builder.CreateBr(walk);
+  builder.SetInsertPoint(done);
+}
+
+llvm::Function *Instrumenter::genRegister() {
+  auto *i64 = builder.getInt64Ty();
+  auto calloc = module->getOrInsertFunction(
+      "calloc",
+      llvm::FunctionType::get(builder.getInt8PtrTy(), { i64, i64 }, false));
+  auto *record_ptr = record_type->getPointerTo();
+
+  // A thread's first call of a function allocates its record and pushes it
+  // on the list, which is only read at exit.
+  auto *func = createFunction(
+      "ys.instrument.register", record_ptr,
+      { record_ptr->getPointerTo(), builder.getInt8PtrTy(), i64 });
+  func->addFnAttr(llvm::Attribute::NoInline);
+  auto arg = func->arg_begin();
+  llvm::Value *local = &*arg++;
+  llvm::Value *name = &*arg++;
+  llvm::Value *flags = &*arg;
+
+  auto *size = llvm::ConstantExpr::getSizeOf(record_type);
+  auto *raw = builder.CreateCall(calloc, { builder.getInt64(1), size });
+  auto *record = builder.CreateBitCast(raw, record_ptr);
+  builder.CreateStore(name, field(record, name_field));
+  builder.CreateStore(flags, field(record, flags_field));
+  auto *next = builder.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Xchg, records, builder.CreatePtrToInt(record, i64),
+      llvm::AtomicOrdering::SequentiallyConsistent);
+  builder.CreateStore(next, field(record, next_field));
+  builder.CreateStore(record, local);
+  builder.CreateRet(record);
+  return func;
+}
+
+llvm::Function *Instrumenter::genEnter(llvm::Function *register_record) {
+  auto *i64 = builder.getInt64Ty();
+  auto *record_ptr = record_type->getPointerTo();
+
+  // Counts a call and returns the cycles the caller's callees took so far,
+  // for genExit to restore. The flags are constant at every call, so the
+  // branch on them folds away once this is inlined.
+  auto *func = createFunction(
+      "ys.instrument.enter", i64,
+      { record_ptr->getPointerTo(), builder.getInt8PtrTy(), i64 });
+  func->addFnAttr(llvm::Attribute::AlwaysInline);
+  auto arg = func->arg_begin();
+  llvm::Value *local = &*arg++;
+  llvm::Value *name = &*arg++;
+  llvm::Value *flags = &*arg;
+
+  auto *entry = builder.GetInsertBlock();
+  auto *first = llvm::BasicBlock::Create(context, "first", func);
+  auto *count = llvm::BasicBlock::Create(context, "count", func);
+  auto *loaded = builder.CreateLoad(record_ptr, local);
+  builder.CreateCondBr(builder.CreateIsNull(loaded), first, count);
+
+  builder.SetInsertPoint(first);
+  auto *created = builder.CreateCall(register_record, { local, name, flags });
+  builder.CreateBr(count);
+
+  builder.SetInsertPoint(count);
+  auto *record = builder.CreatePHI(record_ptr, 2);
+  record->addIncoming(loaded, entry);
+  record->addIncoming(created, first);
+  increment(field(record, calls_field), builder.getInt64(1));
+  auto *timed = llvm::BasicBlock::Create(context, "timed", func);
+  auto *untimed = llvm::BasicBlock::Create(context, "untimed", func);
+  builder.CreateCondBr(
+      builder.CreateIsNull(
+          builder.CreateAnd(flags, builder.getInt64(cycles_flag))),
+      untimed, timed);
+
+  builder.SetInsertPoint(untimed);
+  builder.CreateRet(builder.getInt64(0));
+
+  builder.SetInsertPoint(timed);
+  increment(field(record, active_field), builder.getInt64(1));
+  auto *saved = builder.CreateLoad(i64, child_cycles);
+  builder.CreateStore(builder.getInt64(0), child_cycles);
+  builder.CreateRet(saved);
+  return func;
+}
+
+llvm::Function *Instrumenter::genExit() {
+  auto *i64 = builder.getInt64Ty();
+  auto *record_ptr = record_type->getPointerTo();
+
+  // Adds the `elapsed` cycles of a call, less those of its callees, and for
+  // the outermost active call of the function the whole of them.
+  auto *func = createFunction("ys.instrument.exit", builder.getVoidTy(),
+                              { record_ptr->getPointerTo(), i64, i64 });
+  func->addFnAttr(llvm::Attribute::AlwaysInline);
+  auto arg = func->arg_begin();
+  llvm::Value *local = &*arg++;
+  llvm::Value *elapsed = &*arg++;
+  llvm::Value *saved = &*arg;
+
+  auto *record = builder.CreateLoad(record_ptr, local);
+  auto *callees = builder.CreateLoad(i64, child_cycles);
+  increment(field(record, exclusive_field),
+            builder.CreateSub(elapsed, callees));
+  auto *active_ptr = field(record, active_field);
+  auto *active = builder.CreateSub(builder.CreateLoad(i64, active_ptr),
+                                   builder.getInt64(1));
+  builder.CreateStore(active, active_ptr);
+  increment(field(record, inclusive_field),
+            builder.CreateSelect(builder.CreateIsNull(active), elapsed,
+                                 builder.getInt64(0)));
+  builder.CreateStore(builder.CreateAdd(saved, elapsed), child_cycles);
+  builder.CreateRetVoid();
+  return func;
+}
+
+void Instrumenter::instrument(llvm::Function *func, llvm::Function *enter,
+                              llvm::Function *exit) {
+  std::vector<llvm::ReturnInst *> returns;
+  for (auto &block : *func) {
+    if (auto *ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator())) {
+      returns.push_back(ret);
+    }
+  }
+
+  // The record pointer stays internal, so it goes along with the function
+  // into its --cache-functions unit.
+  auto *record_ptr = record_type->getPointerTo();
+  auto *local = new llvm::GlobalVariable(
+      *module, record_ptr, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantPointerNull::get(record_ptr),
+      func->getName() + ".instrument", nullptr,
+      llvm::GlobalValue::GeneralDynamicTLSModel);
+
+  // After the allocas, which mem2reg only promotes in the entry block.
+  auto it = func->getEntryBlock().begin();
+  while (llvm::isa<llvm::AllocaInst>(*it)) {
+    ++it;
+  }
+  builder.SetInsertPoint(&*it);
+  auto *name = builder.CreateGlobalStringPtr(func->getName());
+  auto *saved = builder.CreateCall(
+      enter, { local, name, builder.getInt64(cycles ? cycles_flag : 0) });
+  if (exit == nullptr) {
+    return;
+  }
+  auto *clock = llvm::Intrinsic::getDeclaration(
+      module, llvm::Intrinsic::readcyclecounter);
+  auto *start = builder.CreateCall(clock);
+
+  for (auto *ret : returns) {
+    if (auto *prev = ret->getPrevNode()) {
+      if (auto *call = llvm::dyn_cast<llvm::CallInst>(prev)) {
+        if (call->isMustTailCall()) {
+          call->setTailCallKind(llvm::CallInst::TCK_Tail);
+        }
+      }
+    }
+    builder.SetInsertPoint(ret);
+    auto *elapsed = builder.CreateSub(builder.CreateCall(clock), start);
+    builder.CreateCall(exit, { local, elapsed, saved });
+  }
+}
+
+llvm::Function *Instrumenter::genCompare() {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *i64 = builder.getInt64Ty();
+  auto *i64p = i64->getPointerTo();
+
+  // qsort order of records by the key in their first field, largest first.
+  auto *i32 = builder.getInt32Ty();
+  auto *func = createFunction("ys.instrument.compare", i32, { i8p, i8p });
+  auto arg = func->arg_begin();
+  auto *lhs = builder.CreateLoad(i64, builder.CreateBitCast(&*arg++, i64p));
+  auto *rhs = builder.CreateLoad(i64, builder.CreateBitCast(&*arg, i64p));
+  auto *less = builder.CreateZExt(builder.CreateICmpULT(lhs, rhs), i32);
+  auto *greater = builder.CreateZExt(builder.CreateICmpUGT(lhs, rhs), i32);
+  builder.CreateRet(builder.CreateSub(less, greater));
+  return func;
+}
+
+llvm::Function *Instrumenter::genCompareNames() {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *i32 = builder.getInt32Ty();
+  auto strcmp = module->getOrInsertFunction(
+      "strcmp", llvm::FunctionType::get(i32, { i8p, i8p }, false));
+  auto *record_ptr = record_type->getPointerTo();
+
+  // qsort order of record pointers by function name. A function defined in
+  // several units, like the linkonce_odr runtime, has a name in each.
+  auto *func =
+      createFunction("ys.instrument.compare.names", i32, { i8p, i8p });
+  std::vector<llvm::Value *> names;
+  for (auto &arg : func->args()) {
+    auto *record = builder.CreateLoad(
+        record_ptr,
+        builder.CreateBitCast(&arg, record_ptr->getPointerTo()));
+    names.push_back(builder.CreateLoad(i8p, field(record, name_field)));
+  }
+  builder.CreateRet(builder.CreateCall(strcmp, names));
+  return func;
+}
+
+llvm::Function *Instrumenter::genDump() {
+  auto *i8p = builder.getInt8PtrTy();
+  auto *i32 = builder.getInt32Ty();
+  auto *i64 = builder.getInt64Ty();
+  auto getenv = module->getOrInsertFunction(
+      "getenv", llvm::FunctionType::get(i8p, { i8p }, false));
+  auto strcmp = module->getOrInsertFunction(
+      "strcmp", llvm::FunctionType::get(i32, { i8p, i8p }, false));
+  auto fopen = module->getOrInsertFunction(
+      "fopen", llvm::FunctionType::get(i8p, { i8p, i8p }, false));
+  auto dup = module->getOrInsertFunction(
+      "dup", llvm::FunctionType::get(i32, { i32 }, false));
+  auto fdopen = module->getOrInsertFunction(
+      "fdopen", llvm::FunctionType::get(i8p, { i32, i8p }, false));
+  auto fprintf = module->getOrInsertFunction(
+      "fprintf", llvm::FunctionType::get(i32, { i8p, i8p }, true));
+  auto fclose = module->getOrInsertFunction(
+      "fclose", llvm::FunctionType::get(i32, { i8p }, false));
+  auto qsort = module->getOrInsertFunction(
+      "qsort", llvm::FunctionType::get(builder.getVoidTy(),
+                                       { i8p, i64, i64, i8p }, false));
+  auto calloc = module->getOrInsertFunction(
+      "calloc", llvm::FunctionType::get(i8p, { i64, i64 }, false));
+  auto free = module->getOrInsertFunction(
+      "free", llvm::FunctionType::get(builder.getVoidTy(), { i8p }, false));
+  auto *compare = genCompare();
+  auto *compare_names = genCompareNames();
+  auto *pointer_type = record_type->getPointerTo();
+  auto *record_size = llvm::ConstantExpr::getSizeOf(record_type);
+
+  // Every module registers this destructor; the first one prints.
+  auto *dump = createFunction("ys.instrument.dump", builder.getVoidTy(), {});
+  auto *start = llvm::BasicBlock::Create(context, "start", dump);
+  auto *done = llvm::BasicBlock::Create(context, "done", dump);
+  auto *entry = builder.GetInsertBlock();
+  auto variable = [&](const char *name) {
+    auto *ptr = new llvm::AllocaInst(i64, 0, name, entry);
+    builder.CreateStore(builder.getInt64(0), ptr);
+    return ptr;
+  };
+  auto *count = variable("count");
+  auto *flags = variable("flags");
+  auto *index = variable("index");
+  auto *merged_count = variable("merged");
+  auto *was_dumped = builder.CreateAtomicRMW(
+      llvm::AtomicRMWInst::Xchg, dumped, builder.getInt64(1),
+      llvm::AtomicOrdering::SequentiallyConsistent);
+  builder.CreateCondBr(builder.CreateIsNull(was_dumped), start, done);
+
+  // Sort the records of every thread by name and sum those of a function.
+  builder.SetInsertPoint(start);
+  emitWalk([&](llvm::Value *record) {
+    increment(count, builder.getInt64(1));
+    builder.CreateStore(
+        builder.CreateOr(builder.CreateLoad(i64, flags),
+                         builder.CreateLoad(i64, field(record, flags_field))),
+        flags);
+  });
+  auto *n = builder.CreateLoad(i64, count);
+  auto *sorted = builder.CreateBitCast(
+      builder.CreateCall(calloc, { n, builder.getInt64(8) }),
+      pointer_type->getPointerTo());
+  emitWalk([&](llvm::Value *record) {
+    auto *i = builder.CreateLoad(i64, index);
+    builder.CreateStore(record,
+                        builder.CreateInBoundsGEP(pointer_type, sorted, i));
+    builder.CreateStore(builder.CreateAdd(i, builder.getInt64(1)), index);
+  });
+  builder.CreateCall(qsort, { builder.CreateBitCast(sorted, i8p), n,
+                              builder.getInt64(8),
+                              builder.CreateBitCast(compare_names, i8p) });
+
+  auto *merged = builder.CreateBitCast(
+      builder.CreateCall(calloc, { n, record_size }), pointer_type);
+  auto *timed = builder.CreateICmpNE(
+      builder.CreateAnd(builder.CreateLoad(i64, flags),
+                        builder.getInt64(cycles_flag)),
+      builder.getInt64(0));
+  emitLoop(n, [&](llvm::Value *i) {
+    auto *record = builder.CreateLoad(
+        pointer_type, builder.CreateInBoundsGEP(pointer_type, sorted, i));
+    llvm::Value *name = builder.CreateLoad(i8p, field(record, name_field));
+    auto *first = builder.CreateIsNull(i);
+    auto *prev = builder.CreateLoad(
+        pointer_type,
+        builder.CreateInBoundsGEP(
+            pointer_type, sorted,
+            builder.CreateSelect(first, i,
+                                 builder.CreateSub(i, builder.getInt64(1)))));
+    auto *same = builder.CreateIsNull(builder.CreateCall(
+        strcmp, { builder.CreateLoad(i8p, field(prev, name_field)), name }));
+    auto *m = builder.CreateAdd(
+        builder.CreateLoad(i64, merged_count),
+        builder.CreateZExt(builder.CreateOr(first, builder.CreateNot(same)),
+                           i64));
+    builder.CreateStore(m, merged_count);
+    auto *total = builder.CreateInBoundsGEP(
+        record_type, merged, builder.CreateSub(m, builder.getInt64(1)));
+    builder.CreateStore(name, field(total, name_field));
+    for (unsigned counter : { calls_field, inclusive_field,
+                              exclusive_field }) {
+      increment(field(total, counter),
+                builder.CreateLoad(i64, field(record, counter)));
+    }
+  });
+  builder.CreateCall(free, { builder.CreateBitCast(sorted, i8p) });
+  auto *m = builder.CreateLoad(i64, merged_count);
+  emitLoop(m, [&](llvm::Value *i) {
+    auto *total = builder.CreateInBoundsGEP(record_type, merged, i);
+    builder.CreateStore(
+        builder.CreateSelect(
+            timed, builder.CreateLoad(i64, field(total, exclusive_field)),
+            builder.CreateLoad(i64, field(total, calls_field))),
+        field(total, next_field));
+  });
+  builder.CreateCall(qsort, { builder.CreateBitCast(merged, i8p), m,
+                              record_size,
+                              builder.CreateBitCast(compare, i8p) });
+
+  auto select_env = [&](const char *name, const char *fallback) {
+    auto *env =
+        builder.CreateCall(getenv, { builder.CreateGlobalStringPtr(name) });
+    return builder.CreateSelect(builder.CreateIsNull(env),
+                                builder.CreateGlobalStringPtr(fallback), env);
+  };
+  auto *json = builder.CreateIsNull(builder.CreateCall(
+      strcmp, { select_env("YS_INSTRUMENT_FORMAT", "text"),
+                builder.CreateGlobalStringPtr("json") }));
+  auto *path = builder.CreateCall(
+      getenv, { builder.CreateGlobalStringPtr("YS_INSTRUMENT_FILE") });
+  auto *write = builder.CreateGlobalStringPtr("w");
+  auto *to_file = llvm::BasicBlock::Create(context, "file", dump);
+  auto *to_stderr = llvm::BasicBlock::Create(context, "stderr", dump);
+  auto *print = llvm::BasicBlock::Create(context, "print", dump);
+  auto *printed = llvm::BasicBlock::Create(context, "printed", dump);
+  builder.CreateCondBr(builder.CreateIsNull(path), to_stderr, to_file);
+
+  builder.SetInsertPoint(to_file);
+  auto *opened = builder.CreateCall(fopen, { path, write });
+  builder.CreateBr(print);
+  builder.SetInsertPoint(to_stderr);
+  auto *duplicated = builder.CreateCall(
+      fdopen, { builder.CreateCall(dup, { builder.getInt32(2) }), write });
+  builder.CreateBr(print);
+
+  builder.SetInsertPoint(print);
+  auto *file = builder.CreatePHI(i8p, 2);
+  file->addIncoming(opened, to_file);
+  file->addIncoming(duplicated, to_stderr);
+  auto *body = llvm::BasicBlock::Create(context, "body", dump);
+  builder.CreateCondBr(builder.CreateIsNull(file), printed, body);
+
+  builder.SetInsertPoint(body);
+  auto format = [&](const std::string &text, const std::string &json_text) {
+    return builder.CreateSelect(json, builder.CreateGlobalStringPtr(json_text),
+                                builder.CreateGlobalStringPtr(text));
+  };
+  // With cycles if any module counted them.
+  auto timed_format = [&](const std::string &text,
+                          const std::string &timed_text,
+                          const std::string &json_text,
+                          const std::string &timed_json_text) {
+    return builder.CreateSelect(timed, format(timed_text, timed_json_text),
+                                format(text, json_text));
+  };
+  std::string header = "function" + std::string(24, ' ') + "        calls";
+  std::string row = "%s%-32s %12llu";
+  std::string json_row = "%s\n  {\"name\": \"%s\", \"calls\": %llu";
+  std::string cycles_header = "   inclusive cycles   exclusive cycles";
+  std::string cycles_row = " %18llu %18llu";
+  std::string cycles_json_row =
+      ", \"inclusive_cycles\": %llu, \"exclusive_cycles\": %llu";
+  builder.CreateCall(
+      fprintf, { file, timed_format(header + "\n",
+                                    header + cycles_header + "\n",
+                                    "{\"functions\": [",
+                                    "{\"functions\": [") });
+  auto *row_format =
+      timed_format(row + "\n", row + cycles_row + "\n", json_row + "}",
+                   json_row + cycles_json_row + "}");
+  auto *separator = format("", ",");
+  auto *empty = builder.CreateGlobalStringPtr("");
+
+  // Only functions that were called have records.
+  emitLoop(m, [&](llvm::Value *i) {
+    auto *total = builder.CreateInBoundsGEP(record_type, merged, i);
+    auto *prefix =
+        builder.CreateSelect(builder.CreateIsNull(i), empty, separator);
+    builder.CreateCall(
+        fprintf,
+        { file, row_format, prefix,
+          builder.CreateLoad(i8p, field(total, name_field)),
+          builder.CreateLoad(i64, field(total, calls_field)),
+          builder.CreateLoad(i64, field(total, inclusive_field)),
+          builder.CreateLoad(i64, field(total, exclusive_field)) });
+  });
+  builder.CreateCall(fprintf, { file, format("", "\n]}\n") });
+  builder.CreateCall(fclose, { file });
+  builder.CreateBr(printed);
+
+  builder.SetInsertPoint(printed);
+  builder.CreateCall(free, { builder.CreateBitCast(merged, i8p) });
+  builder.CreateBr(done);
+
+  builder.SetInsertPoint(done);
+  builder.CreateRetVoid();
+  return dump;
+}
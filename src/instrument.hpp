@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Module.h>
+#include <string>
+#include <vector>
+
+namespace yslang {
+// --instrument: counts the calls of every function CodeGen defined and,
+// with `cycles`, the cycles spent in it (llvm.readcyclecounter, rdtsc on
+// x86) including and excluding its callees. Recursive calls add to the
+// exclusive cycles but only the outermost one to the inclusive cycles.
+//
+// Each thread counts a function's calls into a record of its own, found
+// through a thread-local pointer next to the function and linked into a
+// global list on the thread's first call. The rest of the runtime, the list
+// included, is linkonce_odr and only needs libc, so the functions of every
+// module and of every --cache-functions unit share it. At exit the first
+// module to run its destructor sums the records by function and prints
+// them all, those with the most exclusive cycles (or calls) first, to
+// stderr or to $YS_INSTRUMENT_FILE; with YS_INSTRUMENT_FORMAT=json as JSON.
+//
+// Instrumented functions lose musttail, since their epilogue follows the
+// call.
+class Instrumenter {
+public:
+  // `spec` is "calls", "cycles" or both, comma separated.
+  Instrumenter(llvm::Module *module, const std::string &spec);
+
+  void run();
+
+private:
+  llvm::Function *createFunction(const std::string &name, llvm::Type *result,
+                                 const std::vector<llvm::Type *> &params);
+  llvm::Function *genRegister();
+  llvm::Function *genEnter(llvm::Function *register_record);
+  llvm::Function *genExit();
+  llvm::Function *genCompare();
+  llvm::Function *genCompareNames();
+  llvm::Function *genDump();
+  void instrument(llvm::Function *func, llvm::Function *enter,
+                  llvm::Function *exit);
+
+  // Emits `for (i = 0; i < count; i++) body(i)`.
+  void emitLoop(llvm::Value *count,
+                const std::function<void(llvm::Value *)> &body);
+  // Emits `body(record)` for every record on the list.
+  void emitWalk(const std::function<void(llvm::Value *)> &body);
+  llvm::Value *field(llvm::Value *record, unsigned field);
+  void increment(llvm::Value *ptr, llvm::Value *amount);
+
+private:
+  llvm::Module *module;
+  llvm::LLVMContext &context;
+  llvm::IRBuilder<> builder;
+  bool cycles = false;
+
+  // A thread's counters of one function: the next record as an integer,
+  // the function's name, the flags it was instrumented with, its calls,
+  // inclusive and exclusive cycles, and active calls.
+  llvm::StructType *record_type = nullptr;
+  llvm::GlobalVariable *child_cycles = nullptr;
+  llvm::GlobalVariable *records = nullptr;
+  llvm::GlobalVariable *dumped = nullptr;
+};
+} // namespace yslang
@@ -0,0 +1,376 @@
+#include "./interface.hpp"
+#include "./consteval.hpp"
+#include "./error.hpp"
+#include "./lexer.hpp"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/LEB128.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <cstring>
+#include <set>
+
+using namespace yslang;
+
+static const char magic[] = { 'Y', 'S', 'I', 1 };
+
+enum class TypeTag : uint8_t { None, Ident, Struct, Array, Function };
+
+static Ident *make_ident(const std::string &name) {
+  Ident *ident = new Ident();
+  ident->name = name;
+  return ident;
+}
+
+// -------------------- //
+// Writer
+// -------------------- //
+
+static void write_string(llvm::raw_ostream &os, const std::string &str) {
+  llvm::encodeULEB128(str.size(), os);
+  os << str;
+}
+
+static void write_type(llvm::raw_ostream &os, Type *type);
+
+static void write_fields(llvm::raw_ostream &os,
+                         const std::vector<Field> &fields) {
+  llvm::encodeULEB128(fields.size(), os);
+  for (const auto &field : fields) {
+    write_string(os, field.name->name);
+    write_type(os, field.type);
+  }
+}
+
+static void write_type(llvm::raw_ostream &os, Type *type) {
+  if (type == nullptr) {
+    os << char(TypeTag::None);
+    return;
+  }
+
+  switch (type->kind) {
+  case Type::Kind::Ident:
+    os << char(TypeTag::Ident);
+    write_string(os, dynamic_cast<IdentType *>(type)->name->name);
+    break;
+  case Type::Kind::Struct:
+    os << char(TypeTag::Struct);
+    write_fields(os, dynamic_cast<StructType *>(type)->fields);
+    break;
+  case Type::Kind::Array: {
+    ArrayType *array = dynamic_cast<ArrayType *>(type);
+    os << char(TypeTag::Array);
+    write_type(os, array->element);
+    write_string(os, array->length->value);
+    break;
+  }
+  case Type::Kind::Function: {
+    FunctionType *func = dynamic_cast<FunctionType *>(type);
+    os << char(TypeTag::Function);
+    write_fields(os, func->fields);
+    write_type(os, func->result);
+    break;
+  }
+  }
+}
+
+void Interface::collect(Program *program) {
+  ConstEvaluator evaluator;
+  for (Decl *decl : program->decls) {
+    evaluator.declare(decl);
+  }
+
+  for (Decl *decl : program->decls) {
+    switch (decl->type) {
+    case Decl::Kind::Type:
+      types.push_back(dynamic_cast<TypeDecl *>(decl));
+      break;
+    case Decl::Kind::Const: {
+      if (decl->imported) {
+        break;
+      }
+      ConstDecl *const_decl = dynamic_cast<ConstDecl *>(decl);
+      int64_t value;
+      if (!evaluator.constant(const_decl->name, value)) {
+        error("const " + const_decl->name + " is not a compile time constant");
+      }
+
+      BasicLit *lit = new BasicLit();
+      lit->kind = TokenType::Integer;
+      lit->value = std::to_string(value);
+      ConstDecl *exported = new ConstDecl();
+      exported->name = const_decl->name;
+      exported->expr = lit;
+      consts.push_back(exported);
+      break;
+    }
+    case Decl::Kind::Func:
+      if (!decl->imported) {
+        funcs.push_back(dynamic_cast<FuncDecl *>(decl));
+      }
+      break;
+    default:;
+    }
+  }
+}
+
+void Interface::write(const std::string &path) const {
+  std::string data;
+  llvm::raw_string_ostream os(data);
+  os.write(magic, sizeof(magic));
+
+  llvm::encodeULEB128(types.size(), os);
+  for (TypeDecl *decl : types) {
+    write_string(os, decl->name->name);
+    write_type(os, decl->type);
+  }
+
+  llvm::encodeULEB128(consts.size(), os);
+  for (ConstDecl *decl : consts) {
+    write_string(os, decl->name);
+    llvm::encodeSLEB128(std::stoll(dynamic_cast<BasicLit *>(decl->expr)->value),
+                        os);
+  }
+
+  llvm::encodeULEB128(funcs.size(), os);
+  for (FuncDecl *decl : funcs) {
+    write_string(os, decl->name);
+    write_type(os, decl->func_type);
+  }
+  os.flush();
+
+  // Written whole to a file of its own and renamed, so parallel importers
+  // never see a partial file and parallel writers never share one.
+  int fd;
+  llvm::SmallString<128> temp;
+  if (llvm::sys::fs::createUniqueFile(path + ".tmp-%%%%%%%%", fd, temp)) {
+    error("can not create a temporary file for " + path);
+  }
+  llvm::raw_fd_ostream file(fd, true);
+  file << data;
+  file.close();
+  if (file.has_error()) {
+    file.clear_error();
+    llvm::sys::fs::remove(temp);
+    error("can not write " + temp.str().str());
+  }
+  if (llvm::sys::fs::rename(temp, path)) {
+    llvm::sys::fs::remove(temp);
+    error("can not write " + path);
+  }
+}
+
+// -------------------- //
+// Reader
+// -------------------- //
+
+namespace {
+class InterfaceReader {
+public:
+  InterfaceReader(const std::string &path, llvm::StringRef data)
+      : path(path), p(reinterpret_cast<const uint8_t *>(data.begin())),
+        end(reinterpret_cast<const uint8_t *>(data.end())) {}
+
+  void expectMagic() {
+    if (end - p < long(sizeof(magic)) ||
+        std::memcmp(p, magic, sizeof(magic)) != 0) {
+      error(path + " is not a yslang interface of this version");
+    }
+    p += sizeof(magic);
+  }
+
+  uint64_t readCount() {
+    unsigned n;
+    const char *message = nullptr;
+    uint64_t value = llvm::decodeULEB128(p, &n, end, &message);
+    if (message != nullptr || value > uint64_t(end - p) + n) {
+      broken();
+    }
+    p += n;
+    return value;
+  }
+
+  int64_t readValue() {
+    unsigned n;
+    const char *message = nullptr;
+    int64_t value = llvm::decodeSLEB128(p, &n, end, &message);
+    if (message != nullptr) {
+      broken();
+    }
+    p += n;
+    return value;
+  }
+
+  std::string readString() {
+    uint64_t size = readCount();
+    if (size > uint64_t(end - p)) {
+      broken();
+    }
+    std::string str(reinterpret_cast<const char *>(p), size);
+    p += size;
+    return str;
+  }
+
+  std::vector<Field> readFields() {
+    std::vector<Field> fields(readCount());
+    for (auto &field : fields) {
+      field.name = make_ident(readString());
+      field.type = readType();
+    }
+    return fields;
+  }
+
+  Type *readType() {
+    if (p == end) {
+      broken();
+    }
+    switch (TypeTag(*p++)) {
+    case TypeTag::None:
+      return nullptr;
+    case TypeTag::Ident: {
+      IdentType *type = new IdentType();
+      type->name = make_ident(readString());
+      return type;
+    }
+    case TypeTag::Struct: {
+      StructType *type = new StructType();
+      type->fields = readFields();
+      return type;
+    }
+    case TypeTag::Array: {
+      ArrayType *type = new ArrayType();
+      type->element = readType();
+      type->length = new BasicLit();
+      type->length->kind = TokenType::Integer;
+      type->length->value = readString();
+      return type;
+    }
+    case TypeTag::Function: {
+      FunctionType *type = new FunctionType();
+      type->fields = readFields();
+      type->result = readType();
+      return type;
+    }
+    }
+    broken();
+  }
+
+  [[noreturn]] void broken() { error(path + " is broken"); }
+
+private:
+  std::string path;
+  const uint8_t *p;
+  const uint8_t *end;
+};
+} // namespace
+
+void Interface::read(const std::string &path) {
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer) {
+    error("can not read " + path + ": " + buffer.getError().message());
+  }
+
+  InterfaceReader reader(path, (*buffer)->getBuffer());
+  reader.expectMagic();
+
+  for (uint64_t i = 0, size = reader.readCount(); i < size; i++) {
+    TypeDecl *decl = new TypeDecl();
+    decl->name = make_ident(reader.readString());
+    decl->type = reader.readType();
+    decl->imported = true;
+    types.push_back(decl);
+  }
+
+  for (uint64_t i = 0, size = reader.readCount(); i < size; i++) {
+    ConstDecl *decl = new ConstDecl();
+    decl->name = reader.readString();
+    BasicLit *lit = new BasicLit();
+    lit->kind = TokenType::Integer;
+    lit->value = std::to_string(reader.readValue());
+    decl->expr = lit;
+    decl->imported = true;
+    consts.push_back(decl);
+  }
+
+  for (uint64_t i = 0, size = reader.readCount(); i < size; i++) {
+    FuncDecl *decl = new FuncDecl();
+    decl->name = reader.readString();
+    decl->func_type = dynamic_cast<FunctionType *>(reader.readType());
+    if (decl->func_type == nullptr) {
+      reader.broken();
+    }
+    decl->body = nullptr;
+    decl->imported = true;
+    funcs.push_back(decl);
+  }
+}
+
+// -------------------- //
+// Resolution
+// -------------------- //
+
+std::string
+Interface::findInterface(const std::string &package,
+                         const std::vector<std::string> &search_paths) {
+  for (const auto &dir : search_paths) {
+    llvm::SmallString<128> path(dir);
+    llvm::sys::path::append(path, package + ".yzi");
+    if (llvm::sys::fs::exists(path)) {
+      return path.str().str();
+    }
+  }
+  error("can not find interface " + package + ".yzi for import " + package);
+}
+
+void Interface::resolveImports(Program *program,
+                               const std::vector<std::string> &search_paths) {
+  std::set<std::string> packages;
+  std::set<std::string> type_names;
+  std::vector<Decl *> imported;
+  for (Decl *decl : program->decls) {
+    if (decl->type != Decl::Kind::Import) {
+      continue;
+    }
+    const std::string &package =
+        dynamic_cast<ImportDecl *>(decl)->package->name;
+    if (!packages.insert(package).second) {
+      continue;
+    }
+
+    Interface interface;
+    interface.read(findInterface(package, search_paths));
+
+    // The same type can arrive through several imports.
+    for (TypeDecl *type : interface.types) {
+      if (type_names.insert(type->name->name).second) {
+        imported.push_back(type);
+      }
+    }
+    imported.insert(imported.end(), interface.consts.begin(),
+                    interface.consts.end());
+    imported.insert(imported.end(), interface.funcs.begin(),
+                    interface.funcs.end());
+  }
+
+  // Imports come first so the program's own types can build on them.
+  program->decls.insert(program->decls.begin(), imported.begin(),
+                        imported.end());
+}
+
+std::vector<std::string>
+Interface::findImports(const std::string &input,
+                       const std::vector<std::string> &search_paths) {
+  std::vector<std::string> paths;
+  Lexer lexer(input);
+  for (Token t = lexer.next(); t.type != TokenType::TEOF; t = lexer.next()) {
+    if (t.type != TokenType::Import) {
+      continue;
+    }
+    t = lexer.next();
+    if (t.type == TokenType::Ident) {
+      paths.push_back(findInterface(t.str, search_paths));
+    }
+  }
+  return paths;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "./ast.hpp"
+
+namespace yslang {
+// What a module exports, stored next to its object as <module>.yzi:
+// function signatures, type declarations and constant values. Importers
+// read only this, never the module's source.
+//
+// The file is "YSI" and a format version, then ULEB128 counts and lengths:
+//   types:  name, type
+//   consts: name, SLEB128 value
+//   funcs:  name, function type
+// Types are a tag byte followed by their parts, see writeType().
+class Interface {
+public:
+  // Exports the program's own functions and constants. Every type
+  // declaration is exported, imported ones too, since exported signatures
+  // may use them.
+  void collect(Program *program);
+
+  void write(const std::string &path) const;
+  void read(const std::string &path);
+
+  // Adds the declarations read from <package>.yzi, looked up in
+  // `search_paths`, for every import in `program`.
+  static void resolveImports(Program *program,
+                             const std::vector<std::string> &search_paths);
+
+  // Interface files `input` imports, found by lexing alone. Lets a cache
+  // check its dependencies before parsing.
+  static std::vector<std::string>
+  findImports(const std::string &input,
+              const std::vector<std::string> &search_paths);
+
+private:
+  static std::string
+  findInterface(const std::string &package,
+                const std::vector<std::string> &search_paths);
+
+private:
+  std::vector<TypeDecl *> types;
+  std::vector<ConstDecl *> consts;
+  std::vector<FuncDecl *> funcs;
+};
+} // namespace yslang
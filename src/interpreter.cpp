@@ -0,0 +1,426 @@
+#include "./interpreter.hpp"
+#include "./error.hpp"
+#include "./tailrec.hpp"
+#include <limits>
+#include <pthread.h>
+#include <sstream>
+
+using namespace yslang;
+
+void Interpreter::load(Program *program) {
+  TailRecElim().run(program);
+  for (Decl *decl : program->decls) {
+    evaluator.declare(decl);
+    if (decl->type == Decl::Kind::Func) {
+      FuncDecl *func = dynamic_cast<FuncDecl *>(decl);
+      if (func->is_async) {
+        error("async function " + func->name + " needs native code");
+      }
+      funcs[func->name] = func;
+    } else if (decl->type == Decl::Kind::Type) {
+      TypeDecl *type_decl = dynamic_cast<TypeDecl *>(decl);
+      types[type_decl->name->name] = type_decl->type;
+    }
+  }
+}
+
+namespace {
+struct RunState {
+  Interpreter *interpreter;
+  int64_t result = 0;
+  std::string failure;
+  bool failed = false;
+};
+} // namespace
+
+static void *run_main(void *arg) {
+  RunState *state = static_cast<RunState *>(arg);
+  try {
+    state->result = state->interpreter->call("main", {}).number;
+  } catch (const Error &e) {
+    state->failure = e.what();
+    state->failed = true;
+  } catch (const std::string &msg) {
+    state->failure = msg;
+    state->failed = true;
+  } catch (const std::exception &e) {
+    // Library failures such as std::stoll on an oversized literal.
+    state->failure = e.what();
+    state->failed = true;
+  }
+  return nullptr;
+}
+
+int64_t Interpreter::run() {
+  // Every yslang call nests a few C++ frames, so recursion as deep as the
+  // compiled program allows needs more than the default 8MB stack. It is
+  // only reserved, not committed, until it is used.
+  RunState state;
+  state.interpreter = this;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, stack_size);
+  pthread_t thread;
+  int status = pthread_create(&thread, &attr, run_main, &state);
+  pthread_attr_destroy(&attr);
+  if (status != 0) {
+    run_main(&state);
+  } else {
+    pthread_join(thread, nullptr);
+  }
+
+  // An exception must not leave the thread, so it is raised again here.
+  if (state.failed) {
+    error(state.failure);
+  }
+  return state.result;
+}
+
+Interpreter::Value Interpreter::call(const std::string &name,
+                                     const std::vector<Value> &args) {
+  auto itr = funcs.find(name);
+  if (itr == funcs.end()) {
+    error("undefined function " + name);
+  }
+  std::vector<Value> copy = args;
+  return invoke(itr->second, copy);
+}
+
+Interpreter::Value Interpreter::invoke(FuncDecl *func,
+                                       std::vector<Value> &args) {
+  if (func->body == nullptr) {
+    error("function " + func->name +
+          " is imported; the interpreter runs one module");
+  }
+
+  const auto &fields = func->func_type->fields;
+  if (fields.size() != args.size()) {
+    error("function " + func->name + " takes " +
+          std::to_string(fields.size()) + " arguments, got " +
+          std::to_string(args.size()));
+  }
+  if (depth >= max_depth) {
+    error("call depth limit exceeded in " + func->name);
+  }
+
+  // CodeGen checks that @memo functions are pure and take and return i64.
+  bool memoized = func->hasAttribute("memo");
+  std::pair<FuncDecl *, std::vector<int64_t>> key;
+  if (memoized) {
+    key.first = func;
+    for (const Value &arg : args) {
+      key.second.push_back(arg.number);
+    }
+    auto cached = memo.find(key);
+    if (cached != memo.end()) {
+      Value result;
+      result.number = cached->second;
+      return result;
+    }
+  }
+
+  Frame frame;
+  for (size_t i = 0; i < fields.size(); i++) {
+    frame[fields[i].name->name] = std::move(args[i]);
+  }
+
+  depth++;
+  Value result;
+  execBlock(func->body, frame, result);
+  depth--;
+
+  if (memoized) {
+    memo[key] = result.number;
+  }
+  return result;
+}
+
+Interpreter::Flow Interpreter::execBlock(BlockStmt *block, Frame &frame,
+                                         Value &result) {
+  for (Stmt *stmt : block->stmts) {
+    Flow flow = execStmt(stmt, frame, result);
+    if (flow != Flow::Normal) {
+      return flow;
+    }
+  }
+  return Flow::Normal;
+}
+
+Interpreter::Flow Interpreter::execStmt(Stmt *stmt, Frame &frame,
+                                        Value &result) {
+  switch (stmt->kind) {
+  case Stmt::Kind::Block:
+    return execBlock(dynamic_cast<BlockStmt *>(stmt), frame, result);
+  case Stmt::Kind::Let: {
+    LetStmt *let = dynamic_cast<LetStmt *>(stmt);
+    if (let->expr != nullptr) {
+      frame[let->ident->name] = evalExpr(let->expr, frame);
+    } else if (let->type != nullptr) {
+      frame[let->ident->name] = zeroValue(let->type);
+    } else {
+      error("let " + let->ident->name + " needs a type or a value");
+    }
+    return Flow::Normal;
+  }
+  case Stmt::Kind::Return:
+    result = evalExpr(dynamic_cast<ReturnStmt *>(stmt)->results[0], frame);
+    return Flow::Return;
+  case Stmt::Kind::If: {
+    IfStmt *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    if (evalExpr(if_stmt->cond, frame).number != 0) {
+      return execStmt(if_stmt->then_block, frame, result);
+    } else if (if_stmt->else_block != nullptr) {
+      return execStmt(if_stmt->else_block, frame, result);
+    }
+    return Flow::Normal;
+  }
+  case Stmt::Kind::While: {
+    WhileStmt *while_stmt = dynamic_cast<WhileStmt *>(stmt);
+    while (evalExpr(while_stmt->cond, frame).number != 0) {
+      Flow flow = execBlock(while_stmt->body, frame, result);
+      if (flow == Flow::Break) {
+        break;
+      } else if (flow == Flow::Return) {
+        return flow;
+      }
+    }
+    return Flow::Normal;
+  }
+  case Stmt::Kind::Branch:
+    if (dynamic_cast<BranchStmt *>(stmt)->tok == TokenType::Break) {
+      return Flow::Break;
+    }
+    return Flow::Continue;
+  case Stmt::Kind::Expr: {
+    // A statement drops its value, so an assignment needs no copy of it.
+    Expr *expr = dynamic_cast<ExprStmt *>(stmt)->expr;
+    auto *binary = dynamic_cast<BinaryExpr *>(expr);
+    if (binary != nullptr && binary->op == TokenType::Assign) {
+      assign(binary, frame);
+    } else {
+      evalExpr(expr, frame);
+    }
+    return Flow::Normal;
+  }
+  default:
+    error("unknown statement at execStmt");
+  }
+}
+
+Interpreter::Value Interpreter::evalExpr(Expr *expr, Frame &frame) {
+  switch (expr->type) {
+  case Expr::Type::BasicLit: {
+    BasicLit *lit = dynamic_cast<BasicLit *>(expr);
+    if (lit->kind != TokenType::Integer) {
+      error("unsupported literal " + lit->value);
+    }
+    Value value;
+    value.number = std::stoll(lit->value);
+    return value;
+  }
+  case Expr::Type::Ident:
+    return evalIdent(dynamic_cast<Ident *>(expr), frame);
+  case Expr::Type::CallExpr:
+    return evalCallExpr(dynamic_cast<CallExpr *>(expr), frame);
+  case Expr::Type::BinaryExpr:
+    return evalBinaryExpr(dynamic_cast<BinaryExpr *>(expr), frame);
+  case Expr::Type::RefExpr:
+    return evalRefExpr(dynamic_cast<RefExpr *>(expr), frame);
+  case Expr::Type::IndexExpr:
+    // Like CodeGen, indexing needs a place to index into.
+    return *getRef(expr, frame);
+  default:
+    error("unknown expression at evalExpr");
+  }
+}
+
+Interpreter::Value Interpreter::evalIdent(Ident *ident, Frame &frame) {
+  auto itr = frame.find(ident->name);
+  if (itr != frame.end()) {
+    return itr->second;
+  }
+
+  Value value;
+  if (evaluator.isConst(ident->name) &&
+      evaluator.constant(ident->name, value.number)) {
+    return value;
+  }
+  error("undefined ident " + ident->name);
+}
+
+Interpreter::Value Interpreter::evalCallExpr(CallExpr *expr, Frame &frame) {
+  if (expr->func->type != Expr::Type::Ident) {
+    error("unsupported expr at evalCallExpr");
+  }
+
+  const std::string &name = dynamic_cast<Ident *>(expr->func)->name;
+  auto itr = funcs.find(name);
+  if (itr == funcs.end()) {
+    error("undefined function " + name);
+  }
+
+  std::vector<Value> args;
+  args.reserve(expr->args.size());
+  for (Expr *arg : expr->args) {
+    args.push_back(evalExpr(arg, frame));
+  }
+  return invoke(itr->second, args);
+}
+
+Interpreter::Value *Interpreter::assign(BinaryExpr *expr, Frame &frame) {
+  Value *dest = getRef(expr->lhs, frame);
+  Value src = evalExpr(expr->rhs, frame);
+  *dest = std::move(src);
+  return dest;
+}
+
+Interpreter::Value Interpreter::evalBinaryExpr(BinaryExpr *expr,
+                                               Frame &frame) {
+  if (expr->op == TokenType::Assign) {
+    return *assign(expr, frame);
+  }
+
+  Value result;
+  int64_t lhs = evalExpr(expr->lhs, frame).number;
+  int64_t rhs = evalExpr(expr->rhs, frame).number;
+
+  // Arithmetic wraps like the generated `add`/`sub`/`mul`.
+  uint64_t ulhs = static_cast<uint64_t>(lhs);
+  uint64_t urhs = static_cast<uint64_t>(rhs);
+  switch (expr->op) {
+  case TokenType::Plus:
+    result.number = static_cast<int64_t>(ulhs + urhs);
+    break;
+  case TokenType::Minus:
+    result.number = static_cast<int64_t>(ulhs - urhs);
+    break;
+  case TokenType::Mul:
+    result.number = static_cast<int64_t>(ulhs * urhs);
+    break;
+  case TokenType::Div:
+    if (rhs == 0) {
+      error("division by zero");
+    }
+    if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1) {
+      error("division overflow");
+    }
+    result.number = lhs / rhs;
+    break;
+  case TokenType::Equal:
+    result.number = lhs == rhs;
+    break;
+  case TokenType::NotEqual:
+    result.number = lhs != rhs;
+    break;
+  case TokenType::Less:
+    result.number = lhs < rhs;
+    break;
+  case TokenType::LessEqual:
+    result.number = lhs <= rhs;
+    break;
+  case TokenType::Greater:
+    result.number = lhs > rhs;
+    break;
+  case TokenType::GreaterEqual:
+    result.number = lhs >= rhs;
+    break;
+  default:
+    std::stringstream ss;
+    ss << "not support binop " << expr->op;
+    error(ss.str());
+  }
+  return result;
+}
+
+Interpreter::Value Interpreter::evalRefExpr(RefExpr *expr, Frame &frame) {
+  // A field of a variable is read in place rather than copying the whole
+  // struct first.
+  switch (expr->receiver->type) {
+  case Expr::Type::Ident:
+  case Expr::Type::RefExpr:
+  case Expr::Type::IndexExpr:
+    return *getRef(expr, frame);
+  default: {
+    Value receiver = evalExpr(expr->receiver, frame);
+    return *getField(receiver, expr->ref);
+  }
+  }
+}
+
+Interpreter::Value *Interpreter::getRef(Expr *expr, Frame &frame) {
+  switch (expr->type) {
+  case Expr::Type::Ident: {
+    Ident *ident = dynamic_cast<Ident *>(expr);
+    auto itr = frame.find(ident->name);
+    if (itr == frame.end()) {
+      error("undefined value " + ident->name);
+    }
+    return &itr->second;
+  }
+  case Expr::Type::RefExpr: {
+    RefExpr *ref = dynamic_cast<RefExpr *>(expr);
+    return getField(*getRef(ref->receiver, frame), ref->ref);
+  }
+  case Expr::Type::IndexExpr: {
+    IndexExpr *index = dynamic_cast<IndexExpr *>(expr);
+    Value *receiver = getRef(index->receiver, frame);
+    // Evaluating the index can not move the receiver: frames only grow
+    // through let, which is a statement.
+    return getItem(*receiver, evalExpr(index->index, frame).number);
+  }
+  default:
+    error("can not get ref of expression");
+  }
+}
+
+Interpreter::Value *Interpreter::getField(Value &receiver, Ident *field) {
+  if (receiver.struct_type == nullptr) {
+    error("field " + field->name + " of a non-struct value");
+  }
+  unsigned index = receiver.struct_type->index(field->name);
+  if (index >= receiver.elements.size()) {
+    error("no field " + field->name);
+  }
+  return &receiver.elements[index];
+}
+
+Interpreter::Value *Interpreter::getItem(Value &receiver, int64_t index) {
+  if (receiver.struct_type != nullptr || index < 0 ||
+      static_cast<uint64_t>(index) >= receiver.elements.size()) {
+    error("index " + std::to_string(index) + " out of range");
+  }
+  return &receiver.elements[index];
+}
+
+Interpreter::Value Interpreter::zeroValue(Type *type) {
+  Value value;
+  switch (type->kind) {
+  case Type::Kind::Ident: {
+    const std::string &name = dynamic_cast<IdentType *>(type)->name->name;
+    if (name == "i64" || name == "void") {
+      return value;
+    }
+    auto itr = types.find(name);
+    if (itr == types.end()) {
+      error("unknown type " + name);
+    }
+    return zeroValue(itr->second);
+  }
+  case Type::Kind::Struct: {
+    StructType *struct_type = dynamic_cast<StructType *>(type);
+    for (const auto &field : struct_type->fields) {
+      value.elements.push_back(zeroValue(field.type));
+    }
+    value.struct_type = struct_type;
+    return value;
+  }
+  case Type::Kind::Array: {
+    ArrayType *array_type = dynamic_cast<ArrayType *>(type);
+    value.elements.assign(std::stoull(array_type->length->value),
+                          zeroValue(array_type->element));
+    return value;
+  }
+  default:
+    error("no values of function type");
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./consteval.hpp"
+
+namespace yslang {
+// Runs a Program straight from the AST, for scripts too short to be worth
+// code generation. It follows CodeGen: arithmetic wraps, comparisons give
+// 0 or 1, structs and arrays are copied on assignment, a function that
+// runs off its end returns 0 and consts are folded by the ConstEvaluator.
+// Where the compiled program has undefined behavior (division by zero, an
+// index out of range) the interpreter raises an Error instead.
+class Interpreter {
+public:
+  struct Value {
+    int64_t number = 0;
+    // Fields of a struct or items of an array.
+    std::vector<Value> elements;
+    // Set on struct values, to find fields by name.
+    StructType *struct_type = nullptr;
+  };
+
+  // Runs TailRecElim like CodeGen, so deep tail recursion becomes a loop.
+  void load(Program *program);
+
+  // Calls main() on a thread with a large stack and returns its result.
+  int64_t run();
+  Value call(const std::string &name, const std::vector<Value> &args);
+
+public:
+  size_t stack_size = size_t(1) << 30;
+  size_t max_depth = 1 << 20;
+
+private:
+  enum class Flow { Normal, Return, Break, Continue };
+  using Frame = std::map<std::string, Value>;
+
+  Flow execStmt(Stmt *stmt, Frame &frame, Value &result);
+  Flow execBlock(BlockStmt *block, Frame &frame, Value &result);
+  Value evalExpr(Expr *expr, Frame &frame);
+  Value evalIdent(Ident *ident, Frame &frame);
+  Value evalCallExpr(CallExpr *expr, Frame &frame);
+  Value evalBinaryExpr(BinaryExpr *expr, Frame &frame);
+  // Assigns and gives the assigned variable, field or item.
+  Value *assign(BinaryExpr *expr, Frame &frame);
+  Value evalRefExpr(RefExpr *expr, Frame &frame);
+  Value *getRef(Expr *expr, Frame &frame);
+  Value *getField(Value &receiver, Ident *field);
+  Value *getItem(Value &receiver, int64_t index);
+  Value invoke(FuncDecl *func, std::vector<Value> &args);
+
+  Value zeroValue(Type *type);
+
+private:
+  ConstEvaluator evaluator;
+  std::map<std::string, FuncDecl *> funcs;
+  std::map<std::string, Type *> types;
+  // Results of @memo functions, which CodeGen caches too; without them
+  // the interpreter would be exponentially slower on the same program.
+  std::map<std::pair<FuncDecl *, std::vector<int64_t>>, int64_t> memo;
+  size_t depth = 0;
+};
+} // namespace yslang
@@ -0,0 +1,263 @@
+#include "./jit.hpp"
+#include "./error.hpp"
+#include "./timing.hpp"
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/raw_ostream.h>
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace yslang;
+
+static std::string describe(llvm::Error err) {
+  return llvm::toString(std::move(err));
+}
+
+static BackendOptions host_options() {
+  BackendOptions options;
+  options.opt_level = 2;
+  options.cpu = "native";
+  return options;
+}
+
+namespace {
+// Appends "start size name" lines for each function the JIT loads to
+// /tmp/perf-<pid>.map, the format perf falls back to for unknown code.
+// perf takes the last line covering an address, so when an object is freed
+// its lines are appended again marked "(freed)", and code later loaded
+// into the same memory is listed after them.
+class PerfMapListener : public llvm::JITEventListener {
+public:
+  PerfMapListener() {
+    std::string path = "/tmp/perf-" +
+                       std::to_string(llvm::sys::Process::getProcessId()) +
+                       ".map";
+    std::error_code ec;
+    // Another JIT in the process may have written its functions already.
+    map.reset(new llvm::raw_fd_ostream(path, ec, llvm::sys::fs::F_Append));
+    if (ec) {
+      error("can not open " + path + ": " + ec.message());
+    }
+  }
+
+  void notifyObjectLoaded(
+      ObjectKey key, const llvm::object::ObjectFile &object,
+      const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+    // The debug copy of the object has the addresses it was loaded at.
+    auto loaded = info.getObjectForDebug(object);
+    if (loaded.getBinary() == nullptr) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &sized :
+         llvm::object::computeSymbolSizes(*loaded.getBinary())) {
+      auto type = sized.first.getType();
+      auto name = sized.first.getName();
+      auto address = sized.first.getAddress();
+      if (!type || !name || !address ||
+          *type != llvm::object::SymbolRef::ST_Function) {
+        llvm::consumeError(type.takeError());
+        llvm::consumeError(name.takeError());
+        llvm::consumeError(address.takeError());
+        continue;
+      }
+      std::string line;
+      llvm::raw_string_ostream os(line);
+      os << llvm::format_hex_no_prefix(*address, 1) << " "
+         << llvm::format_hex_no_prefix(sized.second, 1) << " " << *name;
+      *map << os.str() << "\n";
+      functions[key].push_back(line);
+    }
+    map->flush();
+  }
+
+  void notifyFreeingObject(ObjectKey key) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = functions.find(key);
+    if (found == functions.end()) {
+      return;
+    }
+    for (const auto &line : found->second) {
+      *map << line << " (freed)\n";
+    }
+    map->flush();
+    functions.erase(found);
+  }
+
+private:
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> map;
+  // The lines written for each object still loaded.
+  std::map<ObjectKey, std::vector<std::string>> functions;
+};
+} // namespace
+
+// The Backend sets up the native target before the JIT needs it.
+JIT::JIT(bool perf_map) : backend(host_options()) {
+  Phase phase("jit setup");
+  llvm::orc::LLJITBuilder builder;
+  if (perf_map) {
+    this->perf_map.reset(new PerfMapListener());
+    // Null when LLVM was built without perf support.
+    jitdump = llvm::JITEventListener::createPerfJITEventListener();
+    if (jitdump == nullptr) {
+      llvm::errs() << "warn: this LLVM writes no jitdump, only a perf map\n";
+    }
+    // LLJIT's default layer on ELF, with the listeners registered.
+    builder.setObjectLinkingLayerCreator(
+        [this](llvm::orc::ExecutionSession &session, const llvm::Triple &) {
+          auto layer = std::make_unique<llvm::orc::RTDyldObjectLinkingLayer>(
+              session, [] {
+                return std::make_unique<llvm::SectionMemoryManager>();
+              });
+          layer->registerJITEventListener(*this->perf_map);
+          if (jitdump != nullptr) {
+            layer->registerJITEventListener(*jitdump);
+          }
+          return std::unique_ptr<llvm::orc::ObjectLayer>(std::move(layer));
+        });
+  }
+  auto created = builder.create();
+  if (!created) {
+    error("can not create the JIT: " + describe(created.takeError()));
+  }
+  jit = std::move(*created);
+
+  using llvm::orc::DynamicLibrarySearchGenerator;
+  auto process = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      jit->getDataLayout().getGlobalPrefix());
+  if (!process) {
+    error(describe(process.takeError()));
+  }
+  jit->getMainJITDylib().addGenerator(std::move(*process));
+}
+
+JIT::~JIT() = default;
+
+std::vector<void *> JIT::add(llvm::Module *module,
+                             const std::vector<std::string> &names) {
+  std::set<const llvm::GlobalValue *> keep;
+  for (const auto &name : names) {
+    keep.insert(module->getFunction(name));
+  }
+  auto unit =
+      Backend::extractUnit(module, [&keep](const llvm::GlobalValue *value) {
+        return keep.count(value) != 0 || value->hasLocalLinkage();
+      });
+
+  // The JIT takes the unit with a context of its own.
+  llvm::SmallString<0> bitcode;
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(*unit, os);
+  std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+  auto parsed = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode.str(), "jit"), *context);
+  if (!parsed) {
+    error("broken unit: " + describe(parsed.takeError()));
+  }
+
+  // CodeGen's calls use the fast convention; callers from C++ get an
+  // entry point returning i64 in the C one.
+  std::vector<std::string> symbols;
+  for (const auto &name : names) {
+    llvm::Function *func = (*parsed)->getFunction(name);
+    if (func->getCallingConv() == llvm::CallingConv::C) {
+      symbols.push_back(name);
+      continue;
+    }
+    symbols.push_back(name + ".entry");
+    entries.insert(name);
+
+    auto *i64 = llvm::Type::getInt64Ty(*context);
+    auto *type = llvm::FunctionType::get(
+        i64, func->getFunctionType()->params(), false);
+    auto *entry = llvm::Function::Create(
+        type, llvm::Function::ExternalLinkage, symbols.back(), parsed->get());
+    llvm::IRBuilder<> builder(
+        llvm::BasicBlock::Create(*context, "entry", entry));
+    std::vector<llvm::Value *> args;
+    for (auto &arg : entry->args()) {
+      args.push_back(&arg);
+    }
+    auto *call = builder.CreateCall(func, args);
+    call->setCallingConv(func->getCallingConv());
+    if (func->getReturnType()->isVoidTy()) {
+      builder.CreateRet(llvm::ConstantInt::get(i64, 0));
+    } else {
+      builder.CreateRet(call);
+    }
+  }
+
+  // The JIT compiles for the host, so a @multiversion function is already
+  // its best version; RuntimeDyld does not resolve ifuncs anyway.
+  for (auto &func : **parsed) {
+    func.removeFnAttr("yslang.multiversion");
+  }
+  backend.optimize(parsed->get());
+  if (auto err = jit->addIRModule(llvm::orc::ThreadSafeModule(
+          std::move(*parsed), std::move(context)))) {
+    error("can not add " + names.front() + ": " + describe(std::move(err)));
+  }
+
+  // The first lookup compiles the whole unit.
+  std::vector<void *> addresses;
+  for (const auto &name : symbols) {
+    auto symbol = jit->lookup(name);
+    if (!symbol) {
+      error("can not compile " + name + ": " + describe(symbol.takeError()));
+    }
+    auto address = static_cast<uintptr_t>(symbol->getAddress());
+    addresses.push_back(reinterpret_cast<void *>(address));
+  }
+  return addresses;
+}
+
+void JIT::remove(const std::vector<std::string> &names) {
+  llvm::orc::SymbolNameSet symbols;
+  for (const auto &name : names) {
+    symbols.insert(jit->mangleAndIntern(name));
+    if (entries.erase(name) != 0) {
+      symbols.insert(jit->mangleAndIntern(name + ".entry"));
+    }
+  }
+  if (auto err = jit->getMainJITDylib().remove(symbols)) {
+    error("can not remove " + names.front() + ": " + describe(std::move(err)));
+  }
+}
+
+std::vector<llvm::Function *> JIT::callees(llvm::Function *func) {
+  std::vector<llvm::Function *> result;
+  std::set<llvm::Function *> visited{ func };
+  std::vector<llvm::Function *> work{ func };
+  while (!work.empty()) {
+    llvm::Function *caller = work.back();
+    work.pop_back();
+    for (auto &inst : llvm::instructions(caller)) {
+      for (auto &operand : inst.operands()) {
+        auto *callee = llvm::dyn_cast<llvm::Function>(operand.get());
+        if (callee == nullptr || callee->isDeclaration() ||
+            !visited.insert(callee).second) {
+          continue;
+        }
+        if (callee->hasLocalLinkage() || callee->hasLinkOnceODRLinkage()) {
+          work.push_back(callee);
+        } else {
+          result.push_back(callee);
+        }
+      }
+    }
+  }
+  return result;
+}
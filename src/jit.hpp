@@ -0,0 +1,59 @@
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "./backend.hpp"
+
+namespace llvm {
+class JITEventListener;
+namespace orc {
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+
+namespace yslang {
+// An ORC session compiling CodeGen output for the host at -O2. Functions
+// arrive a few at a time out of a module holding the whole program and
+// live in one JITDylib, so later ones call earlier ones directly.
+//
+// With `perf_map`, compiled functions are listed in /tmp/perf-<pid>.map,
+// which `perf report` reads for names, and described in a jitdump file
+// for `perf inject --jit`, which adds source lines when the module has
+// debug info (CodeGen::emitDebugInfo). The jitdump file goes to
+// $JITDUMPDIR or ~/.debug/jit and needs `perf record -k 1`. remove() only
+// unlinks symbols, so their code keeps its place in the map until the JIT
+// frees it on destruction.
+class JIT {
+public:
+  explicit JIT(bool perf_map = false);
+  ~JIT();
+
+  // Compiles the external functions `names` of `module` with the internal
+  // helpers they use, and returns addresses to call them through as C
+  // functions returning i64, in the same order. The functions they call
+  // must be among `names` or already in the JIT. `module` is only read,
+  // and its context stays with the caller.
+  std::vector<void *> add(llvm::Module *module,
+                          const std::vector<std::string> &names);
+  // Drops functions so they can be added again; their callers must go too.
+  void remove(const std::vector<std::string> &names);
+
+  // External functions `func` calls, directly or through internal helpers
+  // such as a memo body or the task runtime.
+  static std::vector<llvm::Function *> callees(llvm::Function *func);
+
+private:
+  Backend backend;
+  // Declared before the JIT that reports to them. LLVM owns jitdump.
+  std::unique_ptr<llvm::JITEventListener> perf_map;
+  llvm::JITEventListener *jitdump = nullptr;
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+  // Functions reached through a separate C entry point.
+  std::set<std::string> entries;
+};
+} // namespace yslang
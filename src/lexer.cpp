@@ -3,17 +3,20 @@
 
 using namespace yslang;
 
-std::map<std::string, TokenType> Lexer::keywords;
-
 Lexer::Lexer(const std::string &input) : input(input) {
-  Lexer::init_keywords();
   read_char();
 }
 
 Token Lexer::next() {
-  Token token;
-
   skip_blank();
+  size_t start = line;
+  Token token = read_token();
+  token.line = start;
+  return token;
+}
+
+Token Lexer::read_token() {
+  Token token;
 
   switch (this->ch) {
   case '0' ... '9':
@@ -24,6 +27,8 @@ Token Lexer::next() {
     return read_ident();
   case '"':
     return read_string_lit();
+  case '@':
+    return read_attribute();
   case '\0':
     token.type = TokenType::TEOF;
     break;
@@ -47,6 +52,13 @@ Token Lexer::next() {
       token.type = TokenType::Assign;
     }
     break;
+  case '!':
+    if (peek_char() != '=') {
+      throw "invalid char: " + std::string{ this->ch };
+    }
+    read_char();
+    token.type = TokenType::NotEqual;
+    break;
   case '<':
     if (peek_char() == '=') {
       read_char();
@@ -114,6 +126,9 @@ void Lexer::skip_blank() {
 }
 
 void Lexer::read_char() {
+  if (this->ch == '\n') {
+    line++;
+  }
   if (read_position >= input.size()) {
     this->ch = '\0';
   } else {
@@ -152,8 +167,8 @@ Token Lexer::read_ident() {
 
   std::string ident = input.substr(pos, position - pos);
 
-  auto itr = keywords.find(ident);
-  if (itr == keywords.end()) {
+  auto itr = keywords().find(ident);
+  if (itr == keywords().end()) {
     return Token(TokenType::Ident, std::move(ident));
   } else {
     return Token(itr->second);
@@ -173,18 +188,35 @@ Token Lexer::read_string_lit() {
   return Token(TokenType::String, input.substr(pos, position - pos - 1));
 }
 
-void Lexer::init_keywords() {
-  if (keywords.size() != 0) {
-    return;
+Token Lexer::read_attribute() {
+  read_char(); // take '@'
+  size_t pos = position;
+
+  while (is_ident_piece(this->ch)) {
+    read_char();
   }
-  keywords["const"] = TokenType::Const;
-  keywords["let"] = TokenType::Let;
-  keywords["func"] = TokenType::Func;
-  keywords["if"] = TokenType::If;
-  keywords["else"] = TokenType::Else;
-  keywords["while"] = TokenType::While;
-  keywords["return"] = TokenType::Return;
-  keywords["import"] = TokenType::Import;
-  keywords["struct"] = TokenType::Struct;
-  keywords["type"] = TokenType::Type;
+
+  return Token(TokenType::Attribute, input.substr(pos, position - pos));
+}
+
+// Built once on first use, which is thread safe, so lexers on different
+// threads can share it.
+const std::map<std::string, TokenType> &Lexer::keywords() {
+  static const std::map<std::string, TokenType> keywords = {
+    { "const", TokenType::Const },
+    { "let", TokenType::Let },
+    { "func", TokenType::Func },
+    { "if", TokenType::If },
+    { "else", TokenType::Else },
+    { "while", TokenType::While },
+    { "break", TokenType::Break },
+    { "continue", TokenType::Continue },
+    { "return", TokenType::Return },
+    { "import", TokenType::Import },
+    { "struct", TokenType::Struct },
+    { "type", TokenType::Type },
+    { "async", TokenType::Async },
+    { "await", TokenType::Await },
+  };
+  return keywords;
 }
@@ -16,6 +16,7 @@ public:
   Token next();
 
 private:
+  Token read_token();
   void skip_blank();
   void read_char();
   char peek_char();
@@ -23,16 +24,17 @@ private:
   Token read_number();
   Token read_ident();
   Token read_string_lit();
+  Token read_attribute();
 
 private:
-  static std::map<std::string, TokenType> keywords;
-  static void init_keywords();
+  static const std::map<std::string, TokenType> &keywords();
 
 private:
   std::string input;
   std::string path;
   size_t position = 0;
   size_t read_position = 0;
-  char ch;
+  size_t line = 1;
+  char ch = '\0';
 };
 } // namespace yslang
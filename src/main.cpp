@@ -1,69 +1,664 @@
+#include <atomic>
 #include <iostream>
+#include <llvm/ADT/SmallString.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 #include <llvm/Support/raw_ostream.h>
+#include <thread>
+#include <unistd.h>
 
 #include "../third_party/cmdline.h"
+#include "./backend.hpp"
+#include "./build.hpp"
+#include "./bytecode.hpp"
+#include "./cache.hpp"
 #include "./codegen.hpp"
+#include "./error.hpp"
+#include "./instrument.hpp"
+#include "./interface.hpp"
+#include "./interpreter.hpp"
 #include "./lexer.hpp"
 #include "./parser.hpp"
+#include "./profile.hpp"
+#include "./protocol.hpp"
+#include "./repl.hpp"
+#include "./scheduler.hpp"
+#include "./server.hpp"
+#include "./tiered.hpp"
+#include "./timing.hpp"
 #include "./token.hpp"
+#include "./vm.hpp"
 
-int main(int argc, char *argv[]) {
-  cmdline::parser cmd;
-  cmd.add("tokens", 't', "print lexed tokens");
-  cmd.add("ast", 'a', "print ast");
-  cmd.footer("file");
+// The source's own directory, then each directory in -I.
+static std::vector<std::string> importPaths(const cmdline::parser &cmd,
+                                            const std::string &path) {
+  std::string dir = llvm::sys::path::parent_path(path).str();
+  std::vector<std::string> paths{ dir.empty() ? "." : dir };
 
-  cmd.parse_check(argc, argv);
+  llvm::SmallVector<llvm::StringRef, 4> dirs;
+  llvm::StringRef(cmd.get<std::string>("import-path")).split(dirs, ':', -1,
+                                                             false);
+  for (auto dir : dirs) {
+    paths.push_back(dir.str());
+  }
+  return paths;
+}
 
-  if (cmd.rest().size() == 0) {
-    std::cout << cmd.usage();
-    return 0;
+static std::string interfacePath(const std::string &output) {
+  llvm::SmallString<128> path(output);
+  llvm::sys::path::replace_extension(path, "yzi");
+  return path.str().str();
+}
+
+// One compilation: what to read, what to write and where imports are.
+struct FileJob {
+  std::string path;
+  std::string output;
+  std::string emit;
+  // Where to write the module's interface, if anywhere.
+  std::string interface_path;
+  std::vector<std::string> import_paths;
+};
+
+static FileJob makeJob(const cmdline::parser &cmd, const std::string &path,
+                       const std::string &output) {
+  FileJob job;
+  job.path = path;
+  job.output = output;
+  job.emit = cmd.get<std::string>("emit");
+  // Objects come with the interface of their module.
+  if (job.emit == "obj") {
+    job.interface_path = interfacePath(output);
+  } else if (job.emit == "yzi") {
+    job.interface_path = output;
   }
+  job.import_paths = importPaths(cmd, path);
+  return job;
+}
+
+// Compiles one input. Errors are reported here so that, in a batch, one
+// broken file does not stop the others.
+static int compileFile(const cmdline::parser &cmd, yslang::Backend &backend,
+                       yslang::CompileCache *cache,
+                       const yslang::Profile *profile, const FileJob &job,
+                       bool batch) {
+  const std::string &path = job.path;
+  const std::string &output = job.output;
+  const std::string &emit = job.emit;
+  const std::string &interface_path = job.interface_path;
+  auto report = [&](const std::string &msg) {
+    std::cerr << (batch ? path + ": " : "") + msg + "\n";
+  };
+
+  std::string input;
+  {
+    yslang::Phase phase("read", path);
+    std::ifstream ifs(path);
+    if (ifs.fail()) {
+      report("Can not open " + path);
+      return 1;
+    }
+
+    std::istreambuf_iterator<char> it(ifs);
+    std::istreambuf_iterator<char> last;
+    input.assign(it, last);
+  }
+
+  try {
+    if (cmd.exist("tokens")) {
+      yslang::Lexer lexer(input);
+      for (yslang::Token t = lexer.next(); t.type != yslang::TokenType::TEOF;
+           t = lexer.next()) {
+        std::cout << t << std::endl;
+      }
+      return 0;
+    }
+
+    // A hit skips the whole pipeline. The job count is left out of the key
+    // since it does not change the output; imported interfaces are in it.
+    std::string cache_key;
+    std::string interface_key;
+    if (cache && !cmd.exist("ast")) {
+      const auto &target = backend.getOptions();
+      std::vector<std::string> parts{
+        input,
+        emit,
+        std::to_string(target.opt_level),
+        backend.getTriple(),
+        target.cpu,
+        target.features,
+        cmd.exist("cache-functions") ? "functions" : "",
+        target.thin_lto ? "thin" : "",
+        cmd.get<std::string>("profile-generate"),
+        cmd.get<std::string>("instrument"),
+        profile != nullptr ? profile->serialize() : ""
+      };
+      for (const auto &import :
+           yslang::Interface::findImports(input, job.import_paths)) {
+        auto buffer = llvm::MemoryBuffer::getFile(import);
+        parts.push_back(buffer ? (*buffer)->getBuffer().str() : "");
+      }
+      cache_key = yslang::CompileCache::key(parts);
+      interface_key = yslang::CompileCache::key({ cache_key, "interface" });
+      if (cache->lookup(cache_key, output) &&
+          (interface_path.empty() || interface_path == output ||
+           cache->lookup(interface_key, interface_path))) {
+        return 0;
+      }
+    }
+
+    // The parser lexes on demand, so for the report the input is also lexed
+    // once on its own; the parse phase still includes lexing.
+    if (yslang::TimeReport::isEnabled()) {
+      yslang::Phase phase("lex", path);
+      yslang::Lexer lexer(input);
+      while (lexer.next().type != yslang::TokenType::TEOF) {
+      }
+    }
+
+    yslang::Parser parser(input);
+    yslang::Program program;
+    {
+      yslang::Phase phase("parse", path);
+      program = parser.parse();
+    }
+
+    if (parser.has_error()) {
+      for (const auto &msg : parser.error_messages) {
+        report(msg);
+      }
+      return 1;
+    }
+
+    if (cmd.exist("ast")) {
+      std::cout << program.toJson().to_string() << std::endl;
+      return 0;
+    }
+
+    {
+      yslang::Phase phase("interface", path);
+      yslang::Interface::resolveImports(&program, job.import_paths);
+      if (!interface_path.empty()) {
+        yslang::Interface interface;
+        interface.collect(&program);
+        interface.write(interface_path);
+      }
+    }
+    if (emit == "yzi") {
+      if (cache) {
+        cache->insert(cache_key, output);
+      }
+      return 0;
+    }
+    if (emit == "ysb") {
+      {
+        yslang::Phase phase("bytecode", path);
+        yslang::BytecodeCompiler().compile(&program).write(output);
+      }
+      if (cache) {
+        cache->insert(cache_key, output);
+      }
+      return 0;
+    }
 
-  std::string path = cmd.rest()[0];
+    yslang::CodeGen codegen;
+    if (!cmd.get<std::string>("profile-generate").empty()) {
+      codegen.instrument(cmd.get<std::string>("profile-generate"));
+    }
+    codegen.useProfile(profile);
+    {
+      yslang::Phase phase("codegen", path);
+      codegen.generate(&program);
+    }
+    auto module = codegen.getModule();
+    if (!cmd.get<std::string>("instrument").empty()) {
+      yslang::Instrumenter(module, cmd.get<std::string>("instrument")).run();
+    }
 
+    yslang::Phase phase("emit", path);
+    if (emit == "obj" && cache && cmd.exist("cache-functions") &&
+        !backend.getOptions().thin_lto) {
+      backend.emitIncremental(module, output, *cache);
+    } else if (emit == "obj") {
+      backend.emitObject(module, output);
+    } else {
+      if (backend.getOptions().opt_level > 0) {
+        backend.optimize(module);
+      } else {
+        backend.setTarget(module);
+      }
+
+      std::error_code error_info;
+      llvm::raw_fd_ostream raw_stream(output, error_info,
+                                      llvm::sys::fs::OpenFlags::F_None);
+      module->print(raw_stream, nullptr);
+    }
+
+    if (cache) {
+      cache->insert(cache_key, output);
+      if (!interface_path.empty() && interface_path != output) {
+        cache->insert(interface_key, interface_path);
+      }
+    }
+    return 0;
+  } catch (const yslang::Error &e) {
+    report(std::string("err: ") + e.what());
+  } catch (const std::string &msg) {
+    report("err: " + msg);
+  } catch (const std::exception &e) {
+    // Library failures such as std::stoll on an oversized literal.
+    report(std::string("err: ") + e.what());
+  }
+  return 1;
+}
+
+// `ys interp file.yz`: runs main() without generating code and exits with
+// its result, like the compiled program would. `ys vm` does the same on the
+// bytecode VM and also takes a .ysb file from --emit ysb.
+static int interpretFile(const std::string &path, bool vm,
+                         uint64_t tier_threshold, bool perf_map) {
   std::ifstream ifs(path);
   if (ifs.fail()) {
     std::cerr << "Can not open " << path << std::endl;
+    return 1;
   }
 
   std::istreambuf_iterator<char> it(ifs);
   std::istreambuf_iterator<char> last;
   std::string input(it, last);
 
-  if (cmd.exist("tokens")) {
-    yslang::Lexer lexer(input);
-    for (yslang::Token t = lexer.next(); t.type != yslang::TokenType::TEOF;
-         t = lexer.next()) {
-      std::cout << t << std::endl;
+  try {
+    if (vm && yslang::BytecodeModule::isBytecode(input)) {
+      if (tier_threshold > 0) {
+        std::cerr << "err: --tiered needs the source of " << path
+                  << std::endl;
+        return 1;
+      }
+      yslang::BytecodeModule module;
+      module.deserialize(input);
+      return static_cast<int>(yslang::VM(std::move(module)).run());
+    }
+
+    yslang::Parser parser(input);
+    yslang::Program program = parser.parse();
+    if (parser.has_error()) {
+      for (const auto &msg : parser.error_messages) {
+        std::cerr << msg << std::endl;
+      }
+      return 1;
+    }
+    program.path = path;
+
+    if (vm && tier_threshold > 0) {
+      yslang::TieredRunner runner(&program, tier_threshold, perf_map);
+      return static_cast<int>(runner.run());
+    }
+    if (vm) {
+      yslang::VM machine(yslang::BytecodeCompiler().compile(&program));
+      return static_cast<int>(machine.run());
+    }
+    yslang::Interpreter interpreter;
+    interpreter.load(&program);
+    return static_cast<int>(interpreter.run());
+  } catch (const yslang::Error &e) {
+    std::cerr << "err: " << e.what() << std::endl;
+  } catch (const std::string &msg) {
+    std::cerr << "err: " << msg << std::endl;
+  } catch (const std::exception &e) {
+    // Library failures such as std::stoll on an oversized literal.
+    std::cerr << "err: " << e.what() << std::endl;
+  }
+  return 1;
+}
+
+// `ys build root.yz`: compiles root and every module it imports into the
+// build directory and links the objects. Interfaces are cheap to produce,
+// so each object only waits for the interfaces of its imports, not for
+// their objects.
+static int buildModules(const cmdline::parser &cmd, yslang::Backend &backend,
+                        yslang::CompileCache *cache,
+                        const yslang::Profile *profile,
+                        const std::string &root, unsigned jobs) {
+  std::string build_dir = cmd.get<std::string>("build-dir");
+  llvm::sys::fs::create_directories(build_dir);
+  auto build_path = [&](const std::string &name, const std::string &ext) {
+    llvm::SmallString<128> path(build_dir);
+    llvm::sys::path::append(path, name + "." + ext);
+    return path.str().str();
+  };
+
+  yslang::ModuleGraph graph;
+  graph.discover(root, importPaths(cmd, root));
+  const auto &modules = graph.getModules();
+
+  yslang::TaskGraph tasks;
+  std::vector<size_t> interfaces;
+  std::vector<size_t> objects;
+  std::vector<std::string> object_paths;
+  for (const auto &module : modules) {
+    std::vector<size_t> deps;
+    for (size_t import : module.imports) {
+      deps.push_back(interfaces[import]);
+    }
+
+    FileJob interface;
+    interface.path = module.path;
+    interface.emit = "yzi";
+    interface.output = build_path(module.name, "yzi");
+    interface.interface_path = interface.output;
+    interface.import_paths = { build_dir };
+    interfaces.push_back(tasks.add(
+        "interface " + module.name,
+        [&, interface]() {
+          return compileFile(cmd, backend, cache, profile, interface,
+                             true) == 0;
+        },
+        deps));
+
+    FileJob object = interface;
+    object.emit = "obj";
+    object.output = build_path(module.name, "o");
+    object.interface_path = "";
+    object_paths.push_back(object.output);
+    objects.push_back(tasks.add(
+        "object " + module.name,
+        [&, object]() {
+          return compileFile(cmd, backend, cache, profile, object, true) == 0;
+        },
+        deps));
+  }
+
+  std::string output = cmd.get<std::string>("output");
+  if (output.empty()) {
+    output = build_path(modules.back().name + ".linked", "o");
+  }
+  tasks.add("link " + output,
+            [&]() {
+              try {
+                if (backend.getOptions().thin_lto) {
+                  backend.linkThinLTO(object_paths, output,
+                                      cmd.get<std::string>("cache-dir"));
+                } else {
+                  backend.linkObjects(object_paths, output);
+                }
+                return true;
+              } catch (const yslang::Error &e) {
+                std::cerr << "err: " + std::string(e.what()) + "\n";
+                return false;
+              }
+            },
+            objects);
+
+  bool ok = tasks.run(jobs);
+  tasks.printCriticalPath(std::cerr);
+  return ok ? 0 : 1;
+}
+
+static int compile(int argc, char *argv[]) {
+  cmdline::parser cmd;
+  cmd.add("tokens", 't', "print lexed tokens");
+  cmd.add("ast", 'a', "print ast");
+  cmd.add<std::string>("emit", 0, "output kind; obj also writes a .yzi",
+                       false, "ll",
+                       cmdline::oneof<std::string>("ll", "obj", "yzi", "ysb"));
+  cmd.add<std::string>("lto", 0, "thin emits ThinLTO bitcode for --link",
+                       false, "none",
+                       cmdline::oneof<std::string>("none", "thin"));
+  cmd.add("link", 0, "link ThinLTO bitcode and objects into one object");
+  cmd.add<std::string>("build-dir", 0, "output directory of ys build", false,
+                       "build");
+  cmd.add<std::string>("import-path", 'I',
+                       "directories with imported .yzi files, split by ':'",
+                       false, "");
+  cmd.add<std::string>("output", 'o', "output file", false, "");
+  cmd.add<unsigned>("opt", 'O', "optimization level", false, 0,
+                    cmdline::range(0u, 3u));
+  cmd.add<unsigned>("jobs", 'j', "number of threads", false, 1);
+  cmd.add<std::string>("march", 0, "target cpu, or native for the host",
+                       false, "generic");
+  cmd.add<std::string>("mcpu", 0, "target cpu, overriding --march", false,
+                       "");
+  cmd.add<std::string>("mattr", 0, "target features such as +avx2", false,
+                       "");
+  cmd.add<std::string>("cache-dir", 0, "reuse outputs cached in this directory",
+                       false, "");
+  cmd.add<unsigned>("cache-size", 0, "cache size limit in MiB, 0 for none",
+                    false, 1024);
+  cmd.add("cache-functions", 0,
+          "cache objects per function; disables cross-function inlining");
+  cmd.add("time-report", 0,
+          "print time and peak memory of each phase and LLVM pass");
+  cmd.add<std::string>("trace", 0, "write Chrome trace events to this file",
+                       false, "");
+  cmd.add<std::string>("profile-generate", 0,
+                       "count branches and append them to this file at exit",
+                       false, "");
+  cmd.add<std::string>("profile-use", 0,
+                       "optimize with a profile from --profile-generate",
+                       false, "");
+  cmd.add<std::string>("instrument", 0,
+                       "count calls and cycles of each function, printed at "
+                       "exit: calls, cycles or calls,cycles",
+                       false, "");
+  cmd.add("tiered", 0, "with ys vm, compile hot functions to native code");
+  cmd.add<unsigned>("tier-threshold", 0,
+                    "calls plus loop iterations that make a function hot",
+                    false, 10000);
+  cmd.add("perf-map", 0,
+          "with --tiered or ys repl, tell perf about JIT-compiled functions");
+  cmd.add("server", 0, "serve ys-client requests on a Unix socket");
+  cmd.add<std::string>("socket", 0, "server socket path", false,
+                       yslang::default_socket_path());
+  cmd.footer("file... | build root.yz | interp file.yz | vm file.yz|file.ysb "
+             "| repl | profile-merge -o out profile...");
+
+  cmd.parse_check(argc, argv);
+
+  if (cmd.exist("server")) {
+    return yslang::CompileServer(cmd.get<std::string>("socket"), compile)
+        .run();
+  }
+
+  // Reports whichever way compilation ends.
+  struct Reporter {
+    std::string trace_path;
+    ~Reporter() {
+      if (yslang::TimeReport::isEnabled()) {
+        yslang::TimeReport::print(llvm::errs());
+      }
+      if (!trace_path.empty() && !yslang::TimeReport::writeTrace(trace_path)) {
+        std::cerr << "err: can not write " << trace_path << std::endl;
+      }
+    }
+  } reporter{ cmd.get<std::string>("trace") };
+  if (cmd.exist("time-report")) {
+    yslang::TimeReport::enable();
+  }
+  if (!reporter.trace_path.empty()) {
+    yslang::TimeReport::startTrace();
+  }
+
+  const auto &paths = cmd.rest();
+  if (paths.size() == 0) {
+    std::cout << cmd.usage();
+    return 0;
+  }
+
+  // Sums profiles of several runs or inputs into one.
+  if (paths[0] == "profile-merge") {
+    try {
+      yslang::Profile merged;
+      for (size_t i = 1; i < paths.size(); i++) {
+        merged.read(paths[i]);
+      }
+      std::string output = cmd.get<std::string>("output");
+      merged.write(output.empty() ? "merged.yprof" : output);
+    } catch (const yslang::Error &e) {
+      std::cerr << "err: " << e.what() << std::endl;
+      return 1;
     }
     return 0;
   }
 
-  yslang::Parser parser(input);
-  yslang::Program program = parser.parse();
+  if (paths[0] == "repl") {
+    try {
+      yslang::Repl(cmd.exist("perf-map"))
+          .run(std::cin, std::cout, isatty(STDIN_FILENO));
+    } catch (const yslang::Error &e) {
+      std::cerr << "err: " << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
 
-  if (parser.has_error()) {
-    for (const auto &msg : parser.error_messages) {
-      std::cerr << msg << std::endl;
+  // Interpreting needs no target setup.
+  if (paths[0] == "interp" || paths[0] == "vm") {
+    if (paths.size() != 2) {
+      std::cerr << "err: ys " << paths[0] << " takes one file" << std::endl;
+      return 1;
+    }
+    if (cmd.exist("tiered") && paths[0] != "vm") {
+      std::cerr << "err: --tiered works with ys vm" << std::endl;
+      return 1;
+    }
+    if (cmd.exist("perf-map") && !cmd.exist("tiered")) {
+      std::cerr << "err: --perf-map works with --tiered or ys repl"
+                << std::endl;
+      return 1;
     }
+    uint64_t tier_threshold =
+        cmd.exist("tiered") ? std::max(cmd.get<unsigned>("tier-threshold"), 1u)
+                            : 0;
+    return interpretFile(paths[1], paths[0] == "vm", tier_threshold,
+                         cmd.exist("perf-map"));
+  }
+
+  std::string emit = cmd.get<std::string>("emit");
+  std::string output = cmd.get<std::string>("output");
+  bool build = paths[0] == "build";
+  bool batch = paths.size() > 1 && !build;
+  if (batch && !output.empty() && !cmd.exist("link")) {
+    std::cerr << "err: -o can not be used with multiple files" << std::endl;
+    return 1;
+  }
+
+  // A single file gets all jobs for its partitions; a batch spreads them
+  // over files instead.
+  unsigned jobs = std::max(cmd.get<unsigned>("jobs"), 1u);
+  yslang::BackendOptions backend_options;
+  backend_options.opt_level = cmd.get<unsigned>("opt");
+  backend_options.jobs = batch || build ? 1 : jobs;
+  backend_options.cpu = cmd.get<std::string>("march");
+  if (!cmd.get<std::string>("mcpu").empty()) {
+    backend_options.cpu = cmd.get<std::string>("mcpu");
+  }
+  backend_options.features = cmd.get<std::string>("mattr");
+  backend_options.thin_lto = cmd.get<std::string>("lto") == "thin";
+
+  std::unique_ptr<yslang::Backend> backend;
+  std::unique_ptr<yslang::CompileCache> cache;
+  std::unique_ptr<yslang::Profile> profile;
+  try {
+    backend.reset(new yslang::Backend(backend_options));
+    if (!cmd.get<std::string>("cache-dir").empty()) {
+      cache.reset(new yslang::CompileCache(
+          cmd.get<std::string>("cache-dir"),
+          uint64_t(cmd.get<unsigned>("cache-size")) << 20));
+    }
+    if (!cmd.get<std::string>("profile-use").empty()) {
+      profile.reset(new yslang::Profile());
+      profile->read(cmd.get<std::string>("profile-use"));
+    }
+  } catch (const yslang::Error &e) {
+    std::cerr << "err: " << e.what() << std::endl;
     return 1;
   }
 
-  if (cmd.exist("ast")) {
-    std::cout << program.toJson().to_string() << std::endl;
+  if (build) {
+    if (paths.size() != 2) {
+      std::cerr << "err: ys build takes one root module" << std::endl;
+      return 1;
+    }
+    int status = buildModules(cmd, *backend, cache.get(), profile.get(),
+                              paths[1], jobs);
+    if (cache) {
+      cache->prune();
+    }
+    return status;
+  }
+
+  // The link step takes every input at once and parallelizes inside.
+  if (cmd.exist("link")) {
+    backend_options.jobs = jobs;
+    yslang::Backend linker(backend_options);
+    linker.linkThinLTO(paths, output.empty() ? "out.o" : output,
+                       cmd.get<std::string>("cache-dir"));
+    if (cache) {
+      cache->prune();
+    }
     return 0;
   }
 
-  yslang::CodeGen codegen;
-  codegen.generate(&program);
-  auto module = codegen.getModule();
+  // Without -o, batch inputs and interfaces get an output next to the
+  // source, a.yz -> a.o, a.ll, a.yzi or a.ysb.
+  std::vector<std::string> outputs;
+  for (const auto &path : paths) {
+    if (!output.empty()) {
+      outputs.push_back(output);
+      continue;
+    }
+    // Interfaces are found by module name, so they are always named after
+    // their source.
+    std::string extension = emit == "obj" ? "o" : emit;
+    if (!batch && emit != "yzi") {
+      outputs.push_back("out." + extension);
+      continue;
+    }
+    llvm::SmallString<128> derived(path);
+    llvm::sys::path::replace_extension(derived, extension);
+    outputs.push_back(derived.str().str());
+  }
+
+  // Printing modes write to stdout, so they keep the files in order.
+  if (cmd.exist("tokens") || cmd.exist("ast")) {
+    jobs = 1;
+  }
+
+  std::atomic<size_t> next(0);
+  std::atomic<int> status(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      if (compileFile(cmd, *backend, cache.get(), profile.get(),
+                      makeJob(cmd, paths[i], outputs[i]), batch) != 0) {
+        status = 1;
+      }
+    }
+  };
 
-  std::error_code error_info;
-  llvm::raw_fd_ostream raw_stream("out.ll", error_info,
-                                  llvm::sys::fs::OpenFlags::F_None);
-  module->print(raw_stream, nullptr);
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < std::min<size_t>(jobs, paths.size()); i++) {
+    workers.emplace_back([&]() {
+      yslang::TimeReport::attachThread();
+      work();
+      yslang::TimeReport::detachThread();
+    });
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  if (cache) {
+    cache->prune();
+  }
+  return status;
+}
 
-  return 0;
+int main(int argc, char *argv[]) {
+  try {
+    return compile(argc, argv);
+  } catch (const yslang::Error &e) {
+    std::cerr << "err: " << e.what() << std::endl;
+    return 1;
+  }
 }
@@ -13,6 +13,7 @@ Parser::Parser(const std::string &input) : lexer(input) {
   prefix_parse_functions[TokenType::Integer] = &Parser::parse_literal;
   prefix_parse_functions[TokenType::String] = &Parser::parse_literal;
   prefix_parse_functions[TokenType::Ident] = &Parser::parse_identifier;
+  prefix_parse_functions[TokenType::Await] = &Parser::parse_await_expression;
 
   infix_parse_functions[TokenType::Plus] = &Parser::parse_infix_expression;
   infix_parse_functions[TokenType::Minus] = &Parser::parse_infix_expression;
@@ -64,10 +65,14 @@ Program Parser::parse() {
 Decl *Parser::parse_decl() {
   std::stringstream ss;
   switch (cur_token.type) {
+  case TokenType::Attribute:
+  case TokenType::Async:
   case TokenType::Func:
     return parse_func_decl();
   case TokenType::Import:
     return parse_import_decl();
+  case TokenType::Const:
+    return parse_const_decl();
   case TokenType::Type:
     return parse_type_decl();
   default:
@@ -78,6 +83,17 @@ Decl *Parser::parse_decl() {
 }
 
 FuncDecl *Parser::parse_func_decl() {
+  std::vector<std::string> attributes;
+  while (cur_token_is(TokenType::Attribute)) {
+    attributes.push_back(std::move(cur_token.str));
+    next_token();
+  }
+
+  size_t line = cur_token.line;
+  bool is_async = cur_token_is(TokenType::Async);
+  if (is_async) {
+    next_token();
+  }
   expect(TokenType::Func);
 
   std::string func_name = "";
@@ -93,8 +109,11 @@ FuncDecl *Parser::parse_func_decl() {
 
   FuncDecl *func = new FuncDecl();
   func->name = std::move(func_name);
+  func->attributes = std::move(attributes);
   func->func_type = func_type;
   func->body = body;
+  func->line = line;
+  func->is_async = is_async;
   return func;
 }
 
@@ -104,6 +123,28 @@ ImportDecl *Parser::parse_import_decl() {
   expect(TokenType::Import);
   decl->package = parse_identifier();
 
+  if (cur_token_is(TokenType::Semicolon)) {
+    next_token();
+  }
+
+  return decl;
+}
+
+ConstDecl *Parser::parse_const_decl() {
+  expect(TokenType::Const);
+
+  ConstDecl *decl = new ConstDecl();
+  if (cur_token_is(TokenType::Ident)) {
+    decl->name = std::move(cur_token.str);
+  }
+  expect(TokenType::Ident);
+  expect(TokenType::Assign);
+  decl->expr = parse_expression(LOWEST);
+
+  if (cur_token_is(TokenType::Semicolon)) {
+    next_token();
+  }
+
   return decl;
 }
 
@@ -238,16 +279,32 @@ BlockStmt *Parser::parse_block_stmt() {
 }
 
 Stmt *Parser::parse_statement() {
+  size_t line = cur_token.line;
+  Stmt *stmt;
   switch (cur_token.type) {
   case TokenType::If:
-    return parse_if_statement();
+    stmt = parse_if_statement();
+    break;
   case TokenType::Let:
-    return parse_let_stmt();
+    stmt = parse_let_stmt();
+    break;
   case TokenType::Return:
-    return parse_return_stmt();
+    stmt = parse_return_stmt();
+    break;
+  case TokenType::While:
+    stmt = parse_while_stmt();
+    break;
+  case TokenType::Break:
+  case TokenType::Continue:
+    stmt = parse_branch_stmt();
+    break;
   default:
-    return parse_expression_stmt();
+    stmt = parse_expression_stmt();
+  }
+  if (stmt != nullptr) {
+    stmt->line = line;
   }
+  return stmt;
 }
 
 LetStmt *Parser::parse_let_stmt() {
@@ -255,10 +312,15 @@ LetStmt *Parser::parse_let_stmt() {
 
   LetStmt *stmt = new LetStmt();
   stmt->ident = parse_identifier();
-  stmt->type = parse_type();
+  stmt->type = nullptr;
   stmt->expr = nullptr;
 
+  if (!cur_token_is(TokenType::Assign)) {
+    stmt->type = parse_type();
+  }
+
   if (cur_token_is(TokenType::Assign)) {
+    next_token();
     stmt->expr = parse_expression(LOWEST);
   }
 
@@ -304,33 +366,23 @@ IfStmt *Parser::parse_if_statement() {
   return stmt;
 }
 
-// void Parser::statementWhile() {
-//   takeToken(TokenType::While);
-
-//   auto *cond_block = llvm::BasicBlock::Create(context, "while.cond",
-//   curFunc); auto *body_block = llvm::BasicBlock::Create(context,
-//   "while.body"); auto *merge_block = llvm::BasicBlock::Create(context,
-//   "while.merge");
+WhileStmt *Parser::parse_while_stmt() {
+  expect(TokenType::While);
 
-//   builder.CreateBr(cond_block);
-
-//   {
-//     builder.SetInsertPoint(cond_block);
-//     auto *cond = condition();
-//     takeToken(TokenType::Do);
-//     builder.CreateCondBr(cond, body_block, merge_block);
-//   }
+  WhileStmt *stmt = new WhileStmt();
+  stmt->cond = parse_expression(LOWEST);
+  stmt->body = parse_block_stmt();
+  return stmt;
+}
 
-//   {
-//     curFunc->getBasicBlockList().push_back(body_block);
-//     builder.SetInsertPoint(body_block);
-//     statement();
-//     builder.CreateBr(cond_block);
-//   }
+BranchStmt *Parser::parse_branch_stmt() {
+  BranchStmt *stmt = new BranchStmt();
+  stmt->tok = cur_token.type;
 
-//   curFunc->getBasicBlockList().push_back(merge_block);
-//   builder.SetInsertPoint(merge_block);
-// }
+  next_token();
+  expect(TokenType::Semicolon);
+  return stmt;
+}
 
 ExprStmt *Parser::parse_expression_stmt() {
   ExprStmt *stmt = new ExprStmt();
@@ -394,7 +446,17 @@ Expr *Parser::parse_infix_expression(Expr *left) {
 
   Precedence precedences = cur_precedence();
   next_token();
+  // Assignment is right associative: `a = b = c` is `a = (b = c)`.
+  if (precedences == ASSIGN) {
+    precedences = LOWEST;
+  }
   expression->rhs = parse_expression(precedences);
+  if (expression->rhs == nullptr) {
+    std::stringstream ss;
+    ss << "expected an expression after " << expression->op << ", got "
+       << cur_token.type;
+    error_messages.emplace_back(ss.str());
+  }
 
   return expression;
 }
@@ -436,6 +498,20 @@ Expr *Parser::parse_index_expression(Expr *left) {
   return expr;
 }
 
+// `await f(x) + 1` awaits f(x) and then adds.
+Expr *Parser::parse_await_expression() {
+  expect(TokenType::Await);
+
+  AwaitExpr *expr = new AwaitExpr();
+  expr->operand = parse_expression(PREFIX);
+  if (expr->operand == nullptr) {
+    std::stringstream ss;
+    ss << "expected an expression after Await, got " << cur_token.type;
+    error_messages.emplace_back(ss.str());
+  }
+  return expr;
+}
+
 std::vector<Expr *> Parser::parse_expression_list() {
   std::vector<Expr *> list;
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <map>
 #include <string>
 
@@ -22,6 +23,7 @@ public:
 private:
   enum Precedence {
     LOWEST = 0,
+    ASSIGN,      // = or :=
     EQUALS,      // ==
     LESSGREATER, // < or >
     SUM,         // + or -
@@ -29,7 +31,6 @@ private:
     PREFIX,      // !X or -Y
     CALL,        // myFunction(X)
     INDEX,       // array[index]
-    ASSIGN,      // = or :=
   };
 
 private:
@@ -46,6 +47,8 @@ private:
   ReturnStmt *parse_return_stmt();
   LetStmt *parse_let_stmt();
   IfStmt *parse_if_statement();
+  WhileStmt *parse_while_stmt();
+  BranchStmt *parse_branch_stmt();
   ExprStmt *parse_expression_stmt();
 
   // Expr
@@ -58,6 +61,7 @@ private:
   Expr *parse_call_expression(Expr *left);
   Expr *parse_ref_expression(Expr *left);
   Expr *parse_index_expression(Expr *left);
+  Expr *parse_await_expression();
 
   std::vector<Expr *> parse_expression_list();
 
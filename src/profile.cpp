@@ -0,0 +1,76 @@
+#include "./profile.hpp"
+#include "./error.hpp"
+#include <fstream>
+#include <sstream>
+
+using namespace yslang;
+
+void Profile::read(const std::string &path) {
+  std::ifstream ifs(path);
+  if (ifs.fail()) {
+    error("can not open profile " + path);
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  parse(ss.str(), path);
+}
+
+void Profile::parse(const std::string &data, const std::string &path) {
+  std::istringstream lines(data);
+  std::string line;
+  for (size_t number = 1; std::getline(lines, line); number++) {
+    std::istringstream fields(line);
+    std::string name;
+    if (!(fields >> name)) {
+      continue;
+    }
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    while (fields >> count) {
+      counts.push_back(count);
+    }
+    if (!fields.eof() || counts.empty() || counts.size() % 2 == 0) {
+      error(path + ":" + std::to_string(number) + ": broken profile line");
+    }
+
+    auto inserted = functions.emplace(name, Counts());
+    Counts &total = inserted.first->second;
+    total.entry += counts[0];
+    counts.erase(counts.begin());
+    if (inserted.second) {
+      total.branches = std::move(counts);
+    } else if (total.branches.size() != counts.size() || total.stale) {
+      total.branches.clear();
+      total.stale = true;
+    } else {
+      for (size_t i = 0; i < counts.size(); i++) {
+        total.branches[i] += counts[i];
+      }
+    }
+  }
+}
+
+std::string Profile::serialize() const {
+  std::string data;
+  for (const auto &func : functions) {
+    data += func.first + " " + std::to_string(func.second.entry);
+    for (uint64_t count : func.second.branches) {
+      data += " " + std::to_string(count);
+    }
+    data += "\n";
+  }
+  return data;
+}
+
+void Profile::write(const std::string &path) const {
+  std::ofstream ofs(path);
+  ofs << serialize();
+  if (ofs.fail()) {
+    error("can not write profile " + path);
+  }
+}
+
+const Profile::Counts *Profile::find(const std::string &name) const {
+  auto it = functions.find(name);
+  return it == functions.end() ? nullptr : &it->second;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace yslang {
+// Execution counts written by a program built with --profile-generate.
+//
+// At exit every module appends one line per function to the profile file:
+// its name, how often it was entered, and for each `if` and `while`
+// condition, in the order CodeGen emits them, how often it was true and
+// how often false. Reading sums the lines of a function, so running the
+// program several times, or concatenating files, merges profiles.
+class Profile {
+public:
+  struct Counts {
+    uint64_t entry = 0;
+    // True and false counts of each condition, interleaved.
+    std::vector<uint64_t> branches;
+    // Lines disagreed on the number of conditions; only `entry` is kept.
+    bool stale = false;
+  };
+
+  // Adds the counts in `path` to the profile.
+  void read(const std::string &path);
+  void write(const std::string &path) const;
+  std::string serialize() const;
+
+  // nullptr for a function the profile does not know.
+  const Counts *find(const std::string &name) const;
+
+private:
+  void parse(const std::string &data, const std::string &path);
+
+private:
+  std::map<std::string, Counts> functions;
+};
+} // namespace yslang
@@ -0,0 +1,145 @@
+#pragma once
+
+// Wire format shared by `ys --server` and ys-client. It is plain POSIX so the
+// client stays small and starts without loading LLVM.
+//
+//   request:  stdin, stdout and stderr as SCM_RIGHTS, then
+//             u32 count, count x (u32 length, bytes); the first string is
+//             the client's working directory, the rest are its arguments
+//   response: i32 exit status
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace yslang {
+static std::string default_socket_path() {
+  if (const char *path = std::getenv("YS_SOCKET")) {
+    return path;
+  }
+  if (const char *dir = std::getenv("XDG_RUNTIME_DIR")) {
+    return std::string(dir) + "/ys.sock";
+  }
+  return "/tmp/ys-" + std::to_string(getuid()) + ".sock";
+}
+
+static bool make_socket_address(const std::string &path, sockaddr_un &addr) {
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+  const char *p = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+  char *p = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, p, size);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool send_fds(int sock, const int *fds, size_t count) {
+  char byte = 0;
+  iovec iov = { &byte, 1 };
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+
+  msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+  return sendmsg(sock, &msg, 0) == 1;
+}
+
+static bool recv_fds(int sock, int *fds, size_t count) {
+  char byte;
+  iovec iov = { &byte, 1 };
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+
+  msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  if (recvmsg(sock, &msg, 0) != 1) {
+    return false;
+  }
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+    return false;
+  }
+  std::memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+  return true;
+}
+
+static bool send_strings(int sock, const std::vector<std::string> &strings) {
+  uint32_t count = strings.size();
+  if (!write_all(sock, &count, sizeof(count))) {
+    return false;
+  }
+  for (const auto &str : strings) {
+    uint32_t length = str.size();
+    if (!write_all(sock, &length, sizeof(length)) ||
+        !write_all(sock, str.data(), length)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool recv_strings(int sock, std::vector<std::string> &strings) {
+  uint32_t count;
+  if (!read_all(sock, &count, sizeof(count))) {
+    return false;
+  }
+  strings.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t length;
+    if (!read_all(sock, &length, sizeof(length))) {
+      return false;
+    }
+    std::string str(length, '\0');
+    if (!read_all(sock, &str[0], length)) {
+      return false;
+    }
+    strings.push_back(std::move(str));
+  }
+  return true;
+}
+} // namespace yslang
@@ -0,0 +1,197 @@
+#include "./repl.hpp"
+#include "./codegen.hpp"
+#include "./error.hpp"
+#include "./jit.hpp"
+#include "./parser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+using namespace yslang;
+
+// Expressions are compiled as the body of this function.
+static const char *const expr_func = "__repl";
+
+static std::string decl_name(Decl *decl) {
+  switch (decl->type) {
+  case Decl::Kind::Func:
+    return dynamic_cast<FuncDecl *>(decl)->name;
+  case Decl::Kind::Const:
+    return dynamic_cast<ConstDecl *>(decl)->name;
+  case Decl::Kind::Type:
+    return dynamic_cast<TypeDecl *>(decl)->name->name;
+  case Decl::Kind::Import:
+    break;
+  }
+  error("imports are not supported in the repl");
+}
+
+static bool is_declaration(const std::string &input) {
+  size_t start = input.find_first_not_of(" \t\r\n");
+  if (start == input.npos) {
+    return false;
+  }
+  if (input[start] == '@') {
+    return true;
+  }
+  // A keyword, not the start of a name such as `constant`.
+  for (const char *keyword : { "func", "async", "type", "const", "import" }) {
+    size_t end = start + std::strlen(keyword);
+    if (input.compare(start, end - start, keyword) == 0 &&
+        (end == input.size() || !(isalnum(input[end]) || input[end] == '_'))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Repl::Repl(bool perf_map) : jit(new JIT(perf_map)), perf_map(perf_map) {}
+
+Repl::~Repl() = default;
+
+bool Repl::submit(const std::string &input, int64_t &value) {
+  bool expression = !is_declaration(input);
+  std::string source = input;
+  if (expression) {
+    size_t end = input.find_last_not_of(" \t\r\n;");
+    source = "func " + std::string(expr_func) + "() i64 {\n  return " +
+             input.substr(0, end + 1) + ";\n}\n";
+  }
+
+  Parser parser(source);
+  Program parsed = parser.parse();
+  if (parser.has_error()) {
+    std::string message;
+    for (const auto &msg : parser.error_messages) {
+      message += (message.empty() ? "" : "\n") + msg;
+    }
+    error(message);
+  }
+
+  // The program as it would be with this submission.
+  Program next = program;
+  std::vector<std::string> changed;
+  bool everything = false;
+  for (Decl *decl : parsed.decls) {
+    std::string name = decl_name(decl);
+    auto same = std::find_if(
+        next.decls.begin(), next.decls.end(),
+        [&name](Decl *old) { return decl_name(old) == name; });
+    if (same != next.decls.end()) {
+      *same = decl;
+    } else {
+      next.decls.push_back(decl);
+    }
+    if (decl->type == Decl::Kind::Func) {
+      changed.push_back(name);
+    } else {
+      everything = true;
+    }
+  }
+
+  CodeGen codegen;
+  if (perf_map) {
+    codegen.emitDebugInfo("<repl>");
+  }
+  codegen.generate(&next);
+  llvm::Module *module = codegen.getModule();
+
+  // Callers of a changed function are compiled again along with it.
+  std::set<std::string> stale(changed.begin(), changed.end());
+  std::map<std::string, std::vector<std::string>> callers;
+  for (auto &func : *module) {
+    if (func.isDeclaration() || func.hasLocalLinkage() ||
+        func.hasLinkOnceODRLinkage()) {
+      continue;
+    }
+    std::string name = func.getName().str();
+    if (everything) {
+      stale.insert(name);
+    }
+    for (auto *callee : JIT::callees(&func)) {
+      callers[callee->getName().str()].push_back(name);
+    }
+  }
+  std::vector<std::string> work(stale.begin(), stale.end());
+  while (!work.empty()) {
+    std::string name = work.back();
+    work.pop_back();
+    for (const auto &caller : callers[name]) {
+      if (stale.insert(caller).second) {
+        work.push_back(caller);
+      }
+    }
+  }
+
+  std::vector<std::string> removed;
+  for (const auto &name : stale) {
+    if (defined.count(name) != 0) {
+      removed.push_back(name);
+    }
+  }
+  if (!removed.empty()) {
+    jit->remove(removed);
+    for (const auto &name : removed) {
+      defined.erase(name);
+    }
+  }
+
+  std::vector<std::string> names(stale.begin(), stale.end());
+  auto addresses = jit->add(module, names);
+  defined.insert(names.begin(), names.end());
+  program = next;
+  if (!expression) {
+    return false;
+  }
+
+  // The expression is not kept, so the next one can reuse its name.
+  size_t entry = std::find(names.begin(), names.end(), expr_func) -
+                 names.begin();
+  value = reinterpret_cast<int64_t (*)()>(addresses[entry])();
+  jit->remove({ expr_func });
+  defined.erase(expr_func);
+  program.decls.pop_back();
+  return true;
+}
+
+void Repl::run(std::istream &in, std::ostream &out, bool prompt) {
+  std::string input;
+  int depth = 0;
+  std::string line;
+  while (true) {
+    if (prompt) {
+      out << (input.empty() ? "> " : ". ") << std::flush;
+    }
+    if (!std::getline(in, line)) {
+      break;
+    }
+    if (input.empty() && line.find_first_not_of(" \t\r") == line.npos) {
+      continue;
+    }
+    if (input.empty() && line == ":quit") {
+      break;
+    }
+
+    input += line + "\n";
+    for (char c : line) {
+      depth += c == '{' ? 1 : c == '}' ? -1 : 0;
+    }
+    // Attributes wait for their declaration, past any blank lines.
+    size_t start = line.find_first_not_of(" \t\r");
+    if (depth > 0 || start == line.npos || line[start] == '@') {
+      continue;
+    }
+
+    try {
+      int64_t value;
+      if (submit(input, value)) {
+        out << value << std::endl;
+      }
+    } catch (const Error &e) {
+      out << "err: " << e.what() << std::endl;
+    }
+    input.clear();
+    depth = 0;
+  }
+}
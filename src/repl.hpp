@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "./ast.hpp"
+
+namespace yslang {
+class JIT;
+
+// Reads top-level declarations and i64 expressions one at a time and
+// compiles each into a new module of the same JIT session, so earlier
+// functions stay compiled.
+//
+// The whole program so far is regenerated for every submission, since
+// CodeGen needs every type and signature, but only what changed reaches
+// the JIT: new functions, and for a redefinition, the function and all its
+// callers, whose old code is removed first. A changed type or constant
+// recompiles everything. A submission that fails leaves the earlier
+// definitions as they were.
+//
+// With `perf_map` the code is visible to perf; see JIT. Lines count from
+// the start of each submission.
+class Repl {
+public:
+  explicit Repl(bool perf_map = false);
+  ~Repl();
+
+  // Returns true with the value for an expression, false for declarations.
+  // Throws Error on a mistake.
+  bool submit(const std::string &input, int64_t &value);
+
+  // Reads submissions, each ending at a line where its braces balance,
+  // until EOF or `:quit`, and prints the value of each expression.
+  void run(std::istream &in, std::ostream &out, bool prompt);
+
+private:
+  Program program;
+  std::unique_ptr<JIT> jit;
+  bool perf_map;
+  // Functions in the JIT.
+  std::set<std::string> defined;
+};
+} // namespace yslang
@@ -0,0 +1,205 @@
+#include "./scheduler.hpp"
+#include "./timing.hpp"
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+using namespace yslang;
+
+static double to_ms(TaskGraph::Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+size_t TaskGraph::add(const std::string &name, std::function<bool()> run,
+                      const std::vector<size_t> &deps) {
+  size_t id = tasks.size();
+  tasks.emplace_back();
+  Task &task = tasks.back();
+  task.name = name;
+  task.run = std::move(run);
+  task.deps = deps;
+  task.waiting.reset(new std::atomic<size_t>(deps.size()));
+  for (size_t dep : deps) {
+    tasks[dep].dependents.push_back(id);
+  }
+  return id;
+}
+
+bool TaskGraph::run(unsigned jobs) {
+  jobs = std::max(jobs, 1u);
+  workers.clear();
+  for (unsigned i = 0; i < jobs; i++) {
+    workers.emplace_back(new Worker());
+  }
+  remaining = tasks.size();
+  failed = false;
+  queued = 0;
+  started = Clock::now();
+
+  // Roots are dealt round-robin so every worker starts with something.
+  unsigned dealt = 0;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (tasks[i].deps.empty()) {
+      push(dealt++ % jobs, i);
+    }
+  }
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs; i++) {
+    threads.emplace_back([this, i]() {
+      TimeReport::attachThread();
+      work(i);
+      TimeReport::detachThread();
+    });
+  }
+  work(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  finished = Clock::now();
+  return !failed;
+}
+
+void TaskGraph::work(unsigned self) {
+  while (true) {
+    size_t task;
+    if (!next(self, task)) {
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      idle.wait(lock, [this]() { return queued > 0 || remaining == 0; });
+      if (remaining == 0) {
+        return;
+      }
+      continue;
+    }
+
+    tasks[task].start = Clock::now();
+    bool ok = false;
+    // An exception must not leave a worker thread, so it fails the task.
+    try {
+      ok = tasks[task].run();
+    } catch (const std::exception &e) {
+      std::cerr << "err: " + tasks[task].name + ": " + e.what() + "\n";
+    }
+    tasks[task].end = Clock::now();
+    finish(self, task, ok);
+  }
+}
+
+bool TaskGraph::next(unsigned self, size_t &task) {
+  {
+    // Newest first from our own deque; its inputs are likely still warm.
+    Worker &worker = *workers[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      task = worker.tasks.back();
+      worker.tasks.pop_back();
+      queued--;
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < workers.size(); i++) {
+    Worker &victim = *workers[(self + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskGraph::push(unsigned self, size_t task) {
+  {
+    Worker &worker = *workers[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    queued++;
+  }
+  idle.notify_one();
+}
+
+void TaskGraph::finish(unsigned self, size_t task, bool ok) {
+  tasks[task].done = ok;
+  if (!ok) {
+    failed = true;
+  }
+
+  // A failed task still counts down its dependents so they are skipped
+  // rather than waited for.
+  std::vector<size_t> stack{ task };
+  size_t skipped = 0;
+  while (!stack.empty()) {
+    size_t current = stack.back();
+    stack.pop_back();
+    for (size_t dependent : tasks[current].dependents) {
+      if (--*tasks[dependent].waiting != 0) {
+        continue;
+      }
+      bool ready = true;
+      for (size_t dep : tasks[dependent].deps) {
+        ready = ready && tasks[dep].done;
+      }
+      if (ready) {
+        push(self, dependent);
+      } else {
+        skipped++;
+        stack.push_back(dependent);
+      }
+    }
+  }
+  if ((remaining -= skipped + 1) == 0) {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    idle.notify_all();
+  }
+}
+
+void TaskGraph::printCriticalPath(std::ostream &os) const {
+  if (tasks.empty()) {
+    return;
+  }
+
+  size_t last = 0;
+  Clock::duration work{};
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (!tasks[i].done) {
+      continue;
+    }
+    work += tasks[i].end - tasks[i].start;
+    if (tasks[i].end > tasks[last].end || !tasks[last].done) {
+      last = i;
+    }
+  }
+
+  std::vector<size_t> path;
+  for (size_t current = last;;) {
+    path.push_back(current);
+    const Task &task = tasks[current];
+    if (task.deps.empty()) {
+      break;
+    }
+    current = task.deps[0];
+    for (size_t dep : task.deps) {
+      if (tasks[dep].end > tasks[current].end) {
+        current = dep;
+      }
+    }
+  }
+
+  Clock::duration wall = finished - started;
+  os << std::fixed << std::setprecision(1) << "build: " << to_ms(wall)
+     << "ms wall, " << to_ms(work) << "ms of work on " << workers.size()
+     << " threads\n";
+  os << "critical path:\n";
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    const Task &task = tasks[*it];
+    os << "  " << std::setw(8) << to_ms(task.end - task.start) << "ms  "
+       << task.name << "\n";
+  }
+}
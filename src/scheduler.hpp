@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace yslang {
+// A graph of tasks run on a work-stealing pool. A task becomes ready when
+// all its dependencies have succeeded; it is pushed onto the deque of the
+// worker that finished its last dependency, which keeps dependent work on
+// the same thread. Idle workers steal the oldest task of another worker.
+class TaskGraph {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Returns the task's id. Dependencies must already be added.
+  size_t add(const std::string &name, std::function<bool()> run,
+             const std::vector<size_t> &deps = {});
+
+  // False if any task failed or threw. Tasks depending on a failed one never
+  // run.
+  bool run(unsigned jobs);
+
+  // The chain of tasks that bounded the wall time: the last task to finish,
+  // the dependency that let it start, and so on back to the first.
+  void printCriticalPath(std::ostream &os) const;
+
+private:
+  struct Task {
+    std::string name;
+    std::function<bool()> run;
+    std::vector<size_t> deps;
+    std::vector<size_t> dependents;
+    std::unique_ptr<std::atomic<size_t>> waiting;
+    Clock::time_point start;
+    Clock::time_point end;
+    bool done = false;
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  void work(unsigned self);
+  bool next(unsigned self, size_t &task);
+  void push(unsigned self, size_t task);
+  void finish(unsigned self, size_t task, bool ok);
+
+private:
+  std::vector<Task> tasks;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> remaining;
+  std::atomic<bool> failed;
+
+  // Idle workers sleep until a task is queued or everything is done.
+  std::mutex idle_mutex;
+  std::condition_variable idle;
+  std::atomic<long> queued;
+  Clock::time_point started;
+  Clock::time_point finished;
+};
+} // namespace yslang
@@ -0,0 +1,198 @@
+#include "./server.hpp"
+#include "./error.hpp"
+#include "./protocol.hpp"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <iostream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace yslang;
+
+static int child_pipe[2];
+
+static void on_child(int) {
+  int saved = errno;
+  char byte = 0;
+  // A full pipe wakes the loop all the same.
+  ssize_t written = write(child_pipe[1], &byte, 1);
+  (void)written;
+  errno = saved;
+}
+
+// Ends a request child with a message on the client's stderr. An exception
+// must not leave the child, which would unwind into its copy of the loop.
+[[noreturn]] static void report(const char *message) {
+  std::cout.flush();
+  std::cerr.flush();
+  write_all(2, message, std::strlen(message));
+  write_all(2, "\n", 1);
+  _exit(1);
+}
+
+CompileServer::CompileServer(const std::string &path, Compiler compiler)
+    : path(path), compiler(compiler) {}
+
+int CompileServer::run() {
+  sockaddr_un addr;
+  if (!make_socket_address(path, addr)) {
+    error("socket path is too long: " + path);
+  }
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    error("can not create socket");
+  }
+  unlink(path.c_str());
+  // Only the owner may connect, since requests run with the server's rights.
+  mode_t mask = umask(077);
+  int bound = bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  umask(mask);
+  if (bound != 0 || listen(sock, SOMAXCONN) != 0) {
+    error("can not listen on " + path);
+  }
+
+  warmUp();
+
+  // Requests are reaped in the loop, which a byte on this pipe wakes.
+  if (pipe2(child_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    error("can not create pipe");
+  }
+  signal(SIGCHLD, on_child);
+  // A client that has gone away must not end the server.
+  signal(SIGPIPE, SIG_IGN);
+  std::cerr << "listening on " << path << std::endl;
+  while (true) {
+    pollfd events[2] = { { sock, POLLIN, 0 }, { child_pipe[0], POLLIN, 0 } };
+    if (poll(events, 2, -1) < 0) {
+      continue;
+    }
+    if (events[1].revents != 0) {
+      reap();
+    }
+    if (events[0].revents == 0) {
+      continue;
+    }
+    int conn = accept(sock, nullptr, nullptr);
+    if (conn < 0) {
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(sock);
+      for (const auto &request : requests) {
+        close(request.second);
+      }
+      close(child_pipe[0]);
+      close(child_pipe[1]);
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      serve(conn);
+    }
+    if (pid < 0) {
+      close(conn);
+      continue;
+    }
+    requests[pid] = conn;
+  }
+}
+
+// Sends every finished request's exit status to its client.
+void CompileServer::reap() {
+  char bytes[64];
+  while (read(child_pipe[0], bytes, sizeof(bytes)) > 0) {
+  }
+
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    auto request = requests.find(pid);
+    if (request == requests.end()) {
+      continue;
+    }
+    int32_t result = WIFEXITED(status) ? WEXITSTATUS(status)
+                                       : 128 + WTERMSIG(status);
+    write_all(request->second, &result, sizeof(result));
+    close(request->second);
+    requests.erase(request);
+  }
+}
+
+// Compiles a small program once so that pass registration, target setup and
+// the code behind them are in place before the first fork.
+void CompileServer::warmUp() {
+  llvm::SmallString<128> source;
+  llvm::SmallString<128> object;
+  int fd;
+  if (llvm::sys::fs::createTemporaryFile("ys-warm", "yz", fd, source) ||
+      llvm::sys::fs::createTemporaryFile("ys-warm", "o", object)) {
+    return;
+  }
+  const char program[] = "func main() i64 {\n  return 0;\n}\n";
+  write_all(fd, program, sizeof(program) - 1);
+  close(fd);
+
+  std::vector<std::string> args{ "ys",   "--emit",        "obj",
+                                 "-O",   "2",             "-o",
+                                 object.str().str(), source.str().str() };
+  std::vector<char *> argv;
+  for (auto &arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+  compiler(argv.size() - 1, argv.data());
+
+  llvm::sys::fs::remove(source);
+  llvm::sys::fs::remove(object);
+}
+
+// Runs one request with the client's directory and stdio. The server
+// reports how it ended, even when it crashed.
+void CompileServer::serve(int conn) {
+  int fds[3];
+  std::vector<std::string> request;
+  if (!recv_fds(conn, fds, 3) || !recv_strings(conn, request) ||
+      request.size() < 2) {
+    _exit(1);
+  }
+  close(conn);
+
+  for (int i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+  }
+  for (int i = 0; i < 3; i++) {
+    if (fds[i] > 2) {
+      close(fds[i]);
+    }
+  }
+  if (chdir(request[0].c_str()) != 0) {
+    report(("err: can not enter " + request[0]).c_str());
+  }
+
+  std::vector<std::string> args(request.begin() + 1, request.end());
+  std::vector<char *> argv;
+  for (auto &arg : args) {
+    argv.push_back(&arg[0]);
+  }
+  argv.push_back(nullptr);
+  int status = 1;
+  try {
+    status = compiler(argv.size() - 1, argv.data());
+  } catch (const Error &e) {
+    report((std::string("err: ") + e.what()).c_str());
+  } catch (const std::string &msg) {
+    report(("err: " + msg).c_str());
+  } catch (const std::exception &e) {
+    report((std::string("err: ") + e.what()).c_str());
+  } catch (...) {
+    report("err: unknown exception");
+  }
+  // Skips LLVM's static destructors, which the server would run again.
+  std::cout.flush();
+  std::cerr.flush();
+  _exit(status);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace yslang {
+// Serves compile requests from ys-client on a Unix socket. LLVM is set up
+// once in the server; each request then runs in a fork of it, so it starts
+// warm with its own working directory, stdio and copy of LLVM's global
+// state, and a crash only ends that request.
+class CompileServer {
+public:
+  using Compiler = std::function<int(int argc, char *argv[])>;
+
+  CompileServer(const std::string &path, Compiler compiler);
+
+  // Accepts requests until the process is killed.
+  int run();
+
+private:
+  void warmUp();
+  void reap();
+  [[noreturn]] void serve(int conn);
+
+private:
+  std::string path;
+  Compiler compiler;
+  // Connections of running requests by the pid of their child.
+  std::map<pid_t, int> requests;
+};
+} // namespace yslang
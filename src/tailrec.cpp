@@ -0,0 +1,130 @@
+#include "./tailrec.hpp"
+
+using namespace yslang;
+
+static Ident *make_ident(const std::string &name) {
+  Ident *ident = new Ident();
+  ident->name = name;
+  return ident;
+}
+
+void TailRecElim::run(Program *program) {
+  for (Decl *decl : program->decls) {
+    if (decl->type == Decl::Kind::Func) {
+      transform(dynamic_cast<FuncDecl *>(decl));
+    }
+  }
+}
+
+bool TailRecElim::transform(FuncDecl *func_decl) {
+  // A return in an async function finishes a task; a call there only makes
+  // a new one.
+  if (func_decl->body == nullptr || func_decl->is_async) {
+    return false;
+  }
+
+  func = func_decl;
+  changed = false;
+  rewrite(func->body, false);
+  if (!changed) {
+    return false;
+  }
+
+  BlockStmt *loop_body = new BlockStmt();
+  loop_body->stmts = std::move(func->body->stmts);
+  BranchStmt *fallthrough = new BranchStmt();
+  fallthrough->tok = TokenType::Break;
+  loop_body->stmts.push_back(fallthrough);
+
+  BasicLit *forever = new BasicLit();
+  forever->kind = TokenType::Integer;
+  forever->value = "1";
+
+  WhileStmt *loop = new WhileStmt();
+  loop->cond = forever;
+  loop->body = loop_body;
+
+  func->body->stmts.clear();
+  func->body->stmts.push_back(loop);
+  return true;
+}
+
+Stmt *TailRecElim::rewrite(Stmt *stmt, bool in_loop) {
+  switch (stmt->kind) {
+  case Stmt::Kind::Block: {
+    BlockStmt *block = dynamic_cast<BlockStmt *>(stmt);
+    for (Stmt *&child : block->stmts) {
+      child = rewrite(child, in_loop);
+    }
+    return block;
+  }
+  case Stmt::Kind::If: {
+    IfStmt *if_stmt = dynamic_cast<IfStmt *>(stmt);
+    if_stmt->then_block = rewrite(if_stmt->then_block, in_loop);
+    if (if_stmt->else_block != nullptr) {
+      if_stmt->else_block = rewrite(if_stmt->else_block, in_loop);
+    }
+    return if_stmt;
+  }
+  case Stmt::Kind::While: {
+    WhileStmt *while_stmt = dynamic_cast<WhileStmt *>(stmt);
+    rewrite(while_stmt->body, true);
+    return while_stmt;
+  }
+  case Stmt::Kind::Return: {
+    ReturnStmt *ret = dynamic_cast<ReturnStmt *>(stmt);
+    if (in_loop || !isSelfCall(ret)) {
+      return ret;
+    }
+    changed = true;
+    return lowerSelfCall(dynamic_cast<CallExpr *>(ret->results[0]));
+  }
+  default:
+    return stmt;
+  }
+}
+
+bool TailRecElim::isSelfCall(ReturnStmt *stmt) {
+  if (stmt->results.size() != 1 ||
+      stmt->results[0]->type != Expr::Type::CallExpr) {
+    return false;
+  }
+
+  CallExpr *call = dynamic_cast<CallExpr *>(stmt->results[0]);
+  return call->func->type == Expr::Type::Ident &&
+         dynamic_cast<Ident *>(call->func)->name == func->name &&
+         call->args.size() == func->func_type->fields.size();
+}
+
+BlockStmt *TailRecElim::lowerSelfCall(CallExpr *call) {
+  BlockStmt *block = new BlockStmt();
+  const auto &fields = func->func_type->fields;
+
+  // Every argument is evaluated before any parameter is overwritten.
+  std::vector<std::string> names;
+  for (Expr *arg : call->args) {
+    names.push_back("tailrec." + std::to_string(temps++));
+
+    LetStmt *let = new LetStmt();
+    let->ident = make_ident(names.back());
+    let->type = nullptr;
+    let->expr = arg;
+    block->stmts.push_back(let);
+  }
+
+  for (size_t i = 0; i < fields.size(); i++) {
+    BinaryExpr *assign = new BinaryExpr();
+    assign->lhs = make_ident(fields[i].name->name);
+    assign->op = TokenType::Assign;
+    assign->rhs = make_ident(names[i]);
+
+    ExprStmt *expr_stmt = new ExprStmt();
+    expr_stmt->expr = assign;
+    block->stmts.push_back(expr_stmt);
+  }
+
+  BranchStmt *next = new BranchStmt();
+  next->tok = TokenType::Continue;
+  block->stmts.push_back(next);
+  return block;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "./ast.hpp"
+
+namespace yslang {
+// Turns direct self tail recursion into a loop:
+//
+//   func f(n i64, acc i64) i64 {      func f(n i64, acc i64) i64 {
+//     if n == 0 {                       while 1 {
+//       return acc;                       if n == 0 {
+//     }                          =>         return acc;
+//     return f(n - 1, acc + n);           }
+//   }                                     let t0 = n - 1; let t1 = acc + n;
+//                                         n = t0; acc = t1; continue;
+//                                         break;
+//                                       }
+//                                     }
+//
+// Returns nested in a loop are left alone, since `continue` there would
+// restart the inner loop; CodeGen still marks them as tail calls.
+class TailRecElim {
+public:
+  void run(Program *program);
+
+private:
+  bool transform(FuncDecl *func);
+  Stmt *rewrite(Stmt *stmt, bool in_loop);
+  bool isSelfCall(ReturnStmt *stmt);
+  BlockStmt *lowerSelfCall(CallExpr *call);
+
+private:
+  FuncDecl *func = nullptr;
+  bool changed = false;
+  unsigned temps = 0;
+};
+} // namespace yslang
@@ -0,0 +1,150 @@
+#include "./tiered.hpp"
+#include "./bytecode.hpp"
+#include "./codegen.hpp"
+#include "./error.hpp"
+#include "./jit.hpp"
+#include "./timing.hpp"
+#include <iostream>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace yslang;
+
+TieredRunner::TieredRunner(Program *program, uint64_t threshold,
+                           bool perf_map)
+    : program(program), vm(BytecodeCompiler().compile(program)),
+      perf_map(perf_map) {
+  vm.enableTiering(threshold, [this](size_t index) { enqueue(index); });
+}
+
+TieredRunner::~TieredRunner() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  wakeup.notify_one();
+  if (compiler.joinable()) {
+    compiler.join();
+  }
+}
+
+int64_t TieredRunner::run() { return vm.run(); }
+
+void TieredRunner::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this]() { return queue.empty() && !busy; });
+}
+
+std::vector<std::string> TieredRunner::getCompiled() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return compiled;
+}
+
+// Called by the VM, so it only hands the function over.
+void TieredRunner::enqueue(size_t index) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(index);
+    if (!compiler.joinable()) {
+      compiler = std::thread([this]() { compileLoop(); });
+    }
+  }
+  wakeup.notify_one();
+}
+
+void TieredRunner::compileLoop() {
+  TimeReport::attachThread();
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    wakeup.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (stopping) {
+      break;
+    }
+    size_t index = queue.front();
+    queue.pop_front();
+    busy = true;
+    lock.unlock();
+
+    // A failure leaves the program in bytecode, which still runs it right.
+    if (!failed) {
+      try {
+        compile(index);
+      } catch (const Error &e) {
+        std::cerr << "warn: tiering stopped: " << e.what() << std::endl;
+        failed = true;
+      } catch (const std::string &msg) {
+        std::cerr << "warn: tiering stopped: " << msg << std::endl;
+        failed = true;
+      } catch (const std::exception &e) {
+        std::cerr << "warn: tiering stopped: " << e.what() << std::endl;
+        failed = true;
+      }
+    }
+
+    lock.lock();
+    busy = false;
+    if (queue.empty()) {
+      idle.notify_all();
+    }
+  }
+  lock.unlock();
+  TimeReport::detachThread();
+}
+
+void TieredRunner::compile(size_t index) {
+  const std::string &name = vm.getModule().functions[index].name;
+  if (defined.count(name) != 0) {
+    return;
+  }
+  Phase phase("tier up", name);
+
+  if (!jit) {
+    jit.reset(new JIT(perf_map));
+    // The VM is done with the AST, so CodeGen can take it over.
+    codegen.reset(new CodeGen());
+    if (perf_map) {
+      codegen->emitDebugInfo(program->path);
+    }
+    codegen->generate(program);
+    // Every unit comes out of this module, so checking it once keeps
+    // broken IR away from the JIT.
+    std::string problems;
+    llvm::raw_string_ostream os(problems);
+    if (llvm::verifyModule(*codegen->getModule(), &os)) {
+      error("broken native code: " + os.str());
+    }
+  }
+
+  // The function and everything it reaches that has no native code yet
+  // go into one unit; functions compiled before stay declarations.
+  llvm::Module *module = codegen->getModule();
+  llvm::Function *root = module->getFunction(name);
+  if (root == nullptr) {
+    error("no code for " + name);
+  }
+  std::vector<std::string> names{ name };
+  std::vector<llvm::Function *> work{ root };
+  defined.insert(name);
+  while (!work.empty()) {
+    llvm::Function *func = work.back();
+    work.pop_back();
+    for (auto *callee : JIT::callees(func)) {
+      if (defined.insert(callee->getName().str()).second) {
+        names.push_back(callee->getName().str());
+        work.push_back(callee);
+      }
+    }
+  }
+
+  auto addresses = jit->add(module, names);
+  for (size_t i = 0; i < names.size(); i++) {
+    int func_index = vm.getModule().find(names[i]);
+    if (func_index >= 0 && vm.getModule().functions[func_index].params <=
+                               VM::max_native_params) {
+      vm.setNative(func_index, addresses[i]);
+      std::lock_guard<std::mutex> lock(mutex);
+      compiled.push_back(names[i]);
+    }
+  }
+}
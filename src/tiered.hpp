@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./ast.hpp"
+#include "./vm.hpp"
+
+namespace yslang {
+class CodeGen;
+class JIT;
+
+// Runs a program on the bytecode VM and compiles the functions that turn
+// out hot to native code in the background, with ORC. A function becomes
+// hot after `threshold` calls plus loop iterations; it is compiled at -O2
+// for the host together with everything it calls that is not native yet,
+// and its calls switch over once the code is ready. A call already running
+// finishes in bytecode, so a single long loop in main gains nothing.
+//
+// LLVM is set up on the first hot function: short runs never pay for it.
+// With `perf_map` the native code is visible to perf, with the lines of
+// `program->path`; see JIT.
+class TieredRunner {
+public:
+  TieredRunner(Program *program, uint64_t threshold, bool perf_map = false);
+  // Waits for a compile in flight and drops the queued ones.
+  ~TieredRunner();
+
+  int64_t run();
+  // Blocks until every hot function found so far runs natively.
+  void wait();
+  // Functions running natively, in the order they were compiled.
+  std::vector<std::string> getCompiled();
+
+private:
+  void enqueue(size_t index);
+  void compileLoop();
+  void compile(size_t index);
+
+private:
+  Program *program;
+  VM vm;
+  bool perf_map;
+
+  std::thread compiler;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  std::condition_variable idle;
+  std::deque<size_t> queue;
+  bool busy = false;
+  bool stopping = false;
+  std::vector<std::string> compiled;
+
+  // Owned by the compiler thread.
+  std::unique_ptr<CodeGen> codegen;
+  std::unique_ptr<JIT> jit;
+  std::set<std::string> defined;
+  bool failed = false;
+};
+} // namespace yslang
@@ -0,0 +1,135 @@
+#include "./timing.hpp"
+#include <algorithm>
+#include <atomic>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <mutex>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace yslang;
+
+namespace {
+struct PhaseTotal {
+  const char *name;
+  double wall_ms = 0;
+  double cpu_ms = 0;
+  long peak_rss_kb = 0;
+  unsigned count = 0;
+};
+
+std::atomic<bool> reporting(false);
+std::atomic<bool> tracing(false);
+std::mutex totals_mutex;
+// In order of first use, which follows the pipeline.
+std::vector<PhaseTotal> totals;
+
+// Spans shorter than this are dropped from the trace.
+const unsigned trace_granularity_us = 10;
+} // namespace
+
+static double cpu_ms() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static long peak_rss_kb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void TimeReport::enable() {
+  reporting = true;
+  llvm::TimePassesIsEnabled = true;
+}
+
+bool TimeReport::isEnabled() { return reporting; }
+
+void TimeReport::print(llvm::raw_ostream &os) {
+  {
+    std::lock_guard<std::mutex> lock(totals_mutex);
+    os << "===" << std::string(73, '-') << "===\n"
+       << "                          ys phase timing report\n"
+       << "===" << std::string(73, '-') << "===\n";
+    os << "  phase                     count    wall (ms)     cpu (ms) "
+          "peak rss (MiB)\n";
+    for (const auto &total : totals) {
+      os << llvm::format("  %-24s %6u %12.3f %12.3f %14.1f\n", total.name,
+                         total.count, total.wall_ms, total.cpu_ms,
+                         total.peak_rss_kb / 1024.0);
+    }
+    os << "\n";
+  }
+  llvm::reportAndResetTimings(&os);
+}
+
+void TimeReport::startTrace() {
+  tracing = true;
+  attachThread();
+}
+
+bool TimeReport::isTracing() { return tracing; }
+
+void TimeReport::attachThread() {
+  if (tracing && !llvm::timeTraceProfilerEnabled()) {
+    llvm::timeTraceProfilerInitialize(trace_granularity_us, "ys");
+  }
+}
+
+void TimeReport::detachThread() {
+  if (tracing && llvm::timeTraceProfilerEnabled()) {
+    llvm::timeTraceProfilerFinishThread();
+  }
+}
+
+bool TimeReport::writeTrace(const std::string &path) {
+  std::error_code error_info;
+  llvm::raw_fd_ostream os(path, error_info, llvm::sys::fs::OpenFlags::F_None);
+  if (error_info) {
+    return false;
+  }
+  llvm::timeTraceProfilerWrite(os);
+  llvm::timeTraceProfilerCleanup();
+  tracing = false;
+  return true;
+}
+
+Phase::Phase(const char *name, const std::string &detail)
+    : name(name), timed(reporting), trace(name, detail) {
+  if (timed) {
+    wall_start = std::chrono::steady_clock::now();
+    cpu_start = cpu_ms();
+  }
+}
+
+Phase::~Phase() {
+  if (!timed) {
+    return;
+  }
+
+  double wall_ms = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - wall_start)
+                       .count();
+  double cpu = cpu_ms() - cpu_start;
+  long rss = peak_rss_kb();
+
+  std::lock_guard<std::mutex> lock(totals_mutex);
+  auto it = std::find_if(totals.begin(), totals.end(),
+                         [&](const PhaseTotal &total) {
+                           return std::string(total.name) == name;
+                         });
+  if (it == totals.end()) {
+    totals.push_back(PhaseTotal());
+    it = totals.end() - 1;
+    it->name = name;
+  }
+  it->wall_ms += wall_ms;
+  it->cpu_ms += cpu;
+  it->peak_rss_kb = std::max(it->peak_rss_kb, rss);
+  it->count++;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace yslang {
+// Wall time, CPU time and peak RSS per compiler phase for --time-report,
+// and Chrome trace events for --trace. Both are off by default, and then a
+// Phase costs one branch.
+class TimeReport {
+public:
+  // Also turns on LLVM's per-pass timers, printed after the phases.
+  static void enable();
+  static bool isEnabled();
+  static void print(llvm::raw_ostream &os);
+
+  // Trace events come from LLVM's time trace profiler, which keeps one
+  // buffer per thread: a thread that compiles attaches before its first
+  // Phase and detaches when it is done.
+  static void startTrace();
+  static bool isTracing();
+  static void attachThread();
+  static void detachThread();
+  static bool writeTrace(const std::string &path);
+};
+
+// Adds its lifetime to the phase `name` and opens a trace span of the same
+// name. Nested phases are counted in both. CPU time is the whole process's,
+// so helper threads of a phase are included.
+class Phase {
+public:
+  Phase(const char *name, const std::string &detail = "");
+  ~Phase();
+
+private:
+  const char *name;
+  bool timed;
+  std::chrono::steady_clock::time_point wall_start;
+  double cpu_start = 0;
+  llvm::TimeTraceScope trace;
+};
+} // namespace yslang
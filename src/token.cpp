@@ -19,6 +19,8 @@ std::ostream &operator<<(std::ostream &out, const TokenType type) {
     return out << "String";
   case TokenType::Ident:
     return out << "Ident";
+  case TokenType::Attribute:
+    return out << "Attribute";
 
   // keywords
   case TokenType::Const:
@@ -33,6 +35,10 @@ std::ostream &operator<<(std::ostream &out, const TokenType type) {
     return out << "Else";
   case TokenType::While:
     return out << "While";
+  case TokenType::Break:
+    return out << "Break";
+  case TokenType::Continue:
+    return out << "Continue";
   case TokenType::Return:
     return out << "Return";
   case TokenType::Import:
@@ -41,6 +47,10 @@ std::ostream &operator<<(std::ostream &out, const TokenType type) {
     return out << "Struct";
   case TokenType::Type:
     return out << "Type";
+  case TokenType::Async:
+    return out << "Async";
+  case TokenType::Await:
+    return out << "Await";
 
   case TokenType::Plus:
     return out << "Plus";
@@ -99,7 +109,7 @@ std::ostream &operator<<(std::ostream &out, const TokenType type) {
 std::ostream &operator<<(std::ostream &out, const Token &token) {
   out << token.type;
   if (token.type == TokenType::Integer || token.type == TokenType::String ||
-      token.type == TokenType::Ident) {
+      token.type == TokenType::Ident || token.type == TokenType::Attribute) {
     out << " " << token.str;
   }
   return out;
@@ -8,6 +8,7 @@ enum class TokenType {
   Integer,
   String,
   Ident,
+  Attribute, // @memo
 
   // keywords
   Const,
@@ -16,10 +17,14 @@ enum class TokenType {
   If,
   Else,
   While,
+  Break,
+  Continue,
   Return,
   Import,
   Struct,
   Type,
+  Async,
+  Await,
 
   Plus,  // +
   Minus, // -
@@ -64,6 +69,8 @@ public:
 public:
   TokenType type;
   std::string str;
+  // 1-based line of the first character.
+  size_t line = 0;
 };
 
 } // namespace yslang
@@ -0,0 +1,351 @@
+#include "./vm.hpp"
+#include "./error.hpp"
+#include <cstring>
+#include <limits>
+
+using namespace yslang;
+
+#if defined(__GNUC__) && !defined(YS_SWITCH_DISPATCH)
+#define YS_THREADED_DISPATCH
+#endif
+
+VM::VM(BytecodeModule bytecode) : module(std::move(bytecode)) {
+  module.verify();
+  memo.resize(module.functions.size());
+}
+
+void VM::enableTiering(uint64_t threshold, std::function<void(size_t)> hot) {
+  hot_threshold = threshold;
+  this->hot = std::move(hot);
+  counts.assign(module.functions.size(), 0);
+  native.reset(new std::atomic<void *>[module.functions.size()]());
+}
+
+void VM::setNative(size_t index, void *code) {
+  native[index].store(code, std::memory_order_release);
+}
+
+void VM::count(const BytecodeFunction *func) {
+  size_t index = func - module.functions.data();
+  if (++counts[index] == hot_threshold &&
+      func->params <= max_native_params) {
+    hot(index);
+  }
+}
+
+bool VM::callNative(const BytecodeFunction *callee, const int64_t *args,
+                    int64_t &result) {
+  size_t index = callee - module.functions.data();
+  void *code = native[index].load(std::memory_order_acquire);
+  if (code == nullptr) {
+    count(callee);
+    return false;
+  }
+
+  using I = int64_t;
+  const I *a = args;
+  switch (callee->params) {
+  case 0:
+    result = reinterpret_cast<I (*)()>(code)();
+    break;
+  case 1:
+    result = reinterpret_cast<I (*)(I)>(code)(a[0]);
+    break;
+  case 2:
+    result = reinterpret_cast<I (*)(I, I)>(code)(a[0], a[1]);
+    break;
+  case 3:
+    result = reinterpret_cast<I (*)(I, I, I)>(code)(a[0], a[1], a[2]);
+    break;
+  case 4:
+    result =
+        reinterpret_cast<I (*)(I, I, I, I)>(code)(a[0], a[1], a[2], a[3]);
+    break;
+  case 5:
+    result = reinterpret_cast<I (*)(I, I, I, I, I)>(code)(a[0], a[1], a[2],
+                                                          a[3], a[4]);
+    break;
+  default:
+    result = reinterpret_cast<I (*)(I, I, I, I, I, I)>(code)(
+        a[0], a[1], a[2], a[3], a[4], a[5]);
+    break;
+  }
+  return true;
+}
+
+int64_t VM::run() { return call("main", {}); }
+
+int64_t VM::call(const std::string &name, const std::vector<int64_t> &args) {
+  int index = module.find(name);
+  if (index < 0) {
+    error("undefined function " + name);
+  }
+  const BytecodeFunction *func = &module.functions[index];
+  if (func->params != args.size()) {
+    error("function " + name + " takes " + std::to_string(func->params) +
+          " arguments, got " + std::to_string(args.size()));
+  }
+
+  // new[] leaves the memory untouched, so the pages come from the system
+  // only as the stack grows.
+  if (!stack) {
+    stack.reset(new int64_t[stack_slots]);
+    frames.reset(new Frame[max_depth]);
+  }
+  if (func->registers > stack_slots) {
+    error("stack overflow in " + name);
+  }
+  std::copy(args.begin(), args.end(), stack.get());
+
+  memo_args.clear();
+  if (func->memo) {
+    auto cached = memo[index].find(args);
+    if (cached != memo[index].end()) {
+      return cached->second;
+    }
+    memo_args.push_back(args);
+  }
+  return hot ? execute<true>(func) : execute<false>(func);
+}
+
+[[noreturn]] static void fail_index(int64_t index) {
+  error("index " + std::to_string(index) + " out of range");
+}
+
+static int64_t divide(int64_t lhs, int64_t rhs) {
+  if (rhs == 0) {
+    error("division by zero");
+  }
+  if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1) {
+    error("division overflow");
+  }
+  return lhs / rhs;
+}
+
+// Arithmetic wraps like the generated `add`/`sub`/`mul`.
+static int64_t wrap_add(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) +
+                              static_cast<uint64_t>(rhs));
+}
+
+static int64_t wrap_sub(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) -
+                              static_cast<uint64_t>(rhs));
+}
+
+static int64_t wrap_mul(int64_t lhs, int64_t rhs) {
+  return static_cast<int64_t>(static_cast<uint64_t>(lhs) *
+                              static_cast<uint64_t>(rhs));
+}
+
+template <bool Tiered>
+int64_t VM::execute(const BytecodeFunction *entry) {
+  const BytecodeFunction *functions = module.functions.data();
+  const BytecodeFunction *func = entry;
+  const Instr *pc = func->code.data();
+  int64_t *regs = stack.get();
+  int64_t *stack_end = stack.get() + stack_slots;
+  Frame *frames_begin = frames.get();
+  Frame *frames_end = frames_begin + max_depth;
+  Frame *fp = frames_begin;
+  const BytecodeFunction *callee;
+  int64_t *callee_regs;
+  int64_t result;
+
+#define R(field) regs[pc->field]
+// Not wrapped in do/while, where the switch's `continue` would stop.
+#define NEXT()                                                               \
+  {                                                                          \
+    ++pc;                                                                    \
+    DISPATCH();                                                              \
+  }
+// A jump backwards is a loop iteration.
+#define JUMP()                                                               \
+  {                                                                          \
+    if (Tiered && pc->imm < 0) {                                             \
+      count(func);                                                           \
+    }                                                                        \
+    pc += pc->imm;                                                           \
+    DISPATCH();                                                              \
+  }
+#define JUMP_IF(cond)                                                        \
+  {                                                                          \
+    if (cond) {                                                              \
+      JUMP();                                                                \
+    }                                                                        \
+    NEXT();                                                                  \
+  }
+#define IMM_C static_cast<int64_t>(static_cast<int16_t>(pc->c))
+
+#ifdef YS_THREADED_DISPATCH
+  static void *const labels[] = {
+#define YS_OPCODE_LABEL(name) &&op_##name,
+    YS_OPCODES(YS_OPCODE_LABEL)
+#undef YS_OPCODE_LABEL
+  };
+#define CASE(name) op_##name
+#define DISPATCH() goto *labels[static_cast<uint8_t>(pc->op)]
+  DISPATCH();
+#else
+#define CASE(name) case Opcode::name
+#define DISPATCH() continue
+  for (;;) {
+    switch (pc->op) {
+#endif
+
+  CASE(Move) : R(a) = R(b);
+  NEXT();
+  CASE(Copy) : std::memmove(&R(a), &R(b), pc->imm * sizeof(int64_t));
+  NEXT();
+  CASE(Zero) : std::memset(&R(a), 0, pc->imm * sizeof(int64_t));
+  NEXT();
+  CASE(LoadInt) : R(a) = pc->imm;
+  NEXT();
+  CASE(LoadConst) : R(a) = func->constants[pc->imm];
+  NEXT();
+  CASE(Load) : {
+    uint64_t index = R(c);
+    if (index >= static_cast<uint64_t>(pc->imm)) {
+      fail_index(R(c));
+    }
+    R(a) = regs[pc->b + index];
+    NEXT();
+  }
+  CASE(Store) : {
+    uint64_t index = R(c);
+    if (index >= static_cast<uint64_t>(pc->imm)) {
+      fail_index(R(c));
+    }
+    regs[pc->b + index] = R(a);
+    NEXT();
+  }
+  CASE(Bound) : if (static_cast<uint64_t>(R(a)) >=
+                    static_cast<uint64_t>(pc->imm)) {
+    fail_index(R(a));
+  }
+  NEXT();
+  CASE(Add) : R(a) = wrap_add(R(b), R(c));
+  NEXT();
+  CASE(Sub) : R(a) = wrap_sub(R(b), R(c));
+  NEXT();
+  CASE(Mul) : R(a) = wrap_mul(R(b), R(c));
+  NEXT();
+  CASE(Div) : R(a) = divide(R(b), R(c));
+  NEXT();
+  CASE(AddImm) : R(a) = wrap_add(R(b), pc->imm);
+  NEXT();
+  CASE(SubImm) : R(a) = wrap_sub(R(b), pc->imm);
+  NEXT();
+  CASE(MulImm) : R(a) = wrap_mul(R(b), pc->imm);
+  NEXT();
+  CASE(Equal) : R(a) = R(b) == R(c);
+  NEXT();
+  CASE(NotEqual) : R(a) = R(b) != R(c);
+  NEXT();
+  CASE(Less) : R(a) = R(b) < R(c);
+  NEXT();
+  CASE(LessEqual) : R(a) = R(b) <= R(c);
+  NEXT();
+  CASE(Greater) : R(a) = R(b) > R(c);
+  NEXT();
+  CASE(GreaterEqual) : R(a) = R(b) >= R(c);
+  NEXT();
+
+  CASE(Jump) : JUMP();
+  CASE(JumpIfZero) : JUMP_IF(R(a) == 0);
+  CASE(JumpIfNotZero) : JUMP_IF(R(a) != 0);
+  CASE(JumpIfEqual) : JUMP_IF(R(b) == R(c));
+  CASE(JumpIfNotEqual) : JUMP_IF(R(b) != R(c));
+  CASE(JumpIfLess) : JUMP_IF(R(b) < R(c));
+  CASE(JumpIfLessEqual) : JUMP_IF(R(b) <= R(c));
+  CASE(JumpIfGreater) : JUMP_IF(R(b) > R(c));
+  CASE(JumpIfGreaterEqual) : JUMP_IF(R(b) >= R(c));
+  CASE(JumpIfEqualImm) : JUMP_IF(R(b) == IMM_C);
+  CASE(JumpIfNotEqualImm) : JUMP_IF(R(b) != IMM_C);
+  CASE(JumpIfLessImm) : JUMP_IF(R(b) < IMM_C);
+  CASE(JumpIfLessEqualImm) : JUMP_IF(R(b) <= IMM_C);
+  CASE(JumpIfGreaterImm) : JUMP_IF(R(b) > IMM_C);
+  CASE(JumpIfGreaterEqualImm) : JUMP_IF(R(b) >= IMM_C);
+
+  CASE(CallMemo) : {
+    callee = &functions[pc->imm];
+    callee_regs = &R(a);
+    if (Tiered && callNative(callee, callee_regs, result)) {
+      R(a) = result;
+      NEXT();
+    }
+    std::vector<int64_t> args(&R(a), &R(a) + pc->b);
+    auto &cache = memo[pc->imm];
+    auto cached = cache.find(args);
+    if (cached != cache.end()) {
+      R(a) = cached->second;
+      NEXT();
+    }
+    memo_args.push_back(std::move(args));
+    goto push;
+  }
+  CASE(CallAddImm) : callee = &functions[pc->c];
+  callee_regs = &R(a);
+  callee_regs[callee->params - 1] = wrap_add(R(b), pc->imm);
+  goto call;
+  CASE(Call) : callee = &functions[pc->imm];
+  callee_regs = &R(a);
+call:
+  if (Tiered && callNative(callee, callee_regs, result)) {
+    R(a) = result;
+    NEXT();
+  }
+push:
+  if (fp == frames_end) {
+    error("call depth limit exceeded in " + callee->name);
+  }
+  if (callee_regs + callee->registers > stack_end) {
+    error("stack overflow in " + callee->name);
+  }
+  *fp++ = Frame{ pc + 1, regs, func };
+  func = callee;
+  pc = callee->code.data();
+  regs = callee_regs;
+  DISPATCH();
+  // The arguments replace this frame, which returns to our caller.
+  CASE(CallReturn) : callee = &functions[pc->imm];
+  if (Tiered && callNative(callee, &R(a), result)) {
+    goto ret;
+  }
+  std::memmove(regs, &R(a), pc->b * sizeof(int64_t));
+  if (regs + callee->registers > stack_end) {
+    error("stack overflow in " + callee->name);
+  }
+  func = callee;
+  pc = callee->code.data();
+  DISPATCH();
+  CASE(ReturnMemo) : result = R(a);
+  memo[func - functions][std::move(memo_args.back())] = result;
+  memo_args.pop_back();
+  goto ret;
+  CASE(Return) : result = R(a);
+ret:
+  if (fp == frames_begin) {
+    return result;
+  }
+  --fp;
+  pc = fp->pc;
+  regs = fp->regs;
+  func = fp->func;
+  // The call that returned is the instruction before the return address.
+  regs[pc[-1].a] = result;
+  DISPATCH();
+
+#ifndef YS_THREADED_DISPATCH
+    }
+  }
+#endif
+
+#undef R
+#undef NEXT
+#undef JUMP
+#undef JUMP_IF
+#undef IMM_C
+#undef CASE
+#undef DISPATCH
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./bytecode.hpp"
+
+namespace yslang {
+// Runs a BytecodeModule. All frames live on one preallocated register
+// stack: a callee's frame starts at the caller's argument registers, so a
+// call copies nothing and a return writes one register. With GCC and Clang
+// every handler jumps straight to the next one through a computed goto;
+// other compilers get a switch.
+//
+// Errors match the Interpreter's: division by zero, an index out of range
+// or running out of stack raise an Error.
+//
+// With tiering enabled, the VM counts the calls and loop iterations of
+// every function; native code handed over by setNative then takes the
+// function's calls, while frames already running it stay in bytecode.
+class VM {
+public:
+  // Verifies the module first.
+  explicit VM(BytecodeModule module);
+
+  int64_t run();
+  int64_t call(const std::string &name, const std::vector<int64_t> &args);
+
+  // Calls `hot` with the index of a function, once, when its calls plus
+  // loop iterations reach `threshold`. Only functions with at most
+  // max_native_params parameters are reported.
+  void enableTiering(uint64_t threshold, std::function<void(size_t)> hot);
+  // `code` is an `int64_t (*)(int64_t...)` computing the same as function
+  // `index`. Can be called from any thread while the VM runs.
+  void setNative(size_t index, void *code);
+
+  const BytecodeModule &getModule() const {
+    return module;
+  }
+
+public:
+  static const unsigned max_native_params = 6;
+
+  // Reserved on the first call but only touched as calls go deeper.
+  size_t stack_slots = size_t(1) << 24;
+  size_t max_depth = 1 << 20;
+
+private:
+  struct Frame {
+    const Instr *pc;
+    int64_t *regs;
+    const BytecodeFunction *func;
+  };
+
+  template <bool Tiered> int64_t execute(const BytecodeFunction *entry);
+  // Counts a call or loop iteration of `func`.
+  void count(const BytecodeFunction *func);
+  // Runs `callee` natively if it has native code.
+  bool callNative(const BytecodeFunction *callee, const int64_t *args,
+                  int64_t &result);
+
+private:
+  BytecodeModule module;
+  std::unique_ptr<int64_t[]> stack;
+  std::unique_ptr<Frame[]> frames;
+  // Results of @memo functions, by function index, and the arguments of
+  // the memo calls still running.
+  std::vector<std::map<std::vector<int64_t>, int64_t>> memo;
+  std::vector<std::vector<int64_t>> memo_args;
+
+  uint64_t hot_threshold = 0;
+  std::function<void(size_t)> hot;
+  std::vector<uint64_t> counts;
+  std::unique_ptr<std::atomic<void *>[]> native;
+};
+} // namespace yslang
@@ -0,0 +1,84 @@
+#include "../src/codegen.hpp"
+#include "../src/error.hpp"
+#include "../src/jit.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+#include <llvm/IR/Verifier.h>
+
+static const char *const source = R"(
+async func work(n i64, ms i64) i64 {
+  await sleep(ms);
+  return n * 2;
+}
+
+async func both(n i64) i64 {
+  let a = spawn(work(n, 20));
+  let b = spawn(work(n + 1, 10));
+  return await a + await b;
+}
+
+func main() i64 {
+  return run(both(10));
+}
+)";
+
+static bool calls_intrinsic(llvm::Function *func, llvm::Intrinsic::ID id) {
+  for (auto &block : *func) {
+    for (auto &inst : block) {
+      auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (call != nullptr && call->getCalledFunction() != nullptr &&
+          call->getCalledFunction()->getIntrinsicID() == id) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+TEST_CASE("Async functions are coroutines", "[async]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+  REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+  for (const char *name : { "work", "both", "ys.async.sleep" }) {
+    llvm::Function *func = module->getFunction(name);
+    REQUIRE(func->hasFnAttribute("coroutine.presplit"));
+    REQUIRE(calls_intrinsic(func, llvm::Intrinsic::coro_begin));
+    REQUIRE(calls_intrinsic(func, llvm::Intrinsic::coro_suspend));
+  }
+  llvm::Function *main = module->getFunction("main");
+  REQUIRE_FALSE(main->hasFnAttribute("coroutine.presplit"));
+  REQUIRE(module->getFunction("ys.async.run") != nullptr);
+}
+
+TEST_CASE("The event loop runs tasks on one thread", "[async]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "work", "both", "main" });
+  REQUIRE(reinterpret_cast<int64_t (*)()>(addresses[2])() == 42);
+}
+
+TEST_CASE("Await needs an async function", "[async]") {
+  yslang::Parser parser(R"(
+async func one() i64 {
+  return 1;
+}
+
+func main() i64 {
+  return await one();
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  REQUIRE_THROWS_AS(codegen.generate(&program), yslang::Error);
+}
@@ -0,0 +1,65 @@
+#include "../src/cache.hpp"
+#include "../third_party/catch.hpp"
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+
+static std::string read_file(const std::string &path) {
+  std::ifstream ifs(path);
+  return std::string(std::istreambuf_iterator<char>(ifs),
+                     std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const std::string &content) {
+  std::ofstream ofs(path);
+  ofs << content;
+}
+
+TEST_CASE("Cache keys depend on every part", "[cache]") {
+  using yslang::CompileCache;
+  REQUIRE(CompileCache::key({ "a", "b" }) == CompileCache::key({ "a", "b" }));
+  REQUIRE(CompileCache::key({ "a", "b" }) != CompileCache::key({ "a", "c" }));
+  REQUIRE(CompileCache::key({ "ab", "c" }) != CompileCache::key({ "a", "bc" }));
+}
+
+TEST_CASE("Cache stores and finds outputs", "[cache]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-cache", dir));
+  std::string root = dir.str().str();
+
+  yslang::CompileCache cache(root + "/cache", 0);
+  std::string key = yslang::CompileCache::key({ "func main() i64 {}" });
+  std::string output = root + "/out.o";
+
+  REQUIRE_FALSE(cache.lookup(key, output));
+
+  write_file(root + "/in.o", "object");
+  REQUIRE(cache.insert(key, root + "/in.o"));
+  REQUIRE(cache.lookup(key, output));
+  REQUIRE(read_file(output) == "object");
+
+  llvm::sys::fs::remove_directories(root);
+}
+
+TEST_CASE("Cache evicts beyond its size limit", "[cache]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-cache", dir));
+  std::string root = dir.str().str();
+
+  yslang::CompileCache cache(root + "/cache", 1000);
+  write_file(root + "/in.o", std::string(600, 'x'));
+  cache.insert("first", root + "/in.o");
+  cache.insert("second", root + "/in.o");
+  cache.prune();
+
+  REQUIRE_FALSE(cache.lookup("first", root + "/out.o"));
+  REQUIRE(cache.lookup("second", root + "/out.o"));
+
+  // The next scan waits for the interval.
+  cache.insert("third", root + "/in.o");
+  cache.prune();
+  REQUIRE(cache.lookup("second", root + "/out.o"));
+  REQUIRE(cache.lookup("third", root + "/out.o"));
+
+  llvm::sys::fs::remove_directories(root);
+}
@@ -0,0 +1,253 @@
+#include "../src/consteval.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+
+static void declare_all(yslang::ConstEvaluator &evaluator,
+                        yslang::Program &program) {
+  for (yslang::Decl *decl : program.decls) {
+    evaluator.declare(decl);
+  }
+}
+
+TEST_CASE("Const declarations are folded", "[consteval]") {
+  std::string input = R"(
+const A = 1 + 1
+const B = A * 10 - 3;
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE(evaluator.constant("A", value));
+  REQUIRE(value == 2);
+  REQUIRE(evaluator.constant("B", value));
+  REQUIRE(value == 17);
+}
+
+TEST_CASE("Pure function calls are evaluated", "[consteval]") {
+  std::string input = R"(
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  } else {
+    return fib(n - 1) + fib(n - 2);
+  }
+}
+
+const T = fib(30)
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE(evaluator.constant("T", value));
+  REQUIRE(value == 832040);
+  REQUIRE(evaluator.call("fib", { 11 }, value));
+  REQUIRE(value == 89);
+}
+
+TEST_CASE("Evaluation gives up at the limits", "[consteval]") {
+  std::string input = R"(
+func forever(n i64) i64 {
+  return forever(n + 1);
+}
+
+const C = forever(0)
+const D = D + 1
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE_FALSE(evaluator.constant("C", value));
+  REQUIRE_FALSE(evaluator.constant("D", value));
+  REQUIRE_FALSE(evaluator.call("undefined", {}, value));
+}
+
+TEST_CASE("A call that runs out of steps is not evaluated again",
+          "[consteval]") {
+  std::string input = R"(
+func spin(n i64) i64 {
+  let i = 0;
+  while i < n {
+    i = i + 1;
+  }
+  return i;
+}
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  evaluator.max_steps = 1000;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE_FALSE(evaluator.call("spin", { 5000 }, value));
+  // A larger budget would finish it, but the failure is remembered.
+  evaluator.max_steps = 100000;
+  REQUIRE_FALSE(evaluator.call("spin", { 5000 }, value));
+  REQUIRE(evaluator.call("spin", { 50 }, value));
+  REQUIRE(value == 50);
+}
+
+TEST_CASE("Calls in expressions remember running out of steps",
+          "[consteval]") {
+  std::string input = R"(
+func spin(n i64) i64 {
+  let i = 0;
+  while i < n {
+    i = i + 1;
+  }
+  return i;
+}
+
+func outer(n i64) i64 {
+  return spin(n) + 1;
+}
+
+const SPIN = spin(5000) + 1;
+const OUTER = outer(5000);
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  evaluator.max_steps = 1000;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE_FALSE(evaluator.constant("SPIN", value));
+  REQUIRE_FALSE(evaluator.constant("OUTER", value));
+  evaluator.max_steps = 100000;
+  // Both got the whole budget at their first call site.
+  REQUIRE_FALSE(evaluator.call("spin", { 5000 }, value));
+  REQUIRE_FALSE(evaluator.call("outer", { 5000 }, value));
+  REQUIRE(evaluator.call("outer", { 500 }, value));
+  REQUIRE(value == 501);
+}
+
+TEST_CASE("A nested call that ran out of what was left is tried again",
+          "[consteval]") {
+  std::string input = R"(
+func spin(n i64) i64 {
+  let i = 0;
+  while i < n {
+    i = i + 1;
+  }
+  return i;
+}
+
+func both(n i64) i64 {
+  return spin(n) + spin(n + 1);
+}
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  evaluator.max_steps = 1000;
+  declare_all(evaluator, program);
+
+  // spin(70) takes most of the budget and leaves spin(71) too little.
+  int64_t value;
+  REQUIRE_FALSE(evaluator.call("both", { 70 }, value));
+  REQUIRE(evaluator.call("spin", { 71 }, value));
+  REQUIRE(value == 71);
+}
+
+TEST_CASE("Loops are evaluated", "[consteval]") {
+  std::string input = R"(
+func sum(n i64) i64 {
+  let s = 0;
+  let i = 0;
+  while 1 {
+    i = i + 1;
+    if i > n {
+      break;
+    }
+    if i == 3 {
+      continue;
+    }
+    s = s + i;
+  }
+  return s;
+}
+
+func spin() i64 {
+  while 1 {
+  }
+  return 0;
+}
+
+const S = sum(10)
+const F = spin()
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::ConstEvaluator evaluator;
+  declare_all(evaluator, program);
+
+  int64_t value;
+  REQUIRE(evaluator.constant("S", value));
+  REQUIRE(value == 52);
+  REQUIRE_FALSE(evaluator.constant("F", value));
+}
+
+TEST_CASE("Purity of functions", "[consteval]") {
+  std::string input = R"(
+@memo
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func outside(n i64) i64 {
+  return print(n);
+}
+
+func caller(n i64) i64 {
+  return fib(n) + outside(n);
+}
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  auto *fib = dynamic_cast<yslang::FuncDecl *>(program.decls[0]);
+  REQUIRE(fib->hasAttribute("memo"));
+
+  yslang::ConstEvaluator evaluator;
+  declare_all(evaluator, program);
+
+  REQUIRE(evaluator.isPure("fib"));
+  REQUIRE_FALSE(evaluator.isPure("outside"));
+  REQUIRE_FALSE(evaluator.isPure("caller"));
+}
@@ -0,0 +1,122 @@
+#include "../src/backend.hpp"
+#include "../src/codegen.hpp"
+#include "../src/error.hpp"
+#include "../src/instrument.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+#include <llvm/IR/Instructions.h>
+
+static const char *const source = R"(
+func even(n i64) i64 {
+  if n == 0 {
+    return 1;
+  }
+  return odd(n - 1);
+}
+
+func odd(n i64) i64 {
+  if n == 0 {
+    return 0;
+  }
+  return even(n - 1);
+}
+
+func main() i64 {
+  return even(10);
+}
+)";
+
+static size_t count_calls(llvm::Function *func, const std::string &callee,
+                          bool musttail = false) {
+  size_t count = 0;
+  for (auto &block : *func) {
+    for (auto &inst : block) {
+      auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+      if (call != nullptr && call->getCalledFunction() != nullptr &&
+          call->getCalledFunction()->getName() == callee &&
+          (!musttail || call->isMustTailCall())) {
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+TEST_CASE("Every function counts its calls and cycles", "[instrument]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+  REQUIRE(count_calls(module->getFunction("odd"), "even", true) == 1);
+
+  yslang::Instrumenter(module, "calls,cycles").run();
+  REQUIRE(module->getNamedGlobal("llvm.global_dtors") != nullptr);
+  for (const char *name : { "even", "odd", "main" }) {
+    llvm::Function *func = module->getFunction(name);
+    REQUIRE(count_calls(func, "ys.instrument.enter") == 1);
+
+    size_t returns = 0;
+    for (auto &block : *func) {
+      auto *ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+      if (ret == nullptr) {
+        continue;
+      }
+      returns++;
+      auto *exit = llvm::dyn_cast<llvm::CallInst>(ret->getPrevNode());
+      REQUIRE(exit->getCalledFunction()->getName() == "ys.instrument.exit");
+    }
+    REQUIRE(count_calls(func, "ys.instrument.exit") == returns);
+    // The epilogue sits between a tail call and its return.
+    REQUIRE(count_calls(func, name[0] == 'e' ? "odd" : "even", true) == 0);
+  }
+}
+
+TEST_CASE("Counting calls reads no clock", "[instrument]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+
+  yslang::Instrumenter(module, "calls").run();
+  REQUIRE(count_calls(module->getFunction("even"), "ys.instrument.enter") == 1);
+  REQUIRE(count_calls(module->getFunction("even"), "ys.instrument.exit") == 0);
+  REQUIRE(module->getFunction("llvm.readcyclecounter") == nullptr);
+
+  REQUIRE_THROWS_AS(yslang::Instrumenter(module, "calls,time"), yslang::Error);
+}
+
+TEST_CASE("Modules and units share the instrumentation runtime",
+          "[instrument]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+  yslang::Instrumenter(module, "calls,cycles").run();
+
+  for (const char *name :
+       { "ys.instrument.records", "ys.instrument.child",
+         "ys.instrument.dumped" }) {
+    REQUIRE(module->getNamedGlobal(name)->hasLinkOnceODRLinkage());
+  }
+  REQUIRE(module->getFunction("ys.instrument.dump")->hasLinkOnceODRLinkage());
+
+  // The units --cache-functions compiles: one per function and the data.
+  auto even = yslang::Backend::extractUnit(module, module->getFunction("even"));
+  auto data = yslang::Backend::extractUnit(module, nullptr);
+  auto *local = even->getNamedGlobal("even.instrument");
+  REQUIRE(local != nullptr);
+  REQUIRE(local->hasLocalLinkage());
+  REQUIRE_FALSE(local->isDeclaration());
+  auto *records = even->getNamedGlobal("ys.instrument.records");
+  REQUIRE(records != nullptr);
+  REQUIRE(records->hasLinkOnceODRLinkage());
+  REQUIRE(even->getFunction("ys.instrument.dump") == nullptr);
+  REQUIRE(data->getNamedGlobal("even.instrument") == nullptr);
+  REQUIRE(data->getFunction("ys.instrument.dump")->hasLinkOnceODRLinkage());
+}
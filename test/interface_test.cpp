@@ -0,0 +1,147 @@
+#include "../src/consteval.hpp"
+#include "../src/error.hpp"
+#include "../src/interface.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+#include <atomic>
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <thread>
+
+TEST_CASE("Interfaces carry exports to importers", "[interface]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-import", dir));
+  std::string root = dir.str().str();
+
+  std::string library = R"(
+type Pair struct {
+  a i64;
+  b i64;
+}
+
+const WIDTH = 6 * 7;
+
+func area(h i64) i64 {
+  return h * WIDTH;
+}
+)";
+
+  yslang::Parser library_parser(library);
+  yslang::Program library_program = library_parser.parse();
+  REQUIRE_FALSE(library_parser.has_error());
+
+  yslang::Interface exported;
+  exported.collect(&library_program);
+  exported.write(root + "/shapes.yzi");
+
+  std::string input = R"(
+import shapes;
+
+const DOUBLE = WIDTH * 2;
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::Interface::resolveImports(&program, { root });
+  REQUIRE(program.decls.size() == 5);
+  REQUIRE(program.decls[0]->type == yslang::Decl::Kind::Type);
+  REQUIRE(program.decls[0]->imported);
+
+  auto *area = dynamic_cast<yslang::FuncDecl *>(program.decls[2]);
+  REQUIRE(area->name == "area");
+  REQUIRE(area->body == nullptr);
+  REQUIRE(area->func_type->toJson().to_string() ==
+          dynamic_cast<yslang::FuncDecl *>(library_program.decls[2])
+              ->func_type->toJson()
+              .to_string());
+
+  yslang::ConstEvaluator evaluator;
+  for (yslang::Decl *decl : program.decls) {
+    evaluator.declare(decl);
+  }
+  int64_t value;
+  REQUIRE(evaluator.constant("DOUBLE", value));
+  REQUIRE(value == 84);
+  REQUIRE_FALSE(evaluator.isPure("area"));
+
+  REQUIRE(yslang::Interface::findImports(input, { root }) ==
+          std::vector<std::string>{ root + "/shapes.yzi" });
+
+  llvm::sys::fs::remove_directories(root);
+}
+
+TEST_CASE("Broken and missing interfaces are errors", "[interface]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-import", dir));
+  std::string root = dir.str().str();
+
+  {
+    std::ofstream ofs(root + "/broken.yzi");
+    ofs << "YSI\x01\x05";
+  }
+
+  yslang::Interface interface;
+  REQUIRE_THROWS_AS(interface.read(root + "/broken.yzi"), yslang::Error);
+  REQUIRE_THROWS_AS(interface.read(root + "/missing.yzi"), yslang::Error);
+
+  llvm::sys::fs::remove_directories(root);
+}
+
+TEST_CASE("Concurrent writers publish whole interfaces", "[interface]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-import", dir));
+  std::string root = dir.str().str();
+
+  std::string library;
+  for (int i = 0; i < 2000; i++) {
+    library += "func f" + std::to_string(i) + "(a i64, b i64) i64 {\n" +
+               "  return a + b;\n}\n";
+  }
+  yslang::Parser parser(library);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::Interface exported;
+  exported.collect(&program);
+  exported.write(root + "/many.yzi");
+
+  std::vector<std::thread> writers;
+  std::atomic<bool> failed(false);
+  for (int i = 0; i < 8; i++) {
+    writers.emplace_back([&]() {
+      for (int j = 0; j < 100; j++) {
+        try {
+          exported.write(root + "/many.yzi");
+        } catch (const yslang::Error &) {
+          failed = true;
+        }
+      }
+    });
+  }
+  bool torn = false;
+  for (int j = 0; j < 200; j++) {
+    try {
+      yslang::Interface().read(root + "/many.yzi");
+    } catch (const yslang::Error &) {
+      torn = true;
+    }
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  REQUIRE_FALSE(failed);
+  REQUIRE_FALSE(torn);
+
+  // Only the interface is left behind.
+  std::error_code error_info;
+  size_t files = 0;
+  for (llvm::sys::fs::directory_iterator it(root, error_info), end;
+       it != end && !error_info; it.increment(error_info)) {
+    files++;
+  }
+  REQUIRE(files == 1);
+
+  llvm::sys::fs::remove_directories(root);
+}
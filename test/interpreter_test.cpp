@@ -0,0 +1,126 @@
+#include "../src/error.hpp"
+#include "../src/interpreter.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+
+static int64_t run(const std::string &input) {
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::Interpreter interpreter;
+  interpreter.load(&program);
+  return interpreter.run();
+}
+
+TEST_CASE("Functions, lets and branches are interpreted", "[interpreter]") {
+  REQUIRE(run(R"(
+const BASE = 6 * 7;
+
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  } else {
+    return fib(n - 1) + fib(n - 2);
+  }
+}
+
+func sum(n i64, acc i64) i64 {
+  if n == 0 {
+    return acc;
+  }
+  return sum(n - 1, acc + n);
+}
+
+func main() i64 {
+  let x = fib(15) + BASE;
+  return x - sum(1000000, 0) / 1000000;
+}
+)") == 610 + 42 - 500000);
+}
+
+TEST_CASE("Structs and arrays are values", "[interpreter]") {
+  REQUIRE(run(R"(
+type Pair struct {
+  a i64;
+  b i64;
+}
+
+func main() i64 {
+  let p Pair;
+  p.a = 3;
+  p.b = 4;
+  let q Pair;
+  q = p;
+  q.a = 10;
+
+  let xs [8]i64;
+  let i = 0;
+  while 1 {
+    if i == 8 {
+      break;
+    }
+    xs[i] = i * i;
+    i = i + 1;
+  }
+  return p.a + q.a + p.b + xs[7];
+}
+)") == 3 + 10 + 4 + 49);
+}
+
+TEST_CASE("Memoized functions are cached", "[interpreter]") {
+  REQUIRE(run(R"(
+@memo
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func main() i64 {
+  return fib(90) - 2880067194370816000;
+}
+)") == 120);
+}
+
+TEST_CASE("Undefined behavior is an error", "[interpreter]") {
+  REQUIRE_THROWS_AS(run(R"(
+func main() i64 {
+  let z = 0;
+  return 1 / z;
+}
+)"),
+                    yslang::Error);
+  REQUIRE_THROWS_AS(run(R"(
+func main() i64 {
+  let xs [2]i64;
+  return xs[2];
+}
+)"),
+                    yslang::Error);
+  REQUIRE_THROWS_AS(run(R"(
+func main() i64 {
+  return 99999999999999999999;
+}
+)"),
+                    yslang::Error);
+}
+
+TEST_CASE("An assignment is interpreted as its value", "[interpreter]") {
+  REQUIRE(run(R"(
+func chain(n i64) i64 {
+  let a = 0;
+  let b = 0;
+  let c [2]i64;
+  a = b = c[1] = n + 1;
+  let d = a = a * 2;
+  return a + b + c[1] + d;
+}
+
+func main() i64 {
+  let n = 4;
+  return chain(n);
+}
+)") == 30);
+}
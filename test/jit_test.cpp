@@ -0,0 +1,218 @@
+#include "../src/codegen.hpp"
+#include "../src/jit.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Process.h>
+#include <set>
+#include <sstream>
+#include <vector>
+
+static const char *const source = R"(@memo
+func fib(n i64) i64 {
+  if n < 2 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func twice(n i64) i64 {
+  let m = n;
+  return fib(m) * 2;
+}
+)";
+
+TEST_CASE("Debug info gives statements their lines", "[jit]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.emitDebugInfo("dir/fib.yz");
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+  REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+  // The memo wrapper is generated code; its body has the lines.
+  REQUIRE(module->getFunction("fib")->getSubprogram() == nullptr);
+  auto *body = module->getFunction("fib.memo.body")->getSubprogram();
+  REQUIRE(body->getLine() == 2);
+  REQUIRE(body->getFilename() == "fib.yz");
+  REQUIRE(body->getDirectory() == "dir");
+
+  std::set<unsigned> lines;
+  for (auto &block : *module->getFunction("twice")) {
+    for (auto &inst : block) {
+      if (inst.getDebugLoc()) {
+        lines.insert(inst.getDebugLoc().getLine());
+      }
+    }
+  }
+  REQUIRE(lines == std::set<unsigned>{ 9, 10, 11 });
+}
+
+TEST_CASE("The perf map lists JIT-compiled functions", "[jit]") {
+  std::string path = "/tmp/perf-" +
+                     std::to_string(llvm::sys::Process::getProcessId()) +
+                     ".map";
+  // The jitdump file goes there rather than to ~/.debug.
+  llvm::SmallString<128> dump_dir;
+  REQUIRE_FALSE(
+      llvm::sys::fs::createUniqueDirectory("yslang-jitdump", dump_dir));
+  setenv("JITDUMPDIR", dump_dir.c_str(), 1);
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.emitDebugInfo("fib.yz");
+  codegen.generate(&program);
+
+  {
+    yslang::JIT jit(true);
+    auto addresses = jit.add(codegen.getModule(), { "fib", "twice" });
+    REQUIRE(reinterpret_cast<int64_t (*)(int64_t)>(addresses[1])(10) == 110);
+
+    std::ifstream map(path);
+    std::set<std::string> names;
+    std::string line;
+    while (std::getline(map, line)) {
+      std::istringstream fields(line);
+      std::string start, size, name;
+      REQUIRE(fields >> start >> size >> name);
+      REQUIRE(std::stoull(start, nullptr, 16) != 0);
+      names.insert(name);
+    }
+    REQUIRE(names.count("twice.entry") == 1);
+  }
+
+  // Freed code is listed again after the lines of its load.
+  std::ifstream map(path);
+  std::vector<std::string> loaded, freed;
+  std::string line;
+  while (std::getline(map, line)) {
+    const std::string mark = " (freed)";
+    if (line.size() > mark.size() &&
+        line.compare(line.size() - mark.size(), mark.size(), mark) == 0) {
+      freed.push_back(line.substr(0, line.size() - mark.size()));
+    } else {
+      REQUIRE(freed.empty());
+      loaded.push_back(line);
+    }
+  }
+  REQUIRE(freed == loaded);
+  llvm::sys::fs::remove(path);
+  llvm::sys::fs::remove_directories(dump_dir);
+}
+
+TEST_CASE("Comparisons are values of 0 or 1", "[jit]") {
+  yslang::Parser parser(R"(
+func id(n i64) i64 {
+  return n;
+}
+
+func less(a i64, b i64) i64 {
+  return a < b;
+}
+
+func count(a i64, b i64) i64 {
+  let x = a == b;
+  let ne = a != b;
+  let gt = a > b;
+  let ge = a >= b;
+  return x + ne * 2 + gt * 4 + ge * 8 + id(a <= b) * 16;
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  REQUIRE_FALSE(llvm::verifyModule(*codegen.getModule(), &llvm::errs()));
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "id", "less", "count" });
+  auto less = reinterpret_cast<int64_t (*)(int64_t, int64_t)>(addresses[1]);
+  auto count = reinterpret_cast<int64_t (*)(int64_t, int64_t)>(addresses[2]);
+  REQUIRE(less(1, 2) == 1);
+  REQUIRE(less(2, 1) == 0);
+  REQUIRE(count(3, 3) == 1 + 8 + 16);
+  REQUIRE(count(4, 3) == 2 + 4 + 8);
+  REQUIRE(count(3, 4) == 2 + 16);
+}
+
+TEST_CASE("An assignment is its value in native code", "[jit]") {
+  yslang::Parser parser(R"(
+func chain(n i64) i64 {
+  let a = 0;
+  let b = 0;
+  let c [2]i64;
+  a = b = c[1] = n + 1;
+  let d = a = a * 2;
+  return a + b + c[1] + d;
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  REQUIRE_FALSE(llvm::verifyModule(*codegen.getModule(), &llvm::errs()));
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "chain" });
+  REQUIRE(reinterpret_cast<int64_t (*)(int64_t)>(addresses[0])(4) == 30);
+}
+
+TEST_CASE("A let without a value starts at zero", "[jit]") {
+  yslang::Parser parser(R"(
+type Pair struct {
+  a i64;
+  b i64;
+}
+
+func sum(n i64) i64 {
+  let total = 0;
+  let i = 0;
+  while i < n {
+    let x i64;
+    let p Pair;
+    let xs [4]i64;
+    total = total + x + p.b + xs[3];
+    x = 100;
+    p.b = 10;
+    xs[3] = 1;
+    i = i + 1;
+  }
+  return total;
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "sum" });
+  REQUIRE(reinterpret_cast<int64_t (*)(int64_t)>(addresses[0])(5) == 0);
+}
+
+TEST_CASE("Constants fold into their uses", "[jit]") {
+  yslang::Parser parser(R"(
+const BASE = 6 * 7;
+
+func base() i64 {
+  return BASE;
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  REQUIRE(codegen.getModule()->global_empty());
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "base" });
+  REQUIRE(reinterpret_cast<int64_t (*)()>(addresses[0])() == 42);
+}
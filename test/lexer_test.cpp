@@ -79,3 +79,34 @@ TEST_CASE("Lex struct keyword", "[lexer]") {
   TEST_TOKEN(lexer, yslang::TokenType::BraceR, "")
   TEST_TOKEN(lexer, yslang::TokenType::TEOF, "")
 }
+
+TEST_CASE("Lex loop keywords", "[lexer]") {
+  std::string input = "while i != 0 {\n"
+                      "  break;\n"
+                      "  continue;\n"
+                      "}\n";
+
+  yslang::Lexer lexer(input);
+
+  TEST_TOKEN(lexer, yslang::TokenType::While, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Ident, "i")
+  TEST_TOKEN(lexer, yslang::TokenType::NotEqual, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Integer, "0")
+  TEST_TOKEN(lexer, yslang::TokenType::BraceL, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Break, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Semicolon, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Continue, "")
+  TEST_TOKEN(lexer, yslang::TokenType::Semicolon, "")
+  TEST_TOKEN(lexer, yslang::TokenType::BraceR, "")
+  TEST_TOKEN(lexer, yslang::TokenType::TEOF, "")
+}
+
+TEST_CASE("Lex attributes", "[lexer]") {
+  std::string input = "@memo func";
+
+  yslang::Lexer lexer(input);
+
+  TEST_TOKEN(lexer, yslang::TokenType::Attribute, "memo")
+  TEST_TOKEN(lexer, yslang::TokenType::Func, "")
+  TEST_TOKEN(lexer, yslang::TokenType::TEOF, "")
+}
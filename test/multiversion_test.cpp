@@ -0,0 +1,102 @@
+#include "../src/backend.hpp"
+#include "../src/codegen.hpp"
+#include "../src/jit.hpp"
+#include "../src/parser.hpp"
+#include "../third_party/catch.hpp"
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Verifier.h>
+
+static const char *const source = R"(@multiversion
+func sum(n i64) i64 {
+  let s = 0;
+  let i = 0;
+  while i < n {
+    s = s + i * i;
+    i = i + 1;
+  }
+  return s;
+}
+
+func main() i64 {
+  return sum(100);
+}
+)";
+
+static std::string attribute(llvm::Function *func, const char *kind) {
+  return func->getFnAttribute(kind).getValueAsString().str();
+}
+
+TEST_CASE("Functions carry the target CPU and features", "[multiversion]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+
+  yslang::BackendOptions options;
+  options.cpu = "skylake";
+  options.features = "+avx2,-avx512f";
+  yslang::Backend backend(options);
+  backend.setTarget(module);
+  llvm::Function *main = module->getFunction("main");
+  REQUIRE(attribute(main, "target-cpu") == "skylake");
+  REQUIRE(attribute(main, "target-features") == "+avx2,-avx512f");
+  REQUIRE(module->getFunction("sum")->hasFnAttribute("yslang.multiversion"));
+}
+
+TEST_CASE("A multiversion function becomes clones behind an ifunc",
+          "[multiversion]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+  llvm::Module *module = codegen.getModule();
+
+  yslang::BackendOptions options;
+  options.cpu = "x86-64";
+  yslang::Backend backend(options);
+  llvm::Triple triple(backend.getTriple());
+  if (triple.getArch() != llvm::Triple::x86_64) {
+    return;
+  }
+  backend.optimize(module);
+  REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+  auto *ifunc = module->getNamedIFunc("sum");
+  REQUIRE(ifunc != nullptr);
+  auto *resolver = llvm::dyn_cast<llvm::Function>(ifunc->getResolver());
+  REQUIRE(resolver != nullptr);
+  REQUIRE(resolver->getName() == "sum.resolver");
+  REQUIRE(module->getFunction("__cpu_indicator_init")->hasOneUse());
+
+  const char *const clones[][2] = { { "sum.avx512", "+avx512f" },
+                                    { "sum.avx2", "+avx2" },
+                                    { "sum.sse4.2", "+sse4.2" } };
+  for (const auto &clone : clones) {
+    llvm::Function *func = module->getFunction(clone[0]);
+    REQUIRE(func != nullptr);
+    REQUIRE(func->hasLocalLinkage());
+    REQUIRE(attribute(func, "target-cpu") == "x86-64");
+    REQUIRE(attribute(func, "target-features") == clone[1]);
+  }
+  llvm::Function *fallback = module->getFunction("sum.default");
+  REQUIRE(fallback != nullptr);
+  REQUIRE_FALSE(fallback->hasFnAttribute("yslang.multiversion"));
+}
+
+TEST_CASE("The JIT compiles multiversion functions for the host",
+          "[multiversion]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen codegen;
+  codegen.generate(&program);
+
+  yslang::JIT jit;
+  auto addresses = jit.add(codegen.getModule(), { "sum", "main" });
+  REQUIRE(reinterpret_cast<int64_t (*)(int64_t)>(addresses[0])(100) ==
+          328350);
+  REQUIRE(reinterpret_cast<int64_t (*)()>(addresses[1])() == 328350);
+}
@@ -306,3 +306,151 @@ func hoge(a int) int {
 
   REQUIRE(program.toJson().to_string() == expected);
 }
+
+TEST_CASE("While statement", "[parser]") {
+  std::string input = R"(
+func count(n i64) i64 {
+  while n != 0 {
+    if n <= 5 {
+      break;
+    }
+    n = n - 1;
+    continue;
+  }
+  return n;
+})";
+
+  std::string expected = R"({
+  "kind": "Program",
+  "path": "",
+  "decls": [
+    {
+      "kind": "FuncDecl",
+      "name": "count",
+      "type": {
+        "kind": "FunctionType",
+        "result": {
+          "kind": "IdentType",
+          "name": {
+            "kind": "Ident",
+            "name": "i64"
+          }
+        },
+        "fields": [
+          {
+            "kind": "Field",
+            "name": {
+              "kind": "Ident",
+              "name": "n"
+            },
+            "type": {
+              "kind": "IdentType",
+              "name": {
+                "kind": "Ident",
+                "name": "i64"
+              }
+            }
+          }
+        ]
+      },
+      "body": {
+        "kind": "BlockStmt",
+        "stmts": [
+          {
+            "kind": "WhileStmt",
+            "cond": {
+              "kind": "BinaryExpr",
+              "lhs": {
+                "kind": "Ident",
+                "name": "n"
+              },
+              "op": "NotEqual",
+              "rhs": {
+                "kind": "Integer",
+                "value": "0"
+              }
+            },
+            "body": {
+              "kind": "BlockStmt",
+              "stmts": [
+                {
+                  "kind": "IfStmt",
+                  "cond": {
+                    "kind": "BinaryExpr",
+                    "lhs": {
+                      "kind": "Ident",
+                      "name": "n"
+                    },
+                    "op": "LessEqual",
+                    "rhs": {
+                      "kind": "Integer",
+                      "value": "5"
+                    }
+                  },
+                  "then_block": {
+                    "kind": "BlockStmt",
+                    "stmts": [
+                      {
+                        "kind": "BranchStmt",
+                        "tok": "Break"
+                      }
+                    ]
+                  }
+                },
+                {
+                  "kind": "ExprStmt",
+                  "expr": {
+                    "kind": "BinaryExpr",
+                    "lhs": {
+                      "kind": "Ident",
+                      "name": "n"
+                    },
+                    "op": "Assign",
+                    "rhs": {
+                      "kind": "BinaryExpr",
+                      "lhs": {
+                        "kind": "Ident",
+                        "name": "n"
+                      },
+                      "op": "Minus",
+                      "rhs": {
+                        "kind": "Integer",
+                        "value": "1"
+                      }
+                    }
+                  }
+                },
+                {
+                  "kind": "BranchStmt",
+                  "tok": "Continue"
+                }
+              ]
+            }
+          },
+          {
+            "kind": "ReturnStmt",
+            "results": [
+              {
+                "kind": "Ident",
+                "name": "n"
+              }
+            ]
+          }
+        ]
+      }
+    }
+  ]
+})";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+
+  if (parser.has_error()) {
+    for (const auto &msg : parser.error_messages) {
+      FAIL_CHECK(msg);
+    }
+    FAIL("Parser has errors");
+  }
+
+  REQUIRE(program.toJson().to_string() == expected);
+}
@@ -0,0 +1,126 @@
+#include "../src/backend.hpp"
+#include "../src/codegen.hpp"
+#include "../src/error.hpp"
+#include "../src/parser.hpp"
+#include "../src/profile.hpp"
+#include "../third_party/catch.hpp"
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/FileSystem.h>
+
+static std::string temp_profile(const std::string &content) {
+  llvm::SmallString<128> path;
+  REQUIRE_FALSE(llvm::sys::fs::createTemporaryFile("yslang", "yprof", path));
+  std::ofstream ofs(path.str().str());
+  ofs << content;
+  return path.str().str();
+}
+
+static const char *const source = R"(
+func clamp(n i64) i64 {
+  if n < 0 {
+    return 0;
+  }
+  return n;
+}
+
+func spare(n i64) i64 {
+  return n;
+}
+
+func main() i64 {
+  let i = 0;
+  while i < 10 {
+    i = i + clamp(i);
+  }
+  return i;
+}
+)";
+
+TEST_CASE("Profiles from several runs are merged", "[profile]") {
+  std::string first = temp_profile("clamp 10 1 9\nmain 1 10 1\n");
+  std::string second = temp_profile("clamp 5 0 5\nmain 1 3 1 7 0\n");
+
+  yslang::Profile profile;
+  profile.read(first);
+  profile.read(first);
+  REQUIRE(profile.find("clamp")->entry == 20);
+  REQUIRE(profile.find("clamp")->branches == std::vector<uint64_t>{ 2, 18 });
+  REQUIRE(profile.find("spare") == nullptr);
+
+  // Lines of different versions of a function only agree on the entries.
+  profile.read(second);
+  REQUIRE(profile.find("clamp")->branches.size() == 2);
+  REQUIRE(profile.find("main")->stale);
+  REQUIRE(profile.find("main")->entry == 3);
+  REQUIRE(profile.serialize() == "clamp 25 2 23\nmain 3\n");
+
+  REQUIRE_THROWS_AS(profile.read(temp_profile("clamp 1 2\n")), yslang::Error);
+  llvm::sys::fs::remove(first);
+  llvm::sys::fs::remove(second);
+}
+
+TEST_CASE("CodeGen instruments and uses profiles", "[profile]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::CodeGen instrumented;
+  instrumented.instrument("run.yprof");
+  instrumented.generate(&program);
+  llvm::Module *module = instrumented.getModule();
+  REQUIRE(module->getNamedGlobal("clamp.counters") != nullptr);
+  REQUIRE(module->getNamedGlobal("llvm.global_dtors") != nullptr);
+  REQUIRE(module->getFunction("ys.profile.write") != nullptr);
+
+  yslang::Profile profile;
+  profile.read(temp_profile("clamp 10 1 9\nspare 0\nmain 1 10 1\n"));
+  yslang::CodeGen optimized;
+  optimized.useProfile(&profile);
+  optimized.generate(&program);
+  module = optimized.getModule();
+  REQUIRE(module->getProfileSummary(false) != nullptr);
+  auto *entry = module->getFunction("clamp")->getMetadata("prof");
+  REQUIRE(llvm::mdconst::extract<llvm::ConstantInt>(entry->getOperand(1))
+              ->getZExtValue() == 10);
+  REQUIRE(module->getFunction("spare")->hasFnAttribute(llvm::Attribute::Cold));
+
+  unsigned weighted = 0;
+  for (auto &block : *module->getFunction("clamp")) {
+    auto *branch = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+    if (branch != nullptr && branch->isConditional()) {
+      uint64_t taken, not_taken;
+      REQUIRE(branch->extractProfMetadata(taken, not_taken));
+      REQUIRE(taken == 1);
+      REQUIRE(not_taken == 9);
+      weighted++;
+    }
+  }
+  REQUIRE(weighted == 1);
+}
+
+TEST_CASE("Functions compiled on their own share the counters", "[profile]") {
+  yslang::Parser parser(source);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  yslang::CodeGen instrumented;
+  instrumented.instrument("run.yprof");
+  instrumented.generate(&program);
+  llvm::Module *module = instrumented.getModule();
+
+  // The units --cache-functions compiles: one per function and the data.
+  auto clamp =
+      yslang::Backend::extractUnit(module, module->getFunction("clamp"));
+  auto data = yslang::Backend::extractUnit(module, nullptr);
+
+  auto *used = clamp->getNamedGlobal("clamp.counters");
+  REQUIRE(used != nullptr);
+  REQUIRE(used->isDeclaration());
+  REQUIRE_FALSE(used->use_empty());
+  auto *defined = data->getNamedGlobal("clamp.counters");
+  REQUIRE_FALSE(defined->isDeclaration());
+  REQUIRE(defined->getVisibility() == llvm::GlobalValue::HiddenVisibility);
+  REQUIRE_FALSE(data->getFunction("ys.profile.write")->isDeclaration());
+  REQUIRE(clamp->getFunction("ys.profile.write") == nullptr);
+}
@@ -0,0 +1,79 @@
+#include "../src/error.hpp"
+#include "../src/repl.hpp"
+#include "../third_party/catch.hpp"
+#include <sstream>
+
+static int64_t eval(yslang::Repl &repl, const std::string &input) {
+  int64_t value = 0;
+  REQUIRE(repl.submit(input, value));
+  return value;
+}
+
+TEST_CASE("The REPL compiles one submission at a time", "[repl]") {
+  yslang::Repl repl;
+  int64_t value;
+  REQUIRE_FALSE(repl.submit(R"(
+func square(n i64) i64 {
+  return n * n;
+}
+
+func area(n i64) i64 {
+  return square(n) * SIDES;
+}
+
+const SIDES = 2;
+)",
+                            value));
+  REQUIRE(eval(repl, "area(3)") == 18);
+
+  // Callers follow a redefinition, and so do constants.
+  repl.submit("func square(n i64) i64 {\n  return n * n * n;\n}", value);
+  REQUIRE(eval(repl, "area(3);") == 54);
+  repl.submit("const SIDES = 3;", value);
+  REQUIRE(eval(repl, "area(2) + SIDES") == 27);
+
+  // A mistake keeps the earlier definitions.
+  REQUIRE_THROWS_AS(
+      repl.submit("func square(n i64) i64 {\n  return m;\n}", value),
+      yslang::Error);
+  REQUIRE_THROWS_AS(repl.submit("area(", value), yslang::Error);
+  REQUIRE_THROWS_AS(repl.submit("missing(1)", value), yslang::Error);
+  REQUIRE(eval(repl, "area(2)") == 24);
+
+  std::istringstream in(R"(
+@memo
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+fib(90)
+1 +
+:quit
+square(2)
+)");
+  std::ostringstream out;
+  repl.run(in, out, false);
+  REQUIRE(out.str().find("2880067194370816120\nerr: ") == 0);
+  REQUIRE(out.str().find("\n8\n") == std::string::npos);
+}
+
+TEST_CASE("Names that start like keywords are expressions", "[repl]") {
+  yslang::Repl repl;
+  int64_t value;
+  REQUIRE_FALSE(repl.submit(
+      "func function_total(n i64) i64 {\n  return n + 1;\n}", value));
+  REQUIRE_FALSE(repl.submit("func types(n i64) i64 {\n  return n;\n}", value));
+  REQUIRE_FALSE(repl.submit("const constant = 4;", value));
+  REQUIRE(eval(repl, "function_total(3)") == 4);
+  REQUIRE(eval(repl, "types(1)") == 1);
+  REQUIRE(eval(repl, "constant + 1") == 5);
+
+  // An attribute waits for its declaration past blank lines.
+  std::istringstream in("@memo\n\n  \nfunc twice(n i64) i64 {\n"
+                        "  return n * 2;\n}\ntwice(21)\n");
+  std::ostringstream out;
+  repl.run(in, out, false);
+  REQUIRE(out.str() == "42\n");
+}
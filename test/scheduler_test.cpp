@@ -0,0 +1,94 @@
+#include "../src/build.hpp"
+#include "../src/error.hpp"
+#include "../src/scheduler.hpp"
+#include "../third_party/catch.hpp"
+#include <fstream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <mutex>
+
+static void write_file(const std::string &path, const std::string &content) {
+  std::ofstream ofs(path);
+  ofs << content;
+}
+
+TEST_CASE("Tasks run after their dependencies", "[scheduler]") {
+  yslang::TaskGraph graph;
+  std::mutex mutex;
+  std::vector<std::string> order;
+  auto task = [&](const std::string &name) {
+    return [&, name]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+      return true;
+    };
+  };
+
+  size_t a = graph.add("a", task("a"));
+  size_t b = graph.add("b", task("b"), { a });
+  size_t c = graph.add("c", task("c"), { a });
+  graph.add("d", task("d"), { b, c });
+  REQUIRE(graph.run(4));
+
+  REQUIRE(order.size() == 4);
+  REQUIRE(order.front() == "a");
+  REQUIRE(order.back() == "d");
+}
+
+TEST_CASE("Dependents of a failed task are skipped", "[scheduler]") {
+  yslang::TaskGraph graph;
+  std::atomic<int> ran(0);
+
+  size_t a = graph.add("a", [&]() { return false; });
+  graph.add("b", [&]() { return bool(++ran); }, { a });
+  graph.add("c", [&]() { return bool(++ran); });
+  REQUIRE_FALSE(graph.run(2));
+  REQUIRE(ran == 1);
+}
+
+TEST_CASE("A task that throws fails", "[scheduler]") {
+  yslang::TaskGraph graph;
+  std::atomic<int> ran(0);
+
+  size_t a = graph.add("a", [&]() -> bool {
+    return std::stoll("99999999999999999999") > 0;
+  });
+  graph.add("b", [&]() { return bool(++ran); }, { a });
+  REQUIRE_FALSE(graph.run(2));
+  REQUIRE(ran == 0);
+}
+
+TEST_CASE("Modules are ordered by imports", "[build]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("ys-build-test", dir));
+  std::string base = dir.str().str();
+
+  write_file(base + "/app.yz", "import b\nimport a\n"
+                               "func main() i64 {\n  return 0;\n}\n");
+  write_file(base + "/a.yz", "func a() i64 {\n  return 1;\n}\n");
+  write_file(base + "/b.yz", "import a\n");
+
+  yslang::ModuleGraph graph;
+  graph.discover(base + "/app.yz", { base });
+  const auto &modules = graph.getModules();
+  REQUIRE(modules.size() == 3);
+  REQUIRE(modules[0].name == "a");
+  REQUIRE(modules[1].name == "b");
+  REQUIRE(modules[2].name == "app");
+  REQUIRE(modules[2].imports.size() == 2);
+
+  write_file(base + "/a.yz", "import b\n");
+  yslang::ModuleGraph cyclic;
+  REQUIRE_THROWS_AS(cyclic.discover(base + "/app.yz", { base }),
+                    yslang::Error);
+
+  // A root named like the module it imports from elsewhere.
+  REQUIRE_FALSE(llvm::sys::fs::create_directory(base + "/other"));
+  write_file(base + "/other/b.yz", "import b\n");
+  write_file(base + "/b.yz", "func b() i64 {\n  return 2;\n}\n");
+  yslang::ModuleGraph clash;
+  REQUIRE_THROWS_AS(clash.discover(base + "/other/b.yz", { base }),
+                    yslang::Error);
+
+  llvm::sys::fs::remove_directories(base);
+}
@@ -0,0 +1,144 @@
+#include "../src/error.hpp"
+#include "../src/protocol.hpp"
+#include "../src/server.hpp"
+#include "../third_party/catch.hpp"
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <iostream>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <sys/wait.h>
+
+static std::string read_pipe(int fd) {
+  std::string result;
+  char buffer[256];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    result.append(buffer, n);
+  }
+  close(fd);
+  return result;
+}
+
+TEST_CASE("Strings and descriptors cross the socket", "[server]") {
+  int socks[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0);
+  int pipe_fds[2];
+  REQUIRE(pipe(pipe_fds) == 0);
+
+  REQUIRE(yslang::send_fds(socks[0], &pipe_fds[1], 1));
+  REQUIRE(yslang::send_strings(socks[0], { "/dir", "", "--emit" }));
+  close(pipe_fds[1]);
+
+  int fd;
+  std::vector<std::string> strings;
+  REQUIRE(yslang::recv_fds(socks[1], &fd, 1));
+  REQUIRE(yslang::recv_strings(socks[1], strings));
+  REQUIRE(strings == std::vector<std::string>{ "/dir", "", "--emit" });
+  REQUIRE(yslang::write_all(fd, "ok", 2));
+  close(fd);
+  REQUIRE(read_pipe(pipe_fds[0]) == "ok");
+
+  close(socks[0]);
+  close(socks[1]);
+}
+
+// Sends a request as ys-client does and gives its status, stdout and stderr.
+static int request(const std::string &path,
+                   const std::vector<std::string> &strings, std::string &out,
+                   std::string &err) {
+  sockaddr_un addr;
+  REQUIRE(yslang::make_socket_address(path, addr));
+  int sock = -1;
+  for (int tries = 0; tries < 500; tries++) {
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ==
+        0) {
+      break;
+    }
+    close(sock);
+    sock = -1;
+    usleep(10000);
+  }
+  REQUIRE(sock >= 0);
+
+  int out_pipe[2];
+  int err_pipe[2];
+  REQUIRE(pipe(out_pipe) == 0);
+  REQUIRE(pipe(err_pipe) == 0);
+  const int fds[3] = { 0, out_pipe[1], err_pipe[1] };
+  REQUIRE(yslang::send_fds(sock, fds, 3));
+  REQUIRE(yslang::send_strings(sock, strings));
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+
+  int32_t status = -1;
+  REQUIRE(yslang::read_all(sock, &status, sizeof(status)));
+  close(sock);
+  out = read_pipe(out_pipe[0]);
+  err = read_pipe(err_pipe[0]);
+  return status;
+}
+
+TEST_CASE("The server runs requests in the client's directory",
+          "[server]") {
+  llvm::SmallString<128> dir;
+  REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("yslang-server", dir));
+  std::string path = dir.str().str() + "/ys.sock";
+
+  yslang::CompileServer server(path, [](int argc, char *argv[]) -> int {
+    std::string command = argc > 1 ? argv[1] : "";
+    if (command == "cwd") {
+      char cwd[PATH_MAX];
+      std::cout << getcwd(cwd, sizeof(cwd)) << std::flush;
+      return 3;
+    }
+    if (command == "throw") {
+      yslang::error("broken");
+    }
+    if (command == "throw-int") {
+      throw 42;
+    }
+    if (command == "crash") {
+      // Unlike SIGSEGV, this can not be caught by the test runner.
+      std::raise(SIGKILL);
+    }
+    return 0;
+  });
+  pid_t pid = fork();
+  REQUIRE(pid >= 0);
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    try {
+      server.run();
+    } catch (...) {
+    }
+    _exit(1);
+  }
+
+  std::string out, err;
+  REQUIRE(request(path, { dir.str().str(), "ys", "cwd" }, out, err) == 3);
+  REQUIRE(out == dir.str().str());
+  REQUIRE(err.empty());
+
+  REQUIRE(request(path, { dir.str().str(), "ys", "throw" }, out, err) == 1);
+  REQUIRE(err == "err: broken\n");
+
+  // Anything else thrown must not reach the child's copy of the loop.
+  REQUIRE(request(path, { dir.str().str(), "ys", "throw-int" }, out, err) ==
+          1);
+  REQUIRE(err == "err: unknown exception\n");
+
+  std::string missing = dir.str().str() + "/missing";
+  REQUIRE(request(path, { missing, "ys", "cwd" }, out, err) == 1);
+  REQUIRE(err == "err: can not enter " + missing + "\n");
+
+  REQUIRE(request(path, { dir.str().str(), "ys", "crash" }, out, err) ==
+          128 + SIGKILL);
+
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, 0);
+  llvm::sys::fs::remove_directories(dir);
+}
@@ -0,0 +1,58 @@
+#include "../src/consteval.hpp"
+#include "../src/parser.hpp"
+#include "../src/tailrec.hpp"
+#include "../third_party/catch.hpp"
+
+TEST_CASE("Self tail calls become a loop", "[tailrec]") {
+  std::string input = R"(
+func sum(n i64, acc i64) i64 {
+  if n == 0 {
+    return acc;
+  }
+  return sum(n - 1, acc + n);
+}
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  yslang::TailRecElim().run(&program);
+
+  auto *func = dynamic_cast<yslang::FuncDecl *>(program.decls[0]);
+  REQUIRE(func->body->stmts.size() == 1);
+  REQUIRE(func->body->stmts[0]->kind == yslang::Stmt::Kind::While);
+
+  // Far deeper than the evaluator's recursion limit.
+  yslang::ConstEvaluator evaluator;
+  evaluator.declare(func);
+  int64_t value;
+  REQUIRE(evaluator.call("sum", { 100000, 0 }, value));
+  REQUIRE(value == 5000050000);
+}
+
+TEST_CASE("Non tail calls are kept", "[tailrec]") {
+  std::string input = R"(
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func spin(n i64) i64 {
+  while n > 0 {
+    return spin(n - 1);
+  }
+  return 0;
+}
+)";
+
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  std::string before = program.toJson().to_string();
+  yslang::TailRecElim().run(&program);
+  REQUIRE(program.toJson().to_string() == before);
+}
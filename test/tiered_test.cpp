@@ -0,0 +1,54 @@
+#include "../src/parser.hpp"
+#include "../src/tiered.hpp"
+#include "../third_party/catch.hpp"
+#include <algorithm>
+
+TEST_CASE("Hot functions move to native code", "[tiered]") {
+  yslang::Parser parser(R"(
+@memo
+func slow(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return slow(n - 1) + slow(n - 2);
+}
+
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func count(n i64, acc i64) i64 {
+  if n == 0 {
+    return acc + fib(10);
+  }
+  return count(n - 1, acc + 1);
+}
+
+func main() i64 {
+  let i = 0;
+  let total = 0;
+  while i < 200 {
+    total = total + fib(15) + slow(60) / 1000000000;
+    i = i + 1;
+  }
+  return total + count(10000, 0);
+}
+)");
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+
+  int64_t expected = 200 * (610 + 1548008755920 / 1000000000) + 10000 + 55;
+  yslang::TieredRunner runner(&program, 100);
+  REQUIRE(runner.run() == expected);
+
+  // The second run calls the native code.
+  runner.wait();
+  auto compiled = runner.getCompiled();
+  for (const char *name : { "main", "fib", "slow", "count" }) {
+    REQUIRE(std::count(compiled.begin(), compiled.end(), name) == 1);
+  }
+  REQUIRE(runner.run() == expected);
+}
@@ -0,0 +1,223 @@
+#include "../src/bytecode.hpp"
+#include "../src/error.hpp"
+#include "../src/parser.hpp"
+#include "../src/vm.hpp"
+#include "../third_party/catch.hpp"
+
+static yslang::BytecodeModule compile(const std::string &input) {
+  yslang::Parser parser(input);
+  yslang::Program program = parser.parse();
+  REQUIRE_FALSE(parser.has_error());
+  return yslang::BytecodeCompiler().compile(&program);
+}
+
+static int64_t run(const std::string &input) {
+  return yslang::VM(compile(input)).run();
+}
+
+TEST_CASE("Functions, lets and branches run on the VM", "[vm]") {
+  REQUIRE(run(R"(
+const BASE = 6 * 7;
+const BIG = 5000000000;
+
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  } else {
+    return fib(n - 1) + fib(n - 2);
+  }
+}
+
+func sum(n i64, acc i64) i64 {
+  if n == 0 {
+    return acc;
+  }
+  return sum(n - 1, acc + n);
+}
+
+func sign(n i64) i64 {
+  if 0 < n {
+    return 1;
+  } else if n == 0 {
+    return 0;
+  }
+  return 0 - 1;
+}
+
+func main() i64 {
+  let x = fib(15) + BASE;
+  x = x - sum(1000000, 0) / 1000000;
+  return x + BIG / 1000000000 + sign(0 - 7) * 100;
+}
+)") == 610 + 42 - 500000 + 5 - 100);
+}
+
+TEST_CASE("Struct and array locals live in registers", "[vm]") {
+  REQUIRE(run(R"(
+type Point struct {
+  x i64;
+  y i64;
+}
+
+type Shape struct {
+  id i64;
+  points [3]Point;
+}
+
+func main() i64 {
+  let shapes [4]Shape;
+  let i = 0;
+  while i < 4 {
+    shapes[i].id = i;
+    let j = 0;
+    while j < 3 {
+      shapes[i].points[j].x = i * 10 + j;
+      shapes[i].points[j].y = 0 - j;
+      j = j + 1;
+    }
+    i = i + 1;
+  }
+
+  let copy Shape;
+  copy = shapes[2];
+  shapes[3] = copy;
+  shapes[3].points[0] = shapes[1].points[2];
+
+  let total = 0;
+  i = 0;
+  while i < 4 {
+    i = i + 1;
+    if i == 2 {
+      continue;
+    }
+    total = total + shapes[i - 1].points[2].x;
+  }
+  return total + shapes[3].id * 1000 + shapes[3].points[0].x * 100;
+}
+)") == 2 + 22 + 22 + 2000 + 1200);
+}
+
+TEST_CASE("Tail calls and memoized calls keep the stack small", "[vm]") {
+  REQUIRE(run(R"(
+@memo
+func fib(n i64) i64 {
+  if n <= 1 {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+func even(n i64) i64 {
+  if n == 0 {
+    return 1;
+  }
+  return odd(n - 1);
+}
+
+func odd(n i64) i64 {
+  if n == 0 {
+    return 0;
+  }
+  return even(n - 1);
+}
+
+func main() i64 {
+  return fib(90) - 2880067194370816000 + even(10000000);
+}
+)") == 121);
+}
+
+TEST_CASE("Bytecode is saved and loaded", "[vm]") {
+  std::string data = compile(R"(
+func square(n i64) i64 {
+  return n * n;
+}
+
+func main() i64 {
+  return square(0 - 40000) / 100000 + 123456789012;
+}
+)")
+                         .serialize();
+  REQUIRE(yslang::BytecodeModule::isBytecode(data));
+
+  yslang::BytecodeModule module;
+  module.deserialize(data);
+  REQUIRE(yslang::VM(module).run() == 16000 + 123456789012);
+
+  // A damaged file is rejected rather than run.
+  REQUIRE_THROWS_AS(module.deserialize(data.substr(0, data.size() - 1)),
+                    yslang::Error);
+  yslang::BytecodeModule loop = compile(R"(
+func main() i64 {
+  let i = 0;
+  while i < 3 {
+    i = i + 1;
+  }
+  return i;
+}
+)");
+  for (yslang::Instr &instr : loop.functions[0].code) {
+    if (instr.op == yslang::Opcode::Jump) {
+      instr.imm = 1000;
+    }
+  }
+  REQUIRE_THROWS_AS(module.deserialize(loop.serialize()), yslang::Error);
+}
+
+TEST_CASE("The VM reports errors", "[vm]") {
+  REQUIRE_THROWS_AS(run(R"(
+func main() i64 {
+  let z = 0;
+  return 1 / z;
+}
+)"),
+                    yslang::Error);
+  REQUIRE_THROWS_AS(run(R"(
+func main() i64 {
+  let xs [2]i64;
+  let i = 2;
+  return xs[i];
+}
+)"),
+                    yslang::Error);
+  REQUIRE_THROWS_AS(run(R"(
+func down(n i64) i64 {
+  return down(n + 1) + 1;
+}
+
+func main() i64 {
+  return down(0);
+}
+)"),
+                    yslang::Error);
+  // Structs are not passed between functions in registers.
+  REQUIRE_THROWS_AS(compile(R"(
+type Pair struct {
+  a i64;
+  b i64;
+}
+
+func first(p Pair) i64 {
+  return p.a;
+}
+)"),
+                    yslang::Error);
+}
+
+TEST_CASE("An assignment is its value on the VM", "[vm]") {
+  REQUIRE(run(R"(
+func chain(n i64) i64 {
+  let a = 0;
+  let b = 0;
+  let c [2]i64;
+  a = b = c[1] = n + 1;
+  let d = a = a * 2;
+  return a + b + c[1] + d;
+}
+
+func main() i64 {
+  let n = 4;
+  return chain(n);
+}
+)") == 30);
+}